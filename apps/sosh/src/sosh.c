@@ -166,6 +166,67 @@ static int ps(int argc, char **argv)
     return 0;
 }
 
+/* Format a ratio to a tenth. */
+static char *ratio(char buf[32], unsigned long num, unsigned long den, const char *unit)
+{
+    unsigned long tenths = den == 0 ? 0 : num * 10 / den;
+    snprintf(buf, 32, "%lu.%lu%s", tenths / 10, tenths % 10, unit);
+    return buf;
+}
+
+static int mem(int argc, char **argv)
+{
+    sos_mem_stats_t stats;
+    char buf[32];
+
+    if (argc != 1) {
+        printf("usage: %s\n", argv[0]);
+        return 1;
+    }
+
+    if (sos_mem_stats(&stats) < 0) {
+        printf("%s: failed to get memory statistics\n", argv[0]);
+        return 1;
+    }
+
+    printf("frames:    %lu total, %lu free, %lu allocated (%lu pageable), %lu peak\n",
+           stats.frames, stats.frames_free, stats.frames_allocated, stats.frames_pageable,
+           stats.frames_max_allocated);
+    printf("untyped:   %lu KiB managed\n", stats.ut_bytes / 1024);
+    printf("paging:    %lu shadow table frames, %lu seL4 structures\n", stats.page_table_frames,
+           stats.paging_structures);
+    printf("cslots:    %lu used, %lu peak\n", stats.cslots_used, stats.cslots_max_used);
+    printf("swap:      %lu slots used\n", stats.swap_used);
+    printf("swap out:  %lu pages in %lu writes, %s\n", stats.swap_pageouts, stats.swap_writes,
+           ratio(buf, stats.swap_pageouts, stats.swap_writes, " per I/O"));
+    printf("swap in:   %lu pages in %lu reads, %s, %lu prefetched\n", stats.swap_pageins, stats.swap_reads,
+           ratio(buf, stats.swap_pageins, stats.swap_reads, " per I/O"), stats.swap_prefetches);
+    printf("zswap:     %lu pages in %lu frames, %lu KiB compressed, %s\n", stats.zswap_pages,
+           stats.zswap_frames, stats.zswap_bytes / 1024,
+           ratio(buf, stats.zswap_pages * 4096, stats.zswap_bytes, ":1"));
+    unsigned long pageins = stats.zswap_pageins + stats.swap_pageins;
+    printf("zswap use: %lu stored, %lu loaded, %lu left for swap, %lu%% of page-ins from memory\n",
+           stats.zswap_pageouts, stats.zswap_pageins, stats.zswap_rejects,
+           pageins == 0 ? 0 : stats.zswap_pageins * 100 / pageins);
+    printf("asids:     %lu of %lu used in %lu pools\n", stats.asids_used, stats.asids_capacity,
+           stats.asid_pools);
+
+    printf("SIZE     FREE  SPLIT\n");
+    for (int i = 0; i < SOS_MEM_SIZE_CLASSES; i++) {
+        if (stats.ut_free[i] == 0 && stats.ut_split[i] == 0) {
+            continue;
+        }
+        unsigned long bytes = 1ul << (i + SOS_MEM_MIN_SIZE_BITS);
+        if (bytes >= 1024) {
+            printf("%4luK %7lu %6lu\n", bytes / 1024, stats.ut_free[i], stats.ut_split[i]);
+        } else {
+            printf("%4luB %7lu %6lu\n", bytes, stats.ut_free[i], stats.ut_split[i]);
+        }
+    }
+
+    return 0;
+}
+
 static int exec(int argc, char **argv)
 {
     pid_t pid;
@@ -318,7 +379,7 @@ struct command commands[] = { { "dir", dir }, { "ls", dir }, { "cat", cat }, {
         "cp", cp
     }, { "ps", ps }, { "exec", exec }, {"sleep", second_sleep}, {"msleep", milli_sleep},
     {"time", second_time}, {"mtime", micro_time}, {"kill", kill},
-    {"benchmark", benchmark}
+    {"benchmark", benchmark}, {"mem", mem}
 };
 
 int main(void)
@@ -149,6 +149,10 @@ struct cspace {
 
     /* backup slots to use if we need to map frames for cspace bookkeeping */
     seL4_CPtr watermark[WATERMARK_SLOTS];
+
+    /* the number of slots currently allocated, and the most ever allocated at once */
+    size_t n_slots_used;
+    size_t max_slots_used;
 };
 
 typedef enum {
@@ -369,6 +369,9 @@ seL4_CPtr cspace_alloc_slot(cspace_t *cspace)
         cptr = top_index;
         bf_set_bit(cspace->top_bf, cptr);
     }
+
+    cspace->n_slots_used++;
+    cspace->max_slots_used = MAX(cspace->max_slots_used, cspace->n_slots_used);
     return cptr;
 }
 
@@ -384,6 +387,9 @@ void cspace_free_slot(cspace_t *cspace, seL4_CPtr cptr)
             ZF_LOGE("Attempting to delete slot greater than cspace bounds");
             return;
         }
+        if (bf_get_bit(cspace->top_bf, cptr)) {
+            cspace->n_slots_used--;
+        }
         bf_clr_bit(cspace->top_bf, cptr);
     } else {
         if (cptr > CNODE_SLOTS(CNODE_SIZE_BITS + cspace->top_lvl_size_bits)) {
@@ -395,7 +401,11 @@ void cspace_free_slot(cspace_t *cspace, seL4_CPtr cptr)
         if (cspace->n_bot_lvl_nodes > node) {
             seL4_Word cnode = CNODE_INDEX(cptr);
             if (cspace->bot_lvl_nodes[node]->n_cnodes > cnode) {
-                bf_clr_bit(cspace->bot_lvl_nodes[node]->cnodes[cnode].bf, BOT_LVL_INDEX(cptr));
+                unsigned long *bf = cspace->bot_lvl_nodes[node]->cnodes[cnode].bf;
+                if (bf_get_bit(bf, BOT_LVL_INDEX(cptr))) {
+                    cspace->n_slots_used--;
+                }
+                bf_clr_bit(bf, BOT_LVL_INDEX(cptr));
             } else {
                 ZF_LOGE("Attempting to free unallocated cptr %lx", cptr);
             }
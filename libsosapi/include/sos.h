@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <sel4/sel4.h>
+#include <sos_protocol.h>
 
 /* System calls for SOS */
 
@@ -24,9 +25,7 @@
 #define TIMER_IPC_EP_CAP   (0x2)
 
 /* Limits */
-#define PROCESS_MAX_FILES 16
 #define MAX_IO_BUF 0x1000
-#define N_NAME 32
 
 /* file modes */
 #define FM_EXEC  1
@@ -50,13 +49,6 @@ typedef struct {
 
 typedef int pid_t;
 
-typedef struct {
-    pid_t     pid;
-    unsigned  size;            /* in pages */
-    unsigned  stime;           /* start time in msec since booting */
-    char      command[N_NAME]; /* Name of exectuable */
-} sos_process_t;
-
 /* I/O system calls */
 
 int sos_sys_open(const char *path, fmode_t mode);
@@ -129,6 +121,16 @@ void sos_sys_usleep(int usec);
 /* Sleeps for the specified number of microseconds.
  */
 
+int sos_mem_stats(sos_mem_stats_t *stats);
+/* Returns the current memory usage of SOS through "stats".
+ * Returns 0 if successful, -1 otherwise.
+ */
+
+pid_t sos_fork(void);
+/* Creates a copy of the calling process, which shares its memory copy on write.
+ * Returns the ID of the child to the parent and 0 to the child, or -1 on failure.
+ */
+
 
 /*************************************************************************/
 /*                                   */
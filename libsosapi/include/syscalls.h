@@ -33,5 +33,7 @@ long sys_read(va_list ap);
 long sys_ioctl(va_list ap);
 long sys_brk(va_list ap);
 long sys_mmap(va_list ap);
+long sys_munmap(va_list ap);
+long sys_msync(va_list ap);
 long sys_writev(va_list ap);
 long sys_write(va_list ap);
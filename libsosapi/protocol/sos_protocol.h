@@ -0,0 +1,132 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+/* The IPC protocol spoken between SOS and user processes */
+
+#pragma once
+
+#include <sel4/sel4.h>
+
+/*
+ * SOS syscall numbers, passed in the first message register of a request.
+ *
+ * Number 1 is deliberately left unimplemented, tty_test uses it to block.
+ */
+#define SOS_SYSCALL0            0
+#define SOS_SYSCALL_MEM_STATS   2
+/* MR1: new end of the heap, or 0 to query it. Reply MR0: end of the heap */
+#define SOS_SYSCALL_BRK         3
+/*
+ * MR1: length, MR2: PROT_ flags, MR3: MAP_ flags, MR4: file descriptor, MR5: offset in the file.
+ * Reply MR0: address of the mapping, 0 on failure
+ */
+#define SOS_SYSCALL_MMAP        4
+/* MR1: address, MR2: length. Reply MR0: 0 on success, -1 on failure */
+#define SOS_SYSCALL_MUNMAP      5
+/* Reply MR0: pid of the child to the parent, 0 to the child, -1 on failure */
+#define SOS_SYSCALL_FORK        6
+/* MR1: address, MR2: size, MR3: writable. Reply MR0: 0 on success, -1 on failure */
+#define SOS_SYSCALL_SHARE_VM    7
+/* MR1: path, MR2: length of the path, MR3: O_ flags. Reply MR0: file descriptor, -1 on failure */
+#define SOS_SYSCALL_OPEN        8
+/* MR1: file descriptor. Reply MR0: 0 on success, -1 on failure */
+#define SOS_SYSCALL_CLOSE       9
+/*
+ * MR1: file descriptor, MR2: buffer, MR3: length. Reply MR0: bytes transferred, -1 on failure
+ *
+ * SOS reads and writes the buffer in place, so any length is done in a single call.
+ */
+#define SOS_SYSCALL_READ        10
+#define SOS_SYSCALL_WRITE       11
+/* MR1: address, MR2: length. Reply MR0: 0 on success, -1 on failure */
+#define SOS_SYSCALL_MSYNC       12
+/* Reply MR0: pid of the caller */
+#define SOS_SYSCALL_MY_ID       13
+/*
+ * MR1: array of sos_process_t, MR2: length of the array.
+ * Reply MR0: number of processes written to the array, -1 on failure
+ */
+#define SOS_SYSCALL_PROCESS_STATUS 14
+
+/* Open files of a process, including the 0, 1 and 2 that muslc assumes are open */
+#define PROCESS_MAX_FILES       16
+/* Longest path SOS_SYSCALL_OPEN accepts */
+#define SOS_PATH_MAX            255
+
+/* Longest name of a process, including the terminating NUL */
+#define N_NAME 32
+
+/* Description of a process, as returned by SOS_SYSCALL_PROCESS_STATUS */
+typedef struct {
+    int       pid;
+    unsigned  size;            /* in pages */
+    unsigned  stime;           /* start time in msec since booting */
+    char      command[N_NAME]; /* Name of exectuable */
+} sos_process_t;
+
+/* Untyped size classes reported in sos_mem_stats_t, from endpoints to large pages */
+#define SOS_MEM_MIN_SIZE_BITS   seL4_EndpointBits
+#define SOS_MEM_SIZE_CLASSES    (seL4_LargePageBits - seL4_EndpointBits + 1)
+
+/*
+ * Memory usage of SOS, returned word by word in the message registers of the
+ * reply to SOS_SYSCALL_MEM_STATS.
+ */
+typedef struct {
+    /* frames provisioned into the frame table */
+    seL4_Word frames;
+    /* frames ready to be allocated, including those kept zeroed */
+    seL4_Word frames_free;
+    /* frames currently allocated */
+    seL4_Word frames_allocated;
+    /* allocated frames that may be paged out */
+    seL4_Word frames_pageable;
+    /* the most frames ever allocated at once */
+    seL4_Word frames_max_allocated;
+    /* non-device memory managed by the untyped allocator, in bytes */
+    seL4_Word ut_bytes;
+    /* free untypeds of each size, indexed by size bits - SOS_MEM_MIN_SIZE_BITS */
+    seL4_Word ut_free[SOS_MEM_SIZE_CLASSES];
+    /* untypeds of each size split into smaller ones */
+    seL4_Word ut_split[SOS_MEM_SIZE_CLASSES];
+    /* frames holding SOS's shadow page tables of user processes */
+    seL4_Word page_table_frames;
+    /* 4K seL4 paging structures allocated to map pages */
+    seL4_Word paging_structures;
+    /* cslots of SOS's cspace in use, and the most ever in use at once */
+    seL4_Word cslots_used;
+    seL4_Word cslots_max_used;
+    /* swap slots holding a page */
+    seL4_Word swap_used;
+    /* pages written out to swap, and the clustered writes they took */
+    seL4_Word swap_pageouts;
+    seL4_Word swap_writes;
+    /* pages read in from swap, and the clustered reads they took */
+    seL4_Word swap_pageins;
+    seL4_Word swap_reads;
+    /* pages read in ahead of a fault on a neighbour */
+    seL4_Word swap_prefetches;
+    /* frames of the compressed store, and the pages and bytes they hold */
+    seL4_Word zswap_frames;
+    seL4_Word zswap_pages;
+    seL4_Word zswap_bytes;
+    /* pages put in and read back from the compressed store */
+    seL4_Word zswap_pageouts;
+    seL4_Word zswap_pageins;
+    /* pages left for the swap file as they compressed poorly or did not fit */
+    seL4_Word zswap_rejects;
+    /* ASID pools made, and the ASIDs in use and available across them */
+    seL4_Word asid_pools;
+    seL4_Word asids_used;
+    seL4_Word asids_capacity;
+} sos_mem_stats_t;
+
+#define SOS_MEM_STATS_WORDS (sizeof(sos_mem_stats_t) / sizeof(seL4_Word))
@@ -19,26 +19,44 @@
 
 int sos_sys_open(const char *path, fmode_t mode)
 {
-    assert(!"You need to implement this");
-    return -1;
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 4);
+    seL4_SetMR(0, SOS_SYSCALL_OPEN);
+    seL4_SetMR(1, (seL4_Word) path);
+    seL4_SetMR(2, strlen(path));
+    seL4_SetMR(3, mode);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0);
 }
 
 int sos_sys_close(int file)
 {
-    assert(!"You need to implement this");
-    return -1;
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 2);
+    seL4_SetMR(0, SOS_SYSCALL_CLOSE);
+    seL4_SetMR(1, file);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0);
+}
+
+/* SOS accesses the buffer in place, so it is never split into MAX_IO_BUF chunks. */
+static int sos_sys_io(seL4_Word syscall, int file, const char *buf, size_t nbyte)
+{
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 4);
+    seL4_SetMR(0, syscall);
+    seL4_SetMR(1, file);
+    seL4_SetMR(2, (seL4_Word) buf);
+    seL4_SetMR(3, nbyte);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0);
 }
 
 int sos_sys_read(int file, char *buf, size_t nbyte)
 {
-    assert(!"You need to implement this");
-    return -1;
+    return sos_sys_io(SOS_SYSCALL_READ, file, buf, nbyte);
 }
 
 int sos_sys_write(int file, const char *buf, size_t nbyte)
 {
-    assert(!"You need to implement this");
-    return -1;
+    return sos_sys_io(SOS_SYSCALL_WRITE, file, buf, nbyte);
 }
 
 int sos_getdirent(int pos, char *name, size_t nbyte)
@@ -67,15 +85,20 @@ int sos_process_delete(pid_t pid)
 
 pid_t sos_my_id(void)
 {
-    assert(!"You need to implement this");
-    return -1;
-
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 1);
+    seL4_SetMR(0, SOS_SYSCALL_MY_ID);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0);
 }
 
 int sos_process_status(sos_process_t *processes, unsigned max)
 {
-    assert(!"You need to implement this");
-    return -1;
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 3);
+    seL4_SetMR(0, SOS_SYSCALL_PROCESS_STATUS);
+    seL4_SetMR(1, (seL4_Word) processes);
+    seL4_SetMR(2, max);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0);
 }
 
 pid_t sos_process_wait(pid_t pid)
@@ -95,3 +118,38 @@ int64_t sos_sys_time_stamp(void)
     assert(!"You need to implement this");
     return -1;
 }
+
+int sos_mem_stats(sos_mem_stats_t *stats)
+{
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 1);
+    seL4_SetMR(0, SOS_SYSCALL_MEM_STATS);
+    tag = seL4_Call(SOS_IPC_EP_CAP, tag);
+    if (seL4_MessageInfo_get_length(tag) != SOS_MEM_STATS_WORDS) {
+        return -1;
+    }
+
+    seL4_Word *words = (seL4_Word *) stats;
+    for (size_t i = 0; i < SOS_MEM_STATS_WORDS; i++) {
+        words[i] = seL4_GetMR(i);
+    }
+    return 0;
+}
+
+pid_t sos_fork(void)
+{
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 1);
+    seL4_SetMR(0, SOS_SYSCALL_FORK);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0);
+}
+
+int sos_share_vm(void *adr, size_t size, int writable)
+{
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 4);
+    seL4_SetMR(0, SOS_SYSCALL_SHARE_VM);
+    seL4_SetMR(1, (seL4_Word) adr);
+    seL4_SetMR(2, size);
+    seL4_SetMR(3, !!writable);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0);
+}
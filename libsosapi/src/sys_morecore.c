@@ -17,62 +17,76 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <assert.h>
+#include <sel4/sel4.h>
+#include <sos.h>
 
 /*
- * Statically allocated morecore area.
- *
- * This is rather terrible, but is the simplest option without a
- * huge amount of infrastructure.
+ * The heap and mappings are managed by SOS, which allocates or reads in their
+ * pages when they are first touched.
  */
-#define MORECORE_AREA_BYTE_SIZE 0x100000
-char morecore_area[MORECORE_AREA_BYTE_SIZE];
-
-/* Pointer to free space in the morecore area. */
-static uintptr_t morecore_base = (uintptr_t) &morecore_area;
-static uintptr_t morecore_top = (uintptr_t) &morecore_area[MORECORE_AREA_BYTE_SIZE];
-
-/* Actual morecore implementation
-   returns 0 if failure, returns newbrk if success.
-*/
 
+/* returns the new end of the heap, or the current end if it could not be moved */
 long sys_brk(va_list ap)
 {
-
-    uintptr_t ret;
     uintptr_t newbrk = va_arg(ap, uintptr_t);
 
-    /*if the newbrk is 0, return the bottom of the heap*/
-    if (!newbrk) {
-        ret = morecore_base;
-    } else if (newbrk < morecore_top && newbrk > (uintptr_t)&morecore_area[0]) {
-        ret = morecore_base = newbrk;
-    } else {
-        ret = 0;
-    }
-
-    return ret;
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 2);
+    seL4_SetMR(0, SOS_SYSCALL_BRK);
+    seL4_SetMR(1, newbrk);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0);
 }
 
-/* Large mallocs will result in muslc calling mmap, so we do a minimal implementation
-   here to support that. We make a bunch of assumptions in the process */
+/* Large mallocs will result in muslc calling mmap. Anonymous mappings and
+   mappings of open files are supported, and SOS chooses where they go */
 long sys_mmap(va_list ap)
 {
-    void *addr = va_arg(ap, void *);
+    UNUSED void *addr = va_arg(ap, void *);
     size_t length = va_arg(ap, size_t);
     int prot = va_arg(ap, int);
     int flags = va_arg(ap, int);
     int fd = va_arg(ap, int);
     off_t offset = va_arg(ap, off_t);
 
-    if (flags & MAP_ANONYMOUS) {
-        /* Check that we don't try and allocate more than exists */
-        if (length > morecore_top - morecore_base) {
-            return -ENOMEM;
-        }
-        /* Steal from the top */
-        morecore_top -= length;
-        return morecore_top;
+    if (flags & MAP_FIXED) {
+        return -EINVAL;
     }
-    ZF_LOGF("not implemented");
-    return -ENOMEM;
+
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 6);
+    seL4_SetMR(0, SOS_SYSCALL_MMAP);
+    seL4_SetMR(1, length);
+    seL4_SetMR(2, prot);
+    seL4_SetMR(3, flags);
+    seL4_SetMR(4, fd);
+    seL4_SetMR(5, offset);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    seL4_Word vaddr = seL4_GetMR(0);
+    return vaddr == 0 ? -ENOMEM : (long) vaddr;
+}
+
+long sys_munmap(va_list ap)
+{
+    void *addr = va_arg(ap, void *);
+    size_t length = va_arg(ap, size_t);
+
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 3);
+    seL4_SetMR(0, SOS_SYSCALL_MUNMAP);
+    seL4_SetMR(1, (seL4_Word) addr);
+    seL4_SetMR(2, length);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0) == 0 ? 0 : -EINVAL;
+}
+
+long sys_msync(va_list ap)
+{
+    void *addr = va_arg(ap, void *);
+    size_t length = va_arg(ap, size_t);
+    UNUSED int flags = va_arg(ap, int);
+
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 3);
+    seL4_SetMR(0, SOS_SYSCALL_MSYNC);
+    seL4_SetMR(1, (seL4_Word) addr);
+    seL4_SetMR(2, length);
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+    return seL4_GetMR(0) == 0 ? 0 : -EIO;
 }
@@ -32,6 +32,9 @@ void sosapi_init_syscall_table(void)
     muslcsys_install_syscall(__NR_ioctl, sys_ioctl);
     muslcsys_install_syscall(__NR_openat, sys_openat);
     muslcsys_install_syscall(__NR_brk, sys_brk);
+    muslcsys_install_syscall(__NR_mmap, sys_mmap);
+    muslcsys_install_syscall(__NR_munmap, sys_munmap);
+    muslcsys_install_syscall(__NR_msync, sys_msync);
     muslcsys_install_syscall(__NR_writev, sys_writev);
     muslcsys_install_syscall(__NR_write, sys_write);
     muslcsys_install_syscall(__NR_set_tid_address, sys_set_tid_address);
@@ -0,0 +1,1063 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "addrspace.h"
+#include "pager.h"
+#include "page_cache.h"
+#include "mapped_file.h"
+#include "shared_vm.h"
+#include "ut.h"
+#include "vmem_layout.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/util.h>
+#include <aos/sel4_zf_logif.h>
+#include <sos/gen_config.h>
+
+/* Initial number of regions allocated for an address space. */
+#define INITIAL_REGIONS 8
+
+/* Write not read bit of the fault status, set if a data abort was a write. */
+#define FSR_WNR BIT(6)
+
+/* Pages in a large page. */
+#define LARGE_PAGE_PAGES BIT(seL4_LargePageBits - seL4_PageBits)
+
+/*
+ * A large page backing a 2MiB aligned span of an anonymous region, in place of the pages
+ * of a last level table. Large pages are never paged out. When part of the span is
+ * unmapped or shared, the large page is split: it is unmapped from the address space, and
+ * each page still in it is copied into a frame of its own on its next fault. SOS accesses
+ * the large page through a copy of its cap, mapped at large_page_data().
+ */
+typedef struct {
+    /* The address space the large page belongs to, NULL if the entry is free. */
+    addrspace_t *as;
+    uintptr_t vaddr;
+    ut_t *ut;
+    /* Mapped into the address space, and into SOS. */
+    seL4_ARM_Page cap;
+    seL4_ARM_Page sos_cap;
+    /* The large page is no longer mapped into the address space. */
+    bool split;
+    /* Pages of the span whose contents are still in the large page. */
+    uint64_t present[LARGE_PAGE_PAGES / 64];
+} large_page_t;
+
+/* There can be no more large pages than large untypeds set aside at boot */
+static large_page_t large_pages[CONFIG_SOS_LARGE_PAGES];
+
+static unsigned char *large_page_data(large_page_t *large)
+{
+    return (unsigned char *) SOS_USER_LARGE_PAGES + (large - large_pages) * BIT(seL4_LargePageBits);
+}
+
+static bool large_page_has(large_page_t *large, size_t i)
+{
+    return large->present[i / 64] & BIT(i % 64);
+}
+
+/* Find the large page holding the contents of the page at vaddr, NULL if none does. */
+static large_page_t *find_large_page(addrspace_t *as, uintptr_t vaddr)
+{
+    uintptr_t span = ROUND_DOWN(vaddr, BIT(seL4_LargePageBits));
+    for (size_t i = 0; i < CONFIG_SOS_LARGE_PAGES; i++) {
+        large_page_t *large = &large_pages[i];
+        if (large->as == as && large->vaddr == span
+            && large_page_has(large, (vaddr - span) / PAGE_SIZE_4K)) {
+            return large;
+        }
+    }
+    return NULL;
+}
+
+static void free_large_page(large_page_t *large)
+{
+    /* Deleting the caps unmaps them */
+    cspace_t *cspace = frame_table_cspace();
+    if (large->sos_cap != seL4_CapNull) {
+        cspace_delete(cspace, large->sos_cap);
+        cspace_free_slot(cspace, large->sos_cap);
+    }
+    if (large->cap != seL4_CapNull) {
+        cspace_delete(cspace, large->cap);
+        cspace_free_slot(cspace, large->cap);
+    }
+    if (large->ut != NULL) {
+        ut_free(large->ut);
+    }
+    *large = (large_page_t) {};
+}
+
+/* Whether any page of a 2MiB aligned span has been given backing memory. */
+static bool span_has_pages(addrspace_t *as, uintptr_t span)
+{
+    for (size_t i = 0; i < CONFIG_SOS_LARGE_PAGES; i++) {
+        if (large_pages[i].as == as && large_pages[i].vaddr == span) {
+            return true;
+        }
+    }
+
+    /* The span is covered by a single last level table */
+    pte_t *pte = page_table_lookup(&as->page_table, span);
+    for (size_t i = 0; pte != NULL && i < LARGE_PAGE_PAGES; i++) {
+        if (pte[i].valid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Back the span around a faulting address with a large page, if the span lies in an
+ * anonymous read write region, none of its pages have been touched, and a large
+ * untyped is free.
+ *
+ * @return 0 if the span is now mapped, -1 if the fault is left to be backed by a page.
+ */
+static int map_large_page(addrspace_t *as, region_t *region, uintptr_t vaddr)
+{
+    uintptr_t span = ROUND_DOWN(vaddr, BIT(seL4_LargePageBits));
+    if (region->type != REGION_ANONYMOUS || !(region->perms & REGION_READ) || !(region->perms & REGION_WRITE)
+        || span < region->start || span + BIT(seL4_LargePageBits) > region->end) {
+        return -1;
+    }
+
+    large_page_t *large = NULL;
+    for (size_t i = 0; i < CONFIG_SOS_LARGE_PAGES && large == NULL; i++) {
+        if (large_pages[i].as == NULL) {
+            large = &large_pages[i];
+        }
+    }
+    if (large == NULL || span_has_pages(as, span)) {
+        return -1;
+    }
+
+    large->ut = ut_alloc_2m_untyped(NULL);
+    if (large->ut == NULL) {
+        return -1;
+    }
+
+    cspace_t *cspace = frame_table_cspace();
+    large->cap = cspace_alloc_slot(cspace);
+    large->sos_cap = cspace_alloc_slot(cspace);
+    if (large->cap == seL4_CapNull || large->sos_cap == seL4_CapNull) {
+        free_large_page(large);
+        return -1;
+    }
+
+    /* Retyping zeroes the page */
+    seL4_Error err = cspace_untyped_retype(cspace, large->ut->cap, large->cap, seL4_ARM_LargePageObject,
+                                           seL4_LargePageBits);
+    if (err == seL4_NoError) {
+        err = cspace_copy(cspace, large->sos_cap, cspace, large->cap, seL4_AllRights);
+    }
+    if (err == seL4_NoError) {
+        err = map_large_frame(cspace, large->sos_cap, seL4_CapInitThreadVSpace, (uintptr_t) large_page_data(large),
+                              seL4_ReadWrite, seL4_ARM_Default_VMAttributes | seL4_ARM_ExecuteNever);
+    }
+    if (err == seL4_NoError) {
+        /* Fails if pages of the span were mapped once, leaving a page table in the way */
+        err = map_user_frame(cspace, large->cap, as->vspace, span, seL4_ReadWrite, seL4_ARM_Default_VMAttributes,
+                             &as->page_table.structures);
+    }
+    if (err != seL4_NoError) {
+        free_large_page(large);
+        return -1;
+    }
+
+    large->as = as;
+    large->vaddr = span;
+    memset(large->present, 0xff, sizeof(large->present));
+    return 0;
+}
+
+/* Unmap a large page from its address space, so its pages can be handled one at a time. */
+static void split_large_page(large_page_t *large)
+{
+    if (!large->split) {
+        seL4_Error err = seL4_ARM_Page_Unmap(large->cap);
+        ZF_LOGF_IFERR(err, "Failed to unmap large page");
+        large->split = true;
+    }
+}
+
+/* Drop the pages of a range from the large pages holding them, freeing those left empty. */
+static void release_large_pages(addrspace_t *as, uintptr_t start, uintptr_t end)
+{
+    for (size_t i = 0; i < CONFIG_SOS_LARGE_PAGES; i++) {
+        large_page_t *large = &large_pages[i];
+        if (large->as != as || large->vaddr >= end || large->vaddr + BIT(seL4_LargePageBits) <= start) {
+            continue;
+        }
+
+        uintptr_t from = MAX(start, large->vaddr);
+        uintptr_t to = MIN(end, large->vaddr + BIT(seL4_LargePageBits));
+        if (to - from < BIT(seL4_LargePageBits)) {
+            split_large_page(large);
+        }
+        bool empty = true;
+        for (size_t j = 0; j < ARRAY_SIZE(large->present); j++) {
+            for (size_t k = 0; k < 64; k++) {
+                uintptr_t page = large->vaddr + (j * 64 + k) * PAGE_SIZE_4K;
+                if (page >= from && page < to) {
+                    large->present[j] &= ~BIT(k);
+                }
+            }
+            empty = empty && large->present[j] == 0;
+        }
+        if (empty) {
+            free_large_page(large);
+        }
+    }
+}
+
+/* Copy a page of a split large page into a frame of its own, and map it. */
+static int large_page_fault(cspace_t *cspace, addrspace_t *as, large_page_t *large, uintptr_t page)
+{
+    if (!large->split) {
+        ZF_LOGE("Fault at %p in a mapped large page", (void *) page);
+        return -1;
+    }
+
+    frame_ref_t frame = alloc_frame();
+    if (frame == NULL_FRAME) {
+        ZF_LOGE("Out of memory for page at %p", (void *) page);
+        return -1;
+    }
+    memcpy(frame_data(frame), large_page_data(large) + (page - large->vaddr), PAGE_SIZE_4K);
+    if (pager_map_pages(cspace, &as->page_table, as->vspace, page, &frame, 1, true) != 1) {
+        free_frame(frame);
+        return -1;
+    }
+    release_large_pages(as, page, page + PAGE_SIZE_4K);
+    return 0;
+}
+
+int as_init(addrspace_t *as, seL4_CPtr vspace)
+{
+    *as = (addrspace_t) {
+        .vspace = vspace,
+        .heap_start = PROCESS_VMEM_START,
+        .brk = PROCESS_VMEM_START,
+    };
+
+    as->regions = malloc(INITIAL_REGIONS * sizeof(region_t));
+    if (as->regions == NULL) {
+        ZF_LOGE("Out of memory for regions");
+        return -1;
+    }
+    as->max_regions = INITIAL_REGIONS;
+
+    if (page_table_init(&as->page_table) != 0) {
+        free(as->regions);
+        as->regions = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Release a page of an address space, which stops sharing it with others. */
+static void release_page(pte_t *pte, uintptr_t vaddr)
+{
+    if (pte->share) {
+        shared_vm_leave(pte, vaddr);
+    }
+    pager_release_page(pte);
+}
+
+static int destroy_page(pte_t *pte, uintptr_t vaddr, UNUSED void *arg)
+{
+    release_page(pte, vaddr);
+    return 0;
+}
+
+/* Offset in its file of a page of a REGION_FILE region. */
+static uint64_t file_offset(region_t *region, uintptr_t vaddr)
+{
+    return region->file_offset + (vaddr - region->data_vaddr);
+}
+
+/* Write back the pages of a range of a shared file region. */
+static int sync_pages(region_t *region, uintptr_t start, uintptr_t end)
+{
+    if (region->type != REGION_FILE || !region->shared) {
+        return 0;
+    }
+    return mapped_file_sync(region->file, file_offset(region, start), file_offset(region, end));
+}
+
+void as_destroy(addrspace_t *as)
+{
+    release_large_pages(as, 0, UINTPTR_MAX);
+    /* Shared pages are found by address, which the table destruction does not know */
+    page_table_walk(&as->page_table, destroy_page, NULL);
+    page_table_destroy(&as->page_table, pager_release_page);
+    for (size_t i = 0; i < as->n_regions; i++) {
+        region_t *region = &as->regions[i];
+        if (region->type == REGION_FILE) {
+            sync_pages(region, region->start, region->end);
+            mapped_file_put(region->file);
+        }
+    }
+    free(as->regions);
+    as->regions = NULL;
+    as->n_regions = 0;
+    as->max_regions = 0;
+}
+
+/* Index of the first region ending after vaddr, which is n_regions if there is none. */
+static size_t region_index(addrspace_t *as, uintptr_t vaddr)
+{
+    size_t lo = 0;
+    size_t hi = as->n_regions;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (as->regions[mid].end <= vaddr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+region_t *as_find_region(addrspace_t *as, uintptr_t vaddr)
+{
+    size_t i = region_index(as, vaddr);
+    if (i < as->n_regions && as->regions[i].start <= vaddr) {
+        return &as->regions[i];
+    }
+    return NULL;
+}
+
+region_t *as_define_region(addrspace_t *as, uintptr_t start, size_t size, seL4_Word perms,
+                           region_type_t type)
+{
+    assert(IS_ALIGNED(start, seL4_PageBits));
+    assert(IS_ALIGNED(size, seL4_PageBits));
+
+    uintptr_t end = start + size;
+    if (size == 0 || end < start) {
+        ZF_LOGE("Invalid region %p + %zu", (void *) start, size);
+        return NULL;
+    }
+
+    size_t i = region_index(as, start);
+    if (i < as->n_regions && as->regions[i].start < end) {
+        ZF_LOGE("Region %p-%p overlaps %p-%p", (void *) start, (void *) end,
+                (void *) as->regions[i].start, (void *) as->regions[i].end);
+        return NULL;
+    }
+
+    if (as->n_regions == as->max_regions) {
+        region_t *regions = realloc(as->regions, as->max_regions * 2 * sizeof(region_t));
+        if (regions == NULL) {
+            ZF_LOGE("Out of memory for regions");
+            return NULL;
+        }
+        as->regions = regions;
+        as->max_regions *= 2;
+    }
+
+    memmove(&as->regions[i + 1], &as->regions[i], (as->n_regions - i) * sizeof(region_t));
+    as->n_regions++;
+    as->regions[i] = (region_t) {
+        .start = start,
+        .end = end,
+        .perms = perms,
+        .type = type,
+    };
+    return &as->regions[i];
+}
+
+/* Release the pages of a range of a region. */
+static void release_pages(addrspace_t *as, region_t *region, uintptr_t start, uintptr_t end)
+{
+    if (region->type == REGION_FIXED) {
+        return;
+    }
+
+    release_large_pages(as, start, end);
+    for (uintptr_t vaddr = start; vaddr < end; vaddr += PAGE_SIZE_4K) {
+        pte_t *pte = page_table_lookup(&as->page_table, vaddr);
+        if (pte != NULL && pte->valid) {
+            release_page(pte, vaddr);
+        }
+    }
+
+    /* Pages no longer mapped elsewhere are clean once written back */
+    if (sync_pages(region, start, end) != 0) {
+        ZF_LOGE("Failed to write back pages %p-%p", (void *) start, (void *) end);
+    }
+}
+
+int as_remove_region(addrspace_t *as, uintptr_t start)
+{
+    region_t *region = as_find_region(as, start);
+    if (region == NULL || region->start != start) {
+        return -1;
+    }
+
+    release_pages(as, region, region->start, region->end);
+    if (region->type == REGION_FILE) {
+        mapped_file_put(region->file);
+    }
+
+    size_t i = region - as->regions;
+    memmove(&as->regions[i], &as->regions[i + 1], (as->n_regions - i - 1) * sizeof(region_t));
+    as->n_regions--;
+    return 0;
+}
+
+static int count_page(UNUSED pte_t *pte, UNUSED uintptr_t vaddr, void *arg)
+{
+    *(size_t *) arg += 1;
+    return 0;
+}
+
+size_t as_pages(addrspace_t *as)
+{
+    size_t pages = 0;
+    page_table_walk(&as->page_table, count_page, &pages);
+    for (size_t i = 0; i < CONFIG_SOS_LARGE_PAGES; i++) {
+        for (size_t j = 0; large_pages[i].as == as && j < ARRAY_SIZE(large_pages[i].present); j++) {
+            pages += __builtin_popcountll(large_pages[i].present[j]);
+        }
+    }
+    return pages;
+}
+
+bool as_check_range(addrspace_t *as, uintptr_t vaddr, size_t len, bool write)
+{
+    if (vaddr + len < vaddr) {
+        return false;
+    }
+
+    /* The range may span several adjacent regions. */
+    uintptr_t end = vaddr + len;
+    size_t i = region_index(as, vaddr);
+    while (vaddr < end) {
+        if (i == as->n_regions) {
+            return false;
+        }
+
+        region_t *region = &as->regions[i];
+        if (region->start > vaddr) {
+            return false;
+        }
+        if (!(region->perms & REGION_READ) || (write && !(region->perms & REGION_WRITE))) {
+            return false;
+        }
+        vaddr = region->end;
+        i++;
+    }
+    return true;
+}
+
+/*
+ * Find a user page for SOS to access, faulting it in if needed, and pin its frame. Pages
+ * of large pages are never paged out, so are not pinned, and their frame is NULL_FRAME.
+ *
+ * @return the contents of the page in SOS, NULL on failure.
+ */
+static unsigned char *pin_page(cspace_t *cspace, addrspace_t *as, uintptr_t vaddr, bool write,
+                               frame_ref_t *frame)
+{
+    region_t *region = as_find_region(as, vaddr);
+    if (region != NULL && (!(region->perms & REGION_READ) || (write && !(region->perms & REGION_WRITE)))) {
+        ZF_LOGE("Access to %p violates region permissions", (void *) vaddr);
+        return NULL;
+    }
+
+    large_page_t *large = find_large_page(as, vaddr);
+    pte_t *pte = page_table_lookup(&as->page_table, vaddr);
+    if (large == NULL
+        && (region == NULL || pte == NULL || !pte->valid || pte->swapped || (write && !pte->writable))) {
+        if (as_handle_fault(cspace, as, vaddr, write ? FSR_WNR : 0, false) != 0) {
+            return NULL;
+        }
+        large = find_large_page(as, vaddr);
+        pte = page_table_lookup(&as->page_table, vaddr);
+    }
+
+    if (large != NULL) {
+        *frame = NULL_FRAME;
+        return large_page_data(large) + (ROUND_DOWN(vaddr, PAGE_SIZE_4K) - large->vaddr);
+    }
+    if (write && !pte->writable) {
+        ZF_LOGE("Page at %p is not writable", (void *) vaddr);
+        return NULL;
+    }
+    frame_ref_pin(pte->frame);
+    *frame = pte->frame;
+    return frame_data(pte->frame);
+}
+
+ssize_t as_pin(cspace_t *cspace, addrspace_t *as, uintptr_t vaddr, size_t len, bool write,
+               struct iovec *iov, frame_ref_t *frames, size_t max)
+{
+    if (vaddr + len < vaddr) {
+        return -1;
+    }
+
+    size_t n = 0;
+    uintptr_t end = vaddr + len;
+    while (vaddr < end && n < max) {
+        /* Earlier pages stay pinned, so faulting in later ones never evicts them. */
+        unsigned char *data = pin_page(cspace, as, vaddr, write, &frames[n]);
+        if (data == NULL) {
+            as_unpin(frames, n);
+            return -1;
+        }
+
+        uintptr_t offset = vaddr % PAGE_SIZE_4K;
+        iov[n].iov_base = data + offset;
+        iov[n].iov_len = MIN(PAGE_SIZE_4K - offset, end - vaddr);
+        vaddr += iov[n].iov_len;
+        n++;
+    }
+    return n;
+}
+
+void as_unpin(frame_ref_t *frames, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (frames[i] != NULL_FRAME) {
+            frame_ref_unpin(frames[i]);
+        }
+    }
+}
+
+uintptr_t as_brk(addrspace_t *as, uintptr_t newbrk)
+{
+    if (newbrk == 0 || newbrk == as->brk) {
+        return as->brk;
+    }
+    if (newbrk < as->heap_start) {
+        ZF_LOGE("brk %p below start of heap", (void *) newbrk);
+        return as->brk;
+    }
+
+    uintptr_t old_end = ROUND_UP(as->brk, PAGE_SIZE_4K);
+    uintptr_t new_end = ROUND_UP(newbrk, PAGE_SIZE_4K);
+    if (new_end < newbrk) {
+        return as->brk;
+    }
+
+    region_t *heap = NULL;
+    if (old_end > as->heap_start) {
+        heap = as_find_region(as, as->heap_start);
+        assert(heap != NULL && heap->end == old_end);
+    }
+
+    if (new_end > old_end) {
+        /* the heap may grow up to the next region */
+        size_t next = region_index(as, old_end);
+        if (next < as->n_regions && as->regions[next].start < new_end) {
+            ZF_LOGE("Heap can not grow to %p", (void *) newbrk);
+            return as->brk;
+        }
+        if (heap == NULL) {
+            heap = as_define_region(as, as->heap_start, new_end - as->heap_start, REGION_READ | REGION_WRITE,
+                                    REGION_ANONYMOUS);
+            if (heap == NULL) {
+                return as->brk;
+            }
+        }
+        heap->end = new_end;
+    } else if (new_end < old_end) {
+        release_pages(as, heap, new_end, old_end);
+        if (new_end == as->heap_start) {
+            as_remove_region(as, as->heap_start);
+        } else {
+            heap->end = new_end;
+        }
+    }
+
+    as->brk = newbrk;
+    return as->brk;
+}
+
+/* Find where to place a new mapping of length bytes, 0 if there is no room. */
+static uintptr_t find_gap(addrspace_t *as, size_t length)
+{
+    /* take the highest gap that fits, leaving the space above the heap to last */
+    uintptr_t bottom = ROUND_UP(as->brk, PAGE_SIZE_4K);
+    uintptr_t gap_end = PROCESS_MMAP_TOP;
+    for (size_t i = as->n_regions; i > 0 && gap_end > bottom; i--) {
+        region_t *region = &as->regions[i - 1];
+        if (region->start >= gap_end) {
+            continue;
+        }
+        uintptr_t gap_start = MAX(region->end, bottom);
+        if (region->end < gap_end && gap_end - gap_start >= length) {
+            break;
+        }
+        gap_end = region->start;
+    }
+    if (gap_end < bottom || gap_end - bottom < length) {
+        ZF_LOGE("No room to map %zu bytes", length);
+        return 0;
+    }
+
+    return gap_end - length;
+}
+
+uintptr_t as_mmap(addrspace_t *as, size_t length, seL4_Word perms)
+{
+    length = ROUND_UP(length, PAGE_SIZE_4K);
+    if (length == 0) {
+        return 0;
+    }
+
+    uintptr_t start = find_gap(as, length);
+    if (start == 0 || as_define_region(as, start, length, perms, REGION_ANONYMOUS) == NULL) {
+        return 0;
+    }
+    return start;
+}
+
+uintptr_t as_mmap_file(addrspace_t *as, size_t length, seL4_Word perms, mapped_file_t *file,
+                       uint64_t offset, bool shared)
+{
+    length = ROUND_UP(length, PAGE_SIZE_4K);
+    if (length == 0 || !IS_ALIGNED(offset, seL4_PageBits)) {
+        return 0;
+    }
+
+    uintptr_t start = find_gap(as, length);
+    region_t *region = NULL;
+    if (start != 0) {
+        region = as_define_region(as, start, length, perms, REGION_FILE);
+    }
+    if (region == NULL) {
+        return 0;
+    }
+    region->file = mapped_file_dup(file);
+    region->file_offset = offset;
+    region->data_vaddr = start;
+    region->shared = shared;
+    return start;
+}
+
+int as_msync(addrspace_t *as, uintptr_t vaddr, size_t length)
+{
+    uintptr_t end = vaddr + ROUND_UP(length, PAGE_SIZE_4K);
+    if (!IS_ALIGNED(vaddr, seL4_PageBits) || end < vaddr) {
+        return -1;
+    }
+
+    int err = 0;
+    for (size_t i = region_index(as, vaddr); i < as->n_regions && as->regions[i].start < end; i++) {
+        region_t *region = &as->regions[i];
+        if (sync_pages(region, MAX(region->start, vaddr), MIN(region->end, end)) != 0) {
+            err = -1;
+        }
+    }
+    return err;
+}
+
+int as_munmap(addrspace_t *as, uintptr_t vaddr, size_t length)
+{
+    uintptr_t end = vaddr + ROUND_UP(length, PAGE_SIZE_4K);
+    if (!IS_ALIGNED(vaddr, seL4_PageBits) || length == 0 || end < vaddr) {
+        return -1;
+    }
+
+    /* SOS's own mappings can not be removed */
+    for (size_t i = region_index(as, vaddr); i < as->n_regions && as->regions[i].start < end; i++) {
+        if (as->regions[i].type == REGION_FIXED) {
+            return -1;
+        }
+    }
+
+    size_t i = region_index(as, vaddr);
+    while (i < as->n_regions && as->regions[i].start < end) {
+        region_t *region = &as->regions[i];
+        uintptr_t start = MAX(region->start, vaddr);
+        uintptr_t stop = MIN(region->end, end);
+        release_pages(as, region, start, stop);
+
+        if (start > region->start && stop < region->end) {
+            /* split, keeping both ends */
+            region_t upper = *region;
+            upper.start = stop;
+            region->end = start;
+            region_t *new = as_define_region(as, upper.start, upper.end - upper.start, upper.perms, upper.type);
+            if (new == NULL) {
+                return -1;
+            }
+            *new = upper;
+            if (new->type == REGION_FILE) {
+                mapped_file_dup(new->file);
+            }
+            break;
+        } else if (start > region->start) {
+            region->end = start;
+            i++;
+        } else if (stop < region->end) {
+            region->start = stop;
+            i++;
+        } else {
+            as_remove_region(as, region->start);
+        }
+    }
+
+    /* the heap can not extend past a hole punched in it */
+    if (vaddr < ROUND_UP(as->brk, PAGE_SIZE_4K) && end > as->heap_start) {
+        as->brk = MAX(vaddr, as->heap_start);
+    }
+    /* nor can the stack grow once its top page is gone */
+    if (as->stack_top != 0 && vaddr < as->stack_top && end > as->stack_top - PAGE_SIZE_4K) {
+        as->stack_top = 0;
+        as->stack_limit = 0;
+    }
+    return 0;
+}
+
+region_t *as_define_stack(addrspace_t *as, uintptr_t top, size_t limit)
+{
+    assert(IS_ALIGNED(top, seL4_PageBits));
+    limit = ROUND_UP(MAX(limit, PAGE_SIZE_4K), PAGE_SIZE_4K);
+    if (limit + PAGE_SIZE_4K > top) {
+        return NULL;
+    }
+
+    region_t *stack = as_define_region(as, top - PAGE_SIZE_4K, PAGE_SIZE_4K, REGION_READ | REGION_WRITE,
+                                       REGION_ANONYMOUS);
+    if (stack != NULL) {
+        as->stack_top = top;
+        as->stack_limit = top - limit;
+    }
+    return stack;
+}
+
+/* Copy the part of an ELF region's data that falls in a page into a zeroed frame */
+static void load_page(region_t *region, uintptr_t page, frame_ref_t frame)
+{
+    uintptr_t start = MAX(page, region->data_vaddr);
+    uintptr_t end = MIN(page + PAGE_SIZE_4K, region->data_vaddr + region->data_size);
+    if (start < end) {
+        memcpy((char *) frame_data(frame) + (start - page), region->data + (start - region->data_vaddr),
+               end - start);
+    }
+    flush_frame(frame);
+}
+
+/* Grow the stack down to cover a faulting address, if it may */
+static region_t *grow_stack(addrspace_t *as, uintptr_t vaddr)
+{
+    if (as->stack_top == 0 || vaddr < as->stack_limit || vaddr >= as->stack_top) {
+        return NULL;
+    }
+
+    /* The stack may have been unmapped, leaving some other region or none above vaddr */
+    size_t i = region_index(as, vaddr);
+    if (i == as->n_regions || as->regions[i].end != as->stack_top
+        || as->regions[i].type != REGION_ANONYMOUS) {
+        return NULL;
+    }
+    region_t *stack = &as->regions[i];
+
+    /* keep a guard page between the stack and whatever is below it */
+    uintptr_t page = ROUND_DOWN(vaddr, PAGE_SIZE_4K);
+    if (i > 0 && as->regions[i - 1].end + PAGE_SIZE_4K > page) {
+        ZF_LOGE("Stack can not grow to %p", (void *) vaddr);
+        return NULL;
+    }
+    stack->start = page;
+    return stack;
+}
+
+/* Share one page of an address space, see as_share(). */
+static int share_page(addrspace_t *as, region_t *region, uintptr_t vaddr, bool writable)
+{
+    pte_t *pte = page_table_lookup_alloc(&as->page_table, vaddr);
+    if (pte == NULL) {
+        return -1;
+    }
+    if (pte->valid && pte->share) {
+        /* Sharing again changes the access allowed */
+        shared_vm_leave(pte, vaddr);
+    }
+
+    frame_ref_t frame = shared_vm_frame(vaddr);
+    if (frame != NULL_FRAME) {
+        /* Join the others, dropping our own contents */
+        if (pte->valid) {
+            pager_release_page(pte);
+        }
+        frame_ref_get(frame);
+    } else if (pte->valid) {
+        /* The first to share the page shares its current contents */
+        if (pte->cow && pager_make_private(frame_table_cspace(), pte) != 0) {
+            return -1;
+        }
+        if (pte->shared && !pte->share) {
+            ZF_LOGE("Page at %p is shared read only", (void *) vaddr);
+            return -1;
+        }
+        frame = pager_page_in(pte);
+        if (frame == NULL_FRAME) {
+            return -1;
+        }
+        /* Unmap the page, so the next access maps it with the rights of the share */
+        if (pte->referenced) {
+            seL4_Error err = seL4_ARM_Page_Unmap(pte->cap);
+            ZF_LOGF_IFERR(err, "Failed to unmap page");
+        }
+        frame_set_unpageable(frame);
+    } else {
+        frame = alloc_zeroed_frame();
+        if (frame == NULL_FRAME) {
+            return -1;
+        }
+        if (region->type == REGION_ELF) {
+            load_page(region, vaddr, frame);
+        }
+    }
+
+    *pte = (pte_t) {
+        .cap = pte->valid ? pte->cap : seL4_CapNull,
+        .frame = frame,
+        .valid = 1,
+        .shared = 1,
+        .share = 1,
+        .share_writable = writable,
+        .share_may_write = !!(region->perms & REGION_WRITE),
+    };
+    if (shared_vm_join(pte, vaddr) != 0) {
+        pager_release_page(pte);
+        return -1;
+    }
+    return 0;
+}
+
+int as_share(addrspace_t *as, uintptr_t vaddr, size_t size, bool writable)
+{
+    if (!IS_ALIGNED(vaddr, seL4_PageBits) || !IS_ALIGNED(size, seL4_PageBits) || size == 0
+        || !as_check_range(as, vaddr, size, writable)) {
+        return -1;
+    }
+
+    for (uintptr_t page = vaddr; page < vaddr + size; page += PAGE_SIZE_4K) {
+        region_t *region = as_find_region(as, page);
+        if (region->type == REGION_FIXED) {
+            return -1;
+        }
+        /* A page is shared in a frame of its own */
+        large_page_t *large = find_large_page(as, page);
+        if (large != NULL) {
+            split_large_page(large);
+            if (large_page_fault(frame_table_cspace(), as, large, page) != 0) {
+                return -1;
+            }
+        }
+        if (share_page(as, region, page, writable) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int clone_page(pte_t *pte, uintptr_t vaddr, void *dst_pt)
+{
+    if (!pte->share) {
+        return pager_share_page(pte, dst_pt, vaddr);
+    }
+
+    /* Pages shared with sos_share_vm() stay shared with the copy */
+    pte_t *dst = page_table_lookup_alloc(dst_pt, vaddr);
+    if (dst == NULL) {
+        return -1;
+    }
+    *dst = *pte;
+    dst->cap = seL4_CapNull;
+    dst->referenced = 0;
+    frame_ref_get(dst->frame);
+    if (shared_vm_join(dst, vaddr) != 0) {
+        pager_release_page(dst);
+        return -1;
+    }
+    return 0;
+}
+
+int as_clone(addrspace_t *dst, addrspace_t *src)
+{
+    assert(dst->n_regions == 0);
+
+    for (size_t i = 0; i < src->n_regions; i++) {
+        region_t *region = &src->regions[i];
+        if (region->type == REGION_FIXED) {
+            continue;
+        }
+        region_t *copy = as_define_region(dst, region->start, region->end - region->start, region->perms,
+                                          region->type);
+        if (copy == NULL) {
+            return -1;
+        }
+        *copy = *region;
+        if (copy->type == REGION_FILE) {
+            mapped_file_dup(copy->file);
+        }
+    }
+    dst->heap_start = src->heap_start;
+    dst->brk = src->brk;
+    dst->stack_top = src->stack_top;
+    dst->stack_limit = src->stack_limit;
+
+    /* Large pages are copied into pages of the copy, rather than shared copy on write */
+    for (size_t i = 0; i < CONFIG_SOS_LARGE_PAGES; i++) {
+        large_page_t *large = &large_pages[i];
+        for (size_t j = 0; large->as == src && j < LARGE_PAGE_PAGES; j++) {
+            if (!large_page_has(large, j)) {
+                continue;
+            }
+            frame_ref_t frame = alloc_frame();
+            if (frame == NULL_FRAME) {
+                return -1;
+            }
+            memcpy(frame_data(frame), large_page_data(large) + j * PAGE_SIZE_4K, PAGE_SIZE_4K);
+            if (pager_map_pages(frame_table_cspace(), &dst->page_table, dst->vspace,
+                                large->vaddr + j * PAGE_SIZE_4K, &frame, 1, true) != 1) {
+                free_frame(frame);
+                return -1;
+            }
+        }
+    }
+
+    return page_table_walk(&src->page_table, clone_page, &dst->page_table);
+}
+
+/*
+ * Map the page of a file from the page cache. Writable pages of private mappings are
+ * copied on write, while shared ones are recorded as dirty when they are written.
+ */
+static int file_fault(cspace_t *cspace, addrspace_t *as, region_t *region, uintptr_t page, bool write)
+{
+    uint64_t offset = file_offset(region, page);
+    frame_ref_t frame = mapped_file_page(region->file, offset);
+    if (frame == NULL_FRAME) {
+        return -1;
+    }
+
+    bool writable = region->shared && write;
+    if (writable) {
+        mapped_file_dirty(region->file, offset);
+    }
+    if (pager_map_shared(cspace, &as->page_table, as->vspace, page, frame, writable) != 0) {
+        free_frame(frame);
+        return -1;
+    }
+
+    if (!region->shared && (region->perms & REGION_WRITE)) {
+        page_table_lookup(&as->page_table, page)->cow = 1;
+        if (write) {
+            return pager_cow_fault(cspace, &as->page_table, as->vspace, page);
+        }
+    }
+    return 0;
+}
+
+int as_handle_fault(cspace_t *cspace, addrspace_t *as, uintptr_t vaddr, seL4_Word fsr, bool prefetch)
+{
+    region_t *region = as_find_region(as, vaddr);
+    if (region == NULL) {
+        region = grow_stack(as, vaddr);
+    }
+    if (region == NULL) {
+        ZF_LOGE("Fault at %p outside of any region", (void *) vaddr);
+        return -1;
+    }
+
+    bool write = !prefetch && (fsr & FSR_WNR);
+    if ((write && !(region->perms & REGION_WRITE)) || (prefetch && !(region->perms & REGION_EXEC))) {
+        ZF_LOGE("Fault at %p violates region permissions", (void *) vaddr);
+        return -1;
+    }
+
+    uintptr_t page = ROUND_DOWN(vaddr, PAGE_SIZE_4K);
+    pte_t *pte = page_table_lookup(&as->page_table, vaddr);
+    if (pte != NULL && pte->valid) {
+        if (write && pte->cow) {
+            return pager_cow_fault(cspace, &as->page_table, as->vspace, vaddr);
+        }
+        if (write && region->type == REGION_FILE && !pte->writable) {
+            /* First write to a shared file page since it was mapped */
+            mapped_file_dirty(region->file, file_offset(region, page));
+            return pager_make_writable(cspace, &as->page_table, as->vspace, vaddr);
+        }
+        return pager_handle_fault(cspace, &as->page_table, as->vspace, vaddr);
+    }
+
+    if (region->type == REGION_FIXED) {
+        ZF_LOGE("Fault at %p in a region with no page", (void *) vaddr);
+        return -1;
+    }
+
+    if (region->type == REGION_FILE) {
+        return file_fault(cspace, as, region, page, write);
+    }
+
+    /* Read only ELF pages are shared by every address space loaded from the same file */
+    bool shared = region->type == REGION_ELF && !(region->perms & REGION_WRITE);
+    frame_ref_t frame = NULL_FRAME;
+    if (shared) {
+        frame = page_cache_lookup(region->data, page);
+    }
+
+    if (region->type == REGION_ANONYMOUS) {
+        large_page_t *large = find_large_page(as, vaddr);
+        if (large != NULL) {
+            return large_page_fault(cspace, as, large, page);
+        }
+        if (map_large_page(as, region, vaddr) == 0) {
+            return 0;
+        }
+    }
+
+    if (frame != NULL_FRAME) {
+        frame_ref_get(frame);
+    } else {
+        /* First touch of an anonymous or ELF page. */
+        frame = alloc_zeroed_frame();
+        if (frame == NULL_FRAME) {
+            ZF_LOGE("Out of memory for page at %p", (void *) vaddr);
+            return -1;
+        }
+        if (region->type == REGION_ELF) {
+            load_page(region, page, frame);
+        }
+        shared = shared && page_cache_insert(region->data, page, frame, NULL) == 0;
+    }
+
+    int err;
+    if (shared) {
+        err = pager_map_shared(cspace, &as->page_table, as->vspace, page, frame, false);
+    } else {
+        err = pager_map_pages(cspace, &as->page_table, as->vspace, page, &frame, 1,
+                              region->perms & REGION_WRITE) == 1 ? 0 : -1;
+    }
+    if (err != 0) {
+        free_frame(frame);
+        return -1;
+    }
+
+    /* Loaded code must be visible to the instruction fetches of the loadee */
+    if (region->type == REGION_ELF && (region->perms & REGION_EXEC)) {
+        pte = page_table_lookup(&as->page_table, page);
+        seL4_ARM_Page_Unify_Instruction(pte->cap, 0, PAGE_SIZE_4K);
+    }
+    return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sel4/sel4.h>
+#include <cspace/cspace.h>
+
+#include "pagetable.h"
+
+/* Access permissions of a region. */
+#define REGION_READ   BIT(0)
+#define REGION_WRITE  BIT(1)
+#define REGION_EXEC   BIT(2)
+
+/* What provides the contents of a region's pages. */
+typedef enum {
+    /* Zero filled when first touched. */
+    REGION_ANONYMOUS,
+    /* Loaded from a segment of the program's ELF file when first touched. */
+    REGION_ELF,
+    /* Mapped by SOS itself and never paged, e.g. the IPC buffer. */
+    REGION_FIXED,
+    /* Pages of a file, shared through the page cache with other mappings of the file. */
+    REGION_FILE,
+} region_type_t;
+
+/* A contiguous range of a user address space with uniform access and backing. */
+typedef struct {
+    /* First address of the region, page aligned. */
+    uintptr_t start;
+    /* Address after the end of the region, page aligned. */
+    uintptr_t end;
+    /* REGION_READ, REGION_WRITE and REGION_EXEC. */
+    seL4_Word perms;
+    region_type_t type;
+    /* Contents of a REGION_ELF region: data_size bytes from data are loaded at data_vaddr,
+     * the rest of the region is zero filled. */
+    const char *data;
+    uintptr_t data_vaddr;
+    size_t data_size;
+    /* Contents of a REGION_FILE region: the page at data_vaddr is at file_offset in file,
+     * which the region holds a reference to. */
+    struct mapped_file *file;
+    uint64_t file_offset;
+    /* Writes to a REGION_FILE region reach the file, rather than a private copy. */
+    bool shared;
+} region_t;
+
+/* The user memory of a process. */
+typedef struct {
+    /* The seL4 vspace the address space is mapped into. */
+    seL4_CPtr vspace;
+    /* The pages of the address space. */
+    page_table_t page_table;
+    /* The regions of the address space, sorted by address and not overlapping. */
+    region_t *regions;
+    size_t n_regions;
+    size_t max_regions;
+    /* Start of the heap, which is an anonymous region growing up from here. */
+    uintptr_t heap_start;
+    /* Current end of the heap, as set by as_brk(). */
+    uintptr_t brk;
+    /* Top of the stack region, 0 if there is no stack. */
+    uintptr_t stack_top;
+    /* Lowest address the stack may grow down to, the page below it is left unmapped as a guard. */
+    uintptr_t stack_limit;
+} addrspace_t;
+
+/*
+ * Initialise an empty address space, with an empty heap at PROCESS_VMEM_START.
+ *
+ * @param vspace  the seL4 vspace the address space is mapped into.
+ * @return 0 on success, -1 if out of memory.
+ */
+int as_init(addrspace_t *as, seL4_CPtr vspace);
+
+/*
+ * Tear down an address space, releasing all of its pages and regions.
+ *
+ * The vspace object itself is not freed.
+ */
+void as_destroy(addrspace_t *as);
+
+/*
+ * Define a new region of the address space.
+ *
+ * @param start  first address of the region, page aligned.
+ * @param size   size of the region in bytes, a multiple of the page size.
+ * @return the new region, or NULL if it overlaps another region or
+ *         memory has run out. The pointer is only valid until the regions
+ *         of the address space next change.
+ */
+region_t *as_define_region(addrspace_t *as, uintptr_t start, size_t size, seL4_Word perms,
+                           region_type_t type);
+
+/*
+ * Remove a region and release any pages in it.
+ *
+ * @return 0 on success, -1 if no region starts at start.
+ */
+int as_remove_region(addrspace_t *as, uintptr_t start);
+
+/* Find the region containing vaddr, or NULL if it is not in a region. */
+region_t *as_find_region(addrspace_t *as, uintptr_t vaddr);
+
+/* The number of pages of the address space backed by memory, in a frame or swapped out. */
+size_t as_pages(addrspace_t *as);
+
+/*
+ * Check that a range of user memory is covered by regions permitting the
+ * requested access, e.g. for a buffer passed to a syscall.
+ */
+bool as_check_range(addrspace_t *as, uintptr_t vaddr, size_t len, bool write);
+
+/*
+ * Pin the pages of a user buffer in memory, so that SOS can access the buffer in place
+ * through the frame table. Pages are faulted in as they would be by the user accessing them.
+ *
+ * @param write   SOS is going to write to the buffer.
+ * @param iov     set to the part of the buffer in each page pinned.
+ * @param frames  set to the pinned frames, to be released with as_unpin(). Pages of large
+ *                pages are never paged out, and have NULL_FRAME in place of a frame.
+ * @param max     most pages to pin, the rest of the buffer is left for another call.
+ * @return the number of pages pinned, or -1 if the buffer is not valid for the access.
+ */
+ssize_t as_pin(cspace_t *cspace, addrspace_t *as, uintptr_t vaddr, size_t len, bool write,
+               struct iovec *iov, frame_ref_t *frames, size_t max);
+
+/* Unpin pages pinned by as_pin(). */
+void as_unpin(frame_ref_t *frames, size_t n);
+
+/*
+ * Define the stack, an anonymous region below top that starts out one page in size and
+ * grows down on faults below it, to at most limit bytes. The page below the limit is
+ * never part of the stack, so overflowing it faults.
+ *
+ * @return the initial stack region, NULL if it overlaps another region.
+ */
+region_t *as_define_stack(addrspace_t *as, uintptr_t top, size_t limit);
+
+/*
+ * Move the end of the heap. Heap pages are allocated when first touched, a large
+ * page at a time where the heap covers a whole 2MiB aligned span.
+ *
+ * @param newbrk  the new end of the heap, or 0 to query it.
+ * @return the end of the heap, which is unchanged if it could not be moved.
+ */
+uintptr_t as_brk(addrspace_t *as, uintptr_t newbrk);
+
+/*
+ * Reserve a new anonymous region, placed below PROCESS_MMAP_TOP. Its pages are
+ * allocated when first touched.
+ *
+ * @param length  size of the region in bytes, rounded up to whole pages.
+ * @param perms   REGION_READ, REGION_WRITE and REGION_EXEC.
+ * @return the start of the region, or 0 if there was no room for it.
+ */
+uintptr_t as_mmap(addrspace_t *as, size_t length, seL4_Word perms);
+
+/*
+ * Map part of a file into a new region, placed like as_mmap().
+ *
+ * @param offset  of the start of the mapping in the file, page aligned.
+ * @param shared  writes reach the file and other shared mappings of it, rather
+ *                than a private copy of the page.
+ * @return the start of the region, or 0 on failure.
+ */
+uintptr_t as_mmap_file(addrspace_t *as, size_t length, seL4_Word perms, struct mapped_file *file,
+                       uint64_t offset, bool shared);
+
+/*
+ * Write back the pages of shared file mappings in a range that have been written to.
+ *
+ * @return 0 on success, -1 if the range is invalid or a page could not be written.
+ */
+int as_msync(addrspace_t *as, uintptr_t vaddr, size_t length);
+
+/*
+ * Remove a range of the address space, splitting regions that extend
+ * beyond it, and release the pages in it. Pages written to through shared
+ * file mappings are written back.
+ *
+ * @param vaddr  start of the range, page aligned.
+ * @param length size of the range in bytes, rounded up to whole pages.
+ * @return 0 on success, -1 if the range is invalid or covers memory mapped by SOS.
+ */
+int as_munmap(addrspace_t *as, uintptr_t vaddr, size_t length);
+
+/*
+ * Share pages of an address space with every other address space that shares
+ * pages at the same addresses, as described for sos_share_vm(). Pages already
+ * shared by others replace this address space's own. Otherwise, the current
+ * contents of the page are shared.
+ *
+ * @param vaddr     start of the pages, page aligned.
+ * @param size      size of the pages, page aligned.
+ * @param writable  the others may write to the pages, which must be writable here.
+ * @return 0 on success, -1 if the range is invalid or out of memory.
+ */
+int as_share(addrspace_t *as, uintptr_t vaddr, size_t size, bool writable);
+
+/*
+ * Copy an address space into an empty one. Pages are shared between the two, and
+ * writable pages are copied when either address space first writes to them.
+ * SOS's own mappings are not copied.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int as_clone(addrspace_t *dst, addrspace_t *src);
+
+/*
+ * Handle a VM fault in an address space.
+ *
+ * Faults on pages that were paged out are paged back in, and anonymous
+ * pages are allocated when first touched.
+ *
+ * @param cspace    of SOS, to allocate slots for mappings.
+ * @param vaddr     the faulting address.
+ * @param fsr       the fault status register value reported for the fault.
+ * @param prefetch  whether the fault was an instruction fetch.
+ * @return 0 if the fault was resolved and the thread can be restarted,
+ *         -1 if it was an invalid access.
+ */
+int as_handle_fault(cspace_t *cspace, addrspace_t *as, uintptr_t vaddr, seL4_Word fsr, bool prefetch);
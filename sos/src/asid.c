@@ -0,0 +1,109 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "asid.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <utils/util.h>
+
+#include "ut.h"
+#include "utils.h"
+
+typedef struct {
+    seL4_ARM_ASIDPool cap;
+    /* ASIDs of the pool given to vspaces that still exist. */
+    size_t used;
+} asid_pool_t;
+
+static struct {
+    asid_pool_t pools[MAX_ASID_POOLS];
+    size_t n_pools;
+} asids = {
+    /* SOS holds the first ASID of its own pool */
+    .pools = {{ .cap = seL4_CapInitThreadASIDPool, .used = 1 }},
+    .n_pools = 1,
+};
+
+/* Make a new, empty pool. @return false if no more pools can be made. */
+static bool make_pool(void)
+{
+    if (asids.n_pools == MAX_ASID_POOLS) {
+        ZF_LOGE("Out of ASID pools");
+        return false;
+    }
+
+    ut_t *ut = ut_alloc(seL4_ASIDPoolBits, &cspace);
+    if (ut == NULL) {
+        ZF_LOGE("No memory for ASID pool");
+        return false;
+    }
+    seL4_CPtr slot = cspace_alloc_slot(&cspace);
+    if (slot == seL4_CapNull) {
+        ZF_LOGE("Failed to allocate slot for ASID pool");
+        ut_free(ut);
+        return false;
+    }
+    seL4_Error err = seL4_ARM_ASIDControl_MakePool(seL4_CapASIDControl, ut->cap, cspace.root_cnode, slot,
+                                                   seL4_WordBits);
+    if (err != seL4_NoError) {
+        ZF_LOGE("Failed to make ASID pool: %d", err);
+        cspace_free_slot(&cspace, slot);
+        ut_free(ut);
+        return false;
+    }
+
+    /* The memory of the pool is never returned, as pools are kept */
+    asids.pools[asids.n_pools++] = (asid_pool_t) { .cap = slot };
+    return true;
+}
+
+int asid_assign(seL4_CPtr vspace)
+{
+    /* Try each pool in turn, making another once all of them are full */
+    for (size_t i = 0; i < asids.n_pools || make_pool(); i++) {
+        asid_pool_t *pool = &asids.pools[i];
+        if (pool->used == ASIDS_PER_POOL) {
+            continue;
+        }
+        seL4_Error err = seL4_ARM_ASIDPool_Assign(pool->cap, vspace);
+        if (err == seL4_NoError) {
+            pool->used += 1;
+            return i;
+        }
+        if (err != seL4_DeleteFirst) {
+            ZF_LOGE("Failed to assign ASID: %d", err);
+            return -1;
+        }
+        /* The pool is full with ASIDs SOS did not hand out */
+        ZF_LOGW("ASID pool %zu unexpectedly full", i);
+        pool->used = ASIDS_PER_POOL;
+    }
+    return -1;
+}
+
+void asid_release(int pool)
+{
+    assert(pool >= 0 && (size_t) pool < asids.n_pools);
+    assert(asids.pools[pool].used > 0);
+    asids.pools[pool].used -= 1;
+}
+
+void asid_stats(asid_stats_t *stats)
+{
+    *stats = (asid_stats_t) {
+        .pools = asids.n_pools,
+        .capacity = asids.n_pools * ASIDS_PER_POOL,
+    };
+    for (size_t i = 0; i < asids.n_pools; i++) {
+        stats->used += asids.pools[i].used;
+    }
+}
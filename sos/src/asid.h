@@ -0,0 +1,54 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stddef.h>
+#include <sel4/sel4.h>
+
+/*
+ * ASID pools give vspaces the address space identifiers the hardware tags
+ * TLB entries with. Each pool holds ASIDS_PER_POOL of them, and SOS starts
+ * with just the pool of the initial thread, whose first ASID is taken by SOS
+ * itself. Further pools are made from untyped memory through ASID control
+ * when the existing ones fill up, up to the limit set by the kernel.
+ *
+ * The kernel takes an ASID back when the vspace holding it is deleted, so
+ * SOS only has to count the ASIDs in use in each pool to know where there is
+ * room. Pools are kept once made.
+ */
+
+#define ASIDS_PER_POOL  BIT(seL4_ASIDPoolIndexBits)
+#define MAX_ASID_POOLS  BIT(seL4_NumASIDPoolsBits)
+
+/* Counters describing the ASID pools. */
+typedef struct {
+    /* Pools made, including the pool of the initial thread. */
+    size_t pools;
+    /* ASIDs in use across all pools. */
+    size_t used;
+    /* ASIDs the pools can hold. */
+    size_t capacity;
+} asid_stats_t;
+
+/*
+ * Assign a vspace an ASID, making a new pool if all of them are full.
+ *
+ * @return the pool the ASID was taken from, to be passed to asid_release()
+ *         once the vspace is deleted, or -1 on failure.
+ */
+int asid_assign(seL4_CPtr vspace);
+
+/* Record that a vspace given an ASID from a pool has been deleted. */
+void asid_release(int pool);
+
+/* Get the current counters of the ASID pools. */
+void asid_stats(asid_stats_t *stats);
@@ -16,6 +16,7 @@
 #include <stdio.h>
 
 #include <autoconf.h>
+#include <sos/gen_config.h>
 #include <utils/util.h>
 #include <cspace/cspace.h>
 #include <aos/sel4_zf_logif.h>
@@ -90,12 +91,20 @@ static seL4_CPtr steal_untyped(const seL4_BootInfo *bi, size_t size_bits, uintpt
 
     ZF_LOGD("looking for untyped %zu in size", size_bits);
     for (size_t i = 0; i < bi->untyped.end - bi->untyped.start; i++) {
-        if (untyped_in_range(bi->untypedList[i]) && boot_info_avail_bytes[i] >= BIT(size_bits)) {
+        if (!untyped_in_range(bi->untypedList[i]) || bi->untypedList[i].isDevice) {
+            continue;
+        }
+
+        /* the kernel aligns the retype to the object size, skipping any bytes before
+         * the boundary, so those are lost too */
+        size_t taken = BIT(bi->untypedList[i].sizeBits) - boot_info_avail_bytes[i];
+        size_t padding = ROUND_UP(taken, BIT(size_bits)) - taken;
+        if (boot_info_avail_bytes[i] >= padding + BIT(size_bits)) {
             if (paddr) {
                 *paddr = paddr_from_avail_bytes(bi, i, size_bits);
             }
             /* mark the bytes as unavailable */
-            boot_info_avail_bytes[i] -= BIT(size_bits);
+            boot_info_avail_bytes[i] -= padding + BIT(size_bits);
             return i + bi->untyped.start;
         }
     }
@@ -216,6 +225,9 @@ void sos_bootstrap(cspace_t *cspace, const seL4_BootInfo *bi)
     /* subtract what we don't need for dma */
     n_slots -= BIT(SOS_DMA_SIZE_BITS - seL4_PageBits);
 
+    /* and for large pages, which need 1 cptr each instead */
+    n_slots -= CONFIG_SOS_LARGE_PAGES * (BIT(seL4_LargePageBits - seL4_PageBits) - 1);
+
     /* now work out how many 2nd level nodes are required - with a buffer */
     size_t n_cnodes = n_slots / CNODE_SLOTS(CNODE_SIZE_BITS) + 2;
     ZF_LOGD("%zu slots needed, %zu cnodes", n_slots, n_cnodes);
@@ -367,6 +379,21 @@ void sos_bootstrap(cspace_t *cspace, const seL4_BootInfo *bi)
     /* initialise the ut table */
     ut_init((void *) SOS_UT_TABLE, memory);
 
+    /* also steal large page untypeds, which can not be rebuilt from 4k untypeds later */
+    for (size_t i = 0; i < CONFIG_SOS_LARGE_PAGES; i++) {
+        uintptr_t large_paddr;
+        seL4_CPtr large_ut = steal_untyped(bi, seL4_LargePageBits, &large_paddr);
+        if (large_ut == seL4_CapNull) {
+            ZF_LOGW("Only found memory for %zu large pages", i);
+            break;
+        }
+
+        err = cspace_untyped_retype(cspace, large_ut, first_free_slot, seL4_UntypedObject, seL4_LargePageBits);
+        ZF_LOGF_IFERR(err, "Failed to retype large page untyped");
+        ut_add_large_untyped(large_paddr, first_free_slot);
+        first_free_slot++;
+    }
+
     /* create all the 4K untypeds and build the ut table, from the first available empty slot */
     for (size_t i = 0; i < bi->untyped.end - bi->untyped.start; i++) {
         if (!untyped_in_range(bi->untypedList[i])) {
@@ -460,6 +487,9 @@ void sos_bootstrap(cspace_t *cspace, const seL4_BootInfo *bi)
         bf_set_bit(bot_lvl_node->cnodes[CNODE_INDEX(i)].bf, BOT_LVL_INDEX(i));
     }
 
+    cspace->n_slots_used = first_free_slot;
+    cspace->max_slots_used = first_free_slot;
+
     /* mark any extra cnodes we created as allocated - this occurs as we over
      * estimate when considering the initial untyped */
     for (size_t i = (first_free_slot / slots_per_cnode + 1); i < n_cnodes; i++) {
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "console.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <utils/util.h>
+#include <serial/serial.h>
+
+/* Input buffered until it is read, older input is dropped when it is full. */
+#define CONSOLE_BUF_SIZE 1024
+
+static struct {
+    struct serial *serial;
+    /* A file has the console open for reading. */
+    bool reader;
+    char buf[CONSOLE_BUF_SIZE];
+    size_t head;
+    size_t count;
+    /* Reads waiting for input, in the order they were made. */
+    file_waiter_t *waiters;
+    file_waiter_t *last_waiter;
+} console;
+
+/* Take buffered input, up to the end of a line. @return the bytes taken. */
+static size_t take_input(const struct iovec *iov, size_t iovcnt)
+{
+    size_t done = 0;
+    bool eol = false;
+    for (size_t i = 0; i < iovcnt && console.count > 0 && !eol; i++) {
+        char *dst = iov[i].iov_base;
+        size_t n = 0;
+        while (n < iov[i].iov_len && console.count > 0 && !eol) {
+            dst[n] = console.buf[console.head];
+            eol = dst[n] == '\n';
+            console.head = (console.head + 1) % CONSOLE_BUF_SIZE;
+            console.count--;
+            n++;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static void console_handler(UNUSED struct serial *serial, char c)
+{
+    console.buf[(console.head + console.count) % CONSOLE_BUF_SIZE] = c;
+    if (console.count == CONSOLE_BUF_SIZE) {
+        console.head = (console.head + 1) % CONSOLE_BUF_SIZE;
+    } else {
+        console.count++;
+    }
+
+    /* Complete waiting reads, rather than SOS blocking until input arrives */
+    while (console.waiters != NULL && console.count > 0) {
+        file_waiter_t *waiter = console.waiters;
+        console.waiters = waiter->next;
+        waiter->done(waiter, take_input(waiter->iov, waiter->iovcnt));
+    }
+}
+
+void console_init(void)
+{
+    console.serial = serial_init();
+    ZF_LOGF_IF(console.serial == NULL, "Failed to initialise the console");
+    serial_register_handler(console.serial, console_handler);
+}
+
+/* Read the input that is available, up to the end of a line. */
+static ssize_t console_read(UNUSED file_t *file, const struct iovec *iov, size_t iovcnt,
+                            UNUSED uint64_t offset)
+{
+    if (console.count == 0) {
+        return FILE_READ_LATER;
+    }
+    return take_input(iov, iovcnt);
+}
+
+static void console_wait(UNUSED file_t *file, file_waiter_t *waiter)
+{
+    waiter->next = NULL;
+    if (console.waiters == NULL) {
+        console.waiters = waiter;
+    } else {
+        console.last_waiter->next = waiter;
+    }
+    console.last_waiter = waiter;
+}
+
+static void console_cancel(UNUSED file_t *file, file_waiter_t *waiter)
+{
+    file_waiter_t *prev = NULL;
+    for (file_waiter_t *w = console.waiters; w != NULL; prev = w, w = w->next) {
+        if (w == waiter) {
+            if (prev == NULL) {
+                console.waiters = w->next;
+            } else {
+                prev->next = w->next;
+            }
+            if (console.last_waiter == w) {
+                console.last_waiter = prev;
+            }
+            return;
+        }
+    }
+}
+
+static ssize_t console_write(UNUSED file_t *file, const struct iovec *iov, size_t iovcnt,
+                             UNUSED uint64_t offset)
+{
+    size_t done = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        int sent = serial_send(console.serial, iov[i].iov_base, iov[i].iov_len);
+        if (sent < 0) {
+            return done == 0 ? -1 : (ssize_t) done;
+        }
+        done += sent;
+        if ((size_t) sent < iov[i].iov_len) {
+            break;
+        }
+    }
+    return done;
+}
+
+static void console_close(file_t *file)
+{
+    if ((file->flags & O_ACCMODE) != O_WRONLY) {
+        console.reader = false;
+    }
+}
+
+static const file_ops_t console_ops = {
+    .read = console_read,
+    .write = console_write,
+    .wait = console_wait,
+    .cancel = console_cancel,
+    .close = console_close,
+};
+
+int console_open(file_t *file)
+{
+    if ((file->flags & O_ACCMODE) != O_WRONLY) {
+        if (console.reader) {
+            ZF_LOGE("Console is already open for reading");
+            return -1;
+        }
+        console.reader = true;
+    }
+    file->ops = &console_ops;
+    return 0;
+}
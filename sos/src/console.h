@@ -0,0 +1,28 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include "file.h"
+
+/* Start the console, which runs over the network, once it is initialised. */
+void console_init(void);
+
+/*
+ * Open the console. Any number of processes may write to it, but only one
+ * may have it open for reading at a time.
+ *
+ * Reads wait for input while handling interrupts, so SOS serves no other
+ * syscalls until a line or some input arrives.
+ *
+ * @return 0 on success, -1 if it is already open for reading.
+ */
+int console_open(file_t *file);
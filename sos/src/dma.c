@@ -10,9 +10,12 @@
  * @TAG(DATA61_GPL)
  */
 /**
- * This file implements very simple DMA for sos.
+ * This file implements DMA for sos.
  *
- * It does not free.
+ * DMA memory comes in chunks of physically contiguous large pages. Small buffers are
+ * carved from slabs, pages divided into objects of a single power of two size, while
+ * bigger buffers take whole pages, allocated first-fit from the free extents of the
+ * chunks. When no extent is big enough the pool grows by another chunk.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,34 +30,256 @@
 #include "vmem_layout.h"
 
 #define DMA_ALIGN_BITS  7 /* 128 */
-#define DMA_ALIGN(a)    ROUND_UP((a), DMA_ALIGN_BITS)
+
+/* Slabs hold objects from 2^DMA_ALIGN_BITS up to half a page in size */
+#define DMA_SLAB_CLASSES  (seL4_PageBits - DMA_ALIGN_BITS)
+#define DMA_SLAB_MAX      BIT(seL4_PageBits - 1)
+
+#define DMA_CHUNK_PAGES   BIT(SOS_DMA_SIZE_BITS - seL4_PageBits)
+#define DMA_MAX_CHUNKS    8
+
+/* Pages are named by their index across all chunks */
+#define DMA_NO_PAGE       UINT16_MAX
+compile_time_assert("DMA page indices fit", DMA_MAX_CHUNKS * DMA_CHUNK_PAGES < DMA_NO_PAGE);
+compile_time_assert("Slab bitmap fits", BIT(seL4_PageBits - DMA_ALIGN_BITS) <= 32);
+
+/* What a page of DMA memory is used for */
+enum {
+    DMA_PAGE_FREE = 0,
+    DMA_PAGE_REGION,
+    DMA_PAGE_SLAB,
+};
+
+typedef struct {
+    /* one of DMA_PAGE_* */
+    uint8_t kind;
+    /* slab: the size class of its objects */
+    uint8_t size_class;
+    /* slab: the number of objects allocated */
+    uint16_t used;
+    /* free: the length of the extent in pages, in its first and last page.
+     * region: the length of the region in pages, in its first page.
+     * slab: bitmap of the free objects. */
+    uint32_t count;
+    /* free extents, and slabs with free objects, are linked into lists */
+    uint16_t next;
+    uint16_t prev;
+} dma_page_t;
 
 typedef struct {
     /* the first virtual address */
     uintptr_t vstart;
     /* the first physical address */
     uintptr_t pstart;
-    /* the next available physical address */
-    uintptr_t pnext;
-    /* the last available physical address */
-    uintptr_t pend;
-    /* a ut cptr, sufficient to allocate   */
-    seL4_CPtr cap;
-    /* vspace for flushing address ranges */
+    /* what each page of the chunk is used for */
+    dma_page_t pages[DMA_CHUNK_PAGES];
+} dma_chunk_t;
+
+typedef struct {
+    dma_chunk_t chunks[DMA_MAX_CHUNKS];
+    size_t n_chunks;
+    /* list of free extents */
+    uint16_t free;
+    /* lists of slabs with free objects, one per size class */
+    uint16_t slabs[DMA_SLAB_CLASSES];
+    /* cspace and vspace used to add chunks, vspace also used for flushing address ranges */
+    cspace_t *cspace;
     seL4_CPtr vspace;
 } dma_t;
 
 /* global dma data structure */
 static dma_t dma;
 
+static inline dma_page_t *page(uint16_t index)
+{
+    return &dma.chunks[index / DMA_CHUNK_PAGES].pages[index % DMA_CHUNK_PAGES];
+}
+
+static inline uintptr_t page_paddr(uint16_t index)
+{
+    return dma.chunks[index / DMA_CHUNK_PAGES].pstart + (index % DMA_CHUNK_PAGES) * PAGE_SIZE_4K;
+}
+
+static inline bool same_chunk(uint16_t a, uint16_t b)
+{
+    return a / DMA_CHUNK_PAGES == b / DMA_CHUNK_PAGES;
+}
+
+static dma_chunk_t *chunk_of_paddr(uintptr_t paddr)
+{
+    for (size_t i = 0; i < dma.n_chunks; i++) {
+        if (paddr >= dma.chunks[i].pstart && paddr - dma.chunks[i].pstart < BIT(SOS_DMA_SIZE_BITS)) {
+            return &dma.chunks[i];
+        }
+    }
+    return NULL;
+}
+
+static uint16_t paddr_to_page(uintptr_t paddr)
+{
+    dma_chunk_t *chunk = chunk_of_paddr(paddr);
+    if (chunk == NULL) {
+        return DMA_NO_PAGE;
+    }
+    return (chunk - dma.chunks) * DMA_CHUNK_PAGES + (paddr - chunk->pstart) / PAGE_SIZE_4K;
+}
+
+static void list_add(uint16_t *head, uint16_t index)
+{
+    page(index)->prev = DMA_NO_PAGE;
+    page(index)->next = *head;
+    if (*head != DMA_NO_PAGE) {
+        page(*head)->prev = index;
+    }
+    *head = index;
+}
+
+static void list_remove(uint16_t *head, uint16_t index)
+{
+    dma_page_t *p = page(index);
+    if (p->prev != DMA_NO_PAGE) {
+        page(p->prev)->next = p->next;
+    } else {
+        *head = p->next;
+    }
+    if (p->next != DMA_NO_PAGE) {
+        page(p->next)->prev = p->prev;
+    }
+}
+
+/* record a free extent of pages, which must not border another free extent */
+static void extent_add(uint16_t first, size_t n_pages)
+{
+    page(first)->kind = DMA_PAGE_FREE;
+    page(first)->count = n_pages;
+    page(first + n_pages - 1)->kind = DMA_PAGE_FREE;
+    page(first + n_pages - 1)->count = n_pages;
+    list_add(&dma.free, first);
+}
+
+/* free a run of pages, merging it with the free extents either side */
+static void free_pages(uint16_t first, size_t n_pages)
+{
+    for (size_t i = 0; i < n_pages; i++) {
+        page(first + i)->kind = DMA_PAGE_FREE;
+        page(first + i)->count = 0;
+    }
+
+    uint16_t before = first - 1;
+    if (first % DMA_CHUNK_PAGES != 0 && page(before)->kind == DMA_PAGE_FREE) {
+        size_t before_pages = page(before)->count;
+        first -= before_pages;
+        n_pages += before_pages;
+        list_remove(&dma.free, first);
+    }
+
+    uint16_t after = first + n_pages;
+    if (after % DMA_CHUNK_PAGES != 0 && same_chunk(first, after) && page(after)->kind == DMA_PAGE_FREE) {
+        n_pages += page(after)->count;
+        list_remove(&dma.free, after);
+    }
+
+    extent_add(first, n_pages);
+}
+
+/* allocate a run of pages first-fit, aligned to align bytes, or return DMA_NO_PAGE */
+static uint16_t alloc_pages(size_t n_pages, size_t align)
+{
+    for (uint16_t extent = dma.free; extent != DMA_NO_PAGE; extent = page(extent)->next) {
+        size_t extent_pages = page(extent)->count;
+        uintptr_t start = ROUND_UP(page_paddr(extent), align);
+        size_t skip = (start - page_paddr(extent)) / PAGE_SIZE_4K;
+        if (skip + n_pages > extent_pages) {
+            continue;
+        }
+
+        list_remove(&dma.free, extent);
+        if (skip > 0) {
+            extent_add(extent, skip);
+        }
+        if (skip + n_pages < extent_pages) {
+            extent_add(extent + skip + n_pages, extent_pages - skip - n_pages);
+        }
+        return extent + skip;
+    }
+    return DMA_NO_PAGE;
+}
+
+/* add a chunk of DMA memory, mapped at vstart */
+static void add_chunk(uintptr_t pstart, uintptr_t vstart)
+{
+    uint16_t first = dma.n_chunks * DMA_CHUNK_PAGES;
+    dma.chunks[dma.n_chunks++] = (dma_chunk_t) {
+        .pstart = pstart,
+        .vstart = vstart,
+    };
+    extent_add(first, DMA_CHUNK_PAGES);
+    ZF_LOGI("DMA chunk %p <--> %p\n", (void *) vstart, (void *)(vstart + BIT(SOS_DMA_SIZE_BITS)));
+}
+
+/* grow the pool by a chunk allocated from the untyped allocator */
+static int grow(void)
+{
+    if (dma.n_chunks == DMA_MAX_CHUNKS) {
+        ZF_LOGE("DMA pool is at its maximum size");
+        return -1;
+    }
+
+    uintptr_t pstart;
+    ut_t *ut = ut_alloc_2m_untyped(&pstart);
+    if (ut == NULL) {
+        ZF_LOGE("No large untyped to grow DMA pool");
+        return -1;
+    }
+
+    seL4_CPtr frame = cspace_alloc_slot(dma.cspace);
+    if (frame == seL4_CapNull) {
+        ut_free(ut);
+        ZF_LOGE("No cptr to grow DMA pool");
+        return -1;
+    }
+
+    seL4_Error err = cspace_untyped_retype(dma.cspace, ut->cap, frame, seL4_ARM_LargePageObject,
+                                           SOS_DMA_SIZE_BITS);
+    if (err != seL4_NoError) {
+        cspace_free_slot(dma.cspace, frame);
+        ut_free(ut);
+        ZF_LOGE("Failed to retype DMA chunk");
+        return -1;
+    }
+
+    /* the first chunk is placed by bootstrap, the rest are mapped after each other */
+    uintptr_t vstart = SOS_DMA_POOL + (dma.n_chunks - 1) * BIT(SOS_DMA_SIZE_BITS);
+    err = map_large_frame(dma.cspace, frame, dma.vspace, vstart, seL4_AllRights, seL4_ARM_Default_VMAttributes);
+    if (err != seL4_NoError) {
+        cspace_delete(dma.cspace, frame);
+        cspace_free_slot(dma.cspace, frame);
+        ut_free(ut);
+        ZF_LOGE("Failed to map DMA chunk");
+        return -1;
+    }
+
+    add_chunk(pstart, vstart);
+    return 0;
+}
+
 uintptr_t sos_dma_phys_to_virt(uintptr_t phys)
 {
-    return dma.vstart + (phys - dma.pstart);
+    dma_chunk_t *chunk = chunk_of_paddr(phys);
+    if (chunk == NULL) {
+        return 0;
+    }
+    return chunk->vstart + (phys - chunk->pstart);
 }
 
 uintptr_t sos_dma_virt_to_phys(uintptr_t vaddr)
 {
-    return dma.pstart + (vaddr - dma.vstart);
+    for (size_t i = 0; i < dma.n_chunks; i++) {
+        if (vaddr >= dma.chunks[i].vstart && vaddr - dma.chunks[i].vstart < BIT(SOS_DMA_SIZE_BITS)) {
+            return dma.chunks[i].pstart + (vaddr - dma.chunks[i].vstart);
+        }
+    }
+    return 0;
 }
 
 int dma_init(cspace_t *cspace, seL4_CPtr vspace, seL4_CPtr ut, uintptr_t pstart, uintptr_t vstart)
@@ -63,44 +288,140 @@ int dma_init(cspace_t *cspace, seL4_CPtr vspace, seL4_CPtr ut, uintptr_t pstart,
         return -1;
     }
 
-    dma.pstart = pstart;
-    dma.vstart = vstart;
-    dma.pend = dma.pstart + BIT(seL4_LargePageBits);
-    dma.pnext = dma.pstart;
+    dma.cspace = cspace;
     dma.vspace = vspace;
+    dma.free = DMA_NO_PAGE;
+    for (size_t i = 0; i < DMA_SLAB_CLASSES; i++) {
+        dma.slabs[i] = DMA_NO_PAGE;
+    }
 
     /* now map the frame */
-    uintptr_t vaddr = sos_dma_phys_to_virt(dma.pstart);
-    ZF_LOGI("DMA initialised %p <--> %p\n", (void *) vaddr, (void *) sos_dma_phys_to_virt(dma.pend));
-    return map_frame(NULL, ut, dma.vspace, vaddr, seL4_AllRights, seL4_ARM_Default_VMAttributes);
+    int err = map_frame(NULL, ut, dma.vspace, vstart, seL4_AllRights, seL4_ARM_Default_VMAttributes);
+    if (err) {
+        return err;
+    }
+    add_chunk(pstart, vstart);
+    return 0;
+}
+
+/* allocate an object from a slab of the size class */
+static uintptr_t slab_alloc(size_t size_class)
+{
+    size_t n_objects = BIT(seL4_PageBits - DMA_ALIGN_BITS - size_class);
+    if (dma.slabs[size_class] == DMA_NO_PAGE) {
+        uint16_t index = alloc_pages(1, PAGE_SIZE_4K);
+        if (index == DMA_NO_PAGE) {
+            return 0;
+        }
+        *page(index) = (dma_page_t) {
+            .kind = DMA_PAGE_SLAB,
+            .size_class = size_class,
+            .count = MASK(n_objects),
+        };
+        list_add(&dma.slabs[size_class], index);
+    }
+
+    uint16_t index = dma.slabs[size_class];
+    dma_page_t *slab = page(index);
+    size_t object = CTZL(slab->count);
+    slab->count &= ~BIT(object);
+    slab->used++;
+    if (slab->used == n_objects) {
+        list_remove(&dma.slabs[size_class], index);
+    }
+    return page_paddr(index) + (object << (DMA_ALIGN_BITS + size_class));
+}
+
+static void slab_free(uint16_t index, uintptr_t paddr)
+{
+    dma_page_t *slab = page(index);
+    size_t size_class = slab->size_class;
+    size_t n_objects = BIT(seL4_PageBits - DMA_ALIGN_BITS - size_class);
+    size_t object = (paddr - page_paddr(index)) >> (DMA_ALIGN_BITS + size_class);
+    assert(!(slab->count & BIT(object)));
+
+    if (slab->used == n_objects) {
+        list_add(&dma.slabs[size_class], index);
+    }
+    slab->count |= BIT(object);
+    slab->used--;
+    if (slab->used == 0) {
+        list_remove(&dma.slabs[size_class], index);
+        free_pages(index, 1);
+    }
 }
 
 dma_addr_t sos_dma_malloc(size_t size, int align)
 {
     dma_addr_t addr = {0, 0};
 
-    dma.pnext = DMA_ALIGN(dma.pnext);
+    /* Buffers never share a cache line */
+    size = MAX(size, BIT(DMA_ALIGN_BITS));
+    size_t align_bytes = MAX((size_t) align, BIT(DMA_ALIGN_BITS));
+    if ((align_bytes & (align_bytes - 1)) != 0) {
+        ZF_LOGE("Invalid DMA allocation of %zu aligned to %d", size, align);
+        return addr;
+    }
 
-    /* Round up to the alignment */
-    dma.pnext = ROUND_UP(dma.pnext, align);
+    uintptr_t paddr = 0;
+    size_t slab_size = MAX(size, align_bytes);
+    if (slab_size <= DMA_SLAB_MAX) {
+        /* the smallest power of two that fits */
+        size_t size_class = seL4_WordBits - CLZL(slab_size - 1) - DMA_ALIGN_BITS;
+        paddr = slab_alloc(size_class);
+        if (paddr == 0 && grow() == 0) {
+            paddr = slab_alloc(size_class);
+        }
+    } else {
+        size_t n_pages = BYTES_TO_4K_PAGES(size);
+        align_bytes = MAX(align_bytes, PAGE_SIZE_4K);
+        uint16_t index = alloc_pages(n_pages, align_bytes);
+        if (index == DMA_NO_PAGE && grow() == 0) {
+            index = alloc_pages(n_pages, align_bytes);
+        }
+        if (index != DMA_NO_PAGE) {
+            page(index)->kind = DMA_PAGE_REGION;
+            page(index)->count = n_pages;
+            for (size_t i = 1; i < n_pages; i++) {
+                page(index + i)->kind = DMA_PAGE_REGION;
+                page(index + i)->count = 0;
+            }
+            paddr = page_paddr(index);
+        }
+    }
 
-    if (dma.pnext + size >= dma.pend) {
+    if (paddr == 0) {
         ZF_LOGE("Out of DMA memory");
         return addr;
     }
 
-    addr.vaddr = sos_dma_phys_to_virt(dma.pnext);
-    addr.paddr = dma.pnext;
-
-    /* set return values */
-    dma.pnext += size;
-    ZF_LOGD("DMA: 0x%x\n", (uintptr_t) addr.vaddr);
+    addr.vaddr = sos_dma_phys_to_virt(paddr);
+    addr.paddr = paddr;
+    ZF_LOGD("DMA: 0x%lx\n", addr.vaddr);
 
     /* Clean invalidate the range to prevent seL4 cache bombs */
     sos_dma_cache_clean_invalidate(addr.vaddr, size);
     return addr;
 }
 
+void sos_dma_free(dma_addr_t addr)
+{
+    uint16_t index = paddr_to_page(addr.paddr);
+    if (index == DMA_NO_PAGE) {
+        ZF_LOGE("%p is not DMA memory", (void *) addr.paddr);
+        return;
+    }
+
+    dma_page_t *p = page(index);
+    if (p->kind == DMA_PAGE_SLAB) {
+        slab_free(index, addr.paddr);
+    } else if (p->kind == DMA_PAGE_REGION && p->count > 0 && IS_ALIGNED(addr.paddr, seL4_PageBits)) {
+        free_pages(index, p->count);
+    } else {
+        ZF_LOGE("%p was not allocated", (void *) addr.paddr);
+    }
+}
+
 seL4_Error sos_dma_cache_invalidate(uintptr_t addr, size_t size)
 {
     return seL4_ARM_VSpace_Invalidate_Data(dma.vspace, addr, addr + size);
@@ -19,8 +19,8 @@ typedef struct {
 /**
  * Initialises a pool of DMA memory.
  *
- * @param cspace       cspace that this allocator can use to allocate a slot with and
- *                     retype the passed in untyped with. Only used in init.
+ * @param cspace       cspace that this allocator can use to allocate slots with, to
+ *                     grow the pool with more large pages.
  * @param vspace       cptr to the vspace to use for mapping and cache operations.
  * @param ut           cptr to a ut that is seL4_LargePageBits in size
  * @param pstart       The base physical address of the ut
@@ -32,12 +32,22 @@ int dma_init(cspace_t *cspace, seL4_CPtr vspace, seL4_CPtr ut, uintptr_t pstart,
 /**
  * Allocate an amount of DMA memory.
  *
+ * Allocations are at least cache line aligned, and never share a cache line with
+ * another allocation. The memory is physically contiguous.
+ *
  * @param size in bytes to allocate
- * @param align alignment to align start of address to
+ * @param align alignment to align start of address to, a power of two
  * @return a dma_addr_t representing the memory. On failure values will be 0.
  */
 dma_addr_t sos_dma_malloc(size_t size, int align);
 
+/**
+ * Free DMA memory allocated with sos_dma_malloc.
+ *
+ * @param addr the allocation, as returned by sos_dma_malloc
+ */
+void sos_dma_free(dma_addr_t addr);
+
 /**
  * Convert the provided physical DMA address into a virtual address
  *
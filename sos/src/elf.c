@@ -16,12 +16,17 @@
 #include <string.h>
 #include <assert.h>
 #include <cspace/cspace.h>
+#include <sos/gen_config.h>
 
 #include "frame_table.h"
 #include "ut.h"
 #include "mapping.h"
+#include "pager.h"
 #include "elfload.h"
 
+/* Number of pages of a segment loaded before they are mapped together. */
+#define LOAD_BATCH 32
+
 /*
  * Convert ELF permissions into seL4 permissions.
  */
@@ -37,6 +42,62 @@ static inline seL4_CapRights_t get_sel4_rights_from_elf(unsigned long permission
     return seL4_CapRights_new(false, false, canRead, canWrite);
 }
 
+/*
+ * Convert ELF permissions into region permissions.
+ */
+static inline seL4_Word get_region_perms_from_elf(unsigned long permissions)
+{
+    seL4_Word perms = 0;
+    if (permissions & PF_R || permissions & PF_X) {
+        perms |= REGION_READ;
+    }
+    if (permissions & PF_W) {
+        perms |= REGION_WRITE;
+    }
+    if (permissions & PF_X) {
+        perms |= REGION_EXEC;
+    }
+    return perms;
+}
+
+/*
+ * Map a batch of loaded frames into the loadee at consecutive pages.
+ *
+ * @param n_frames  number of frames in the batch, reset to 0 as the batch
+ *                  is consumed whether or not it could be mapped.
+ * @return 0 on success, -1 on failure.
+ */
+static int map_loaded(cspace_t *cspace, seL4_CPtr loadee, page_table_t *pt, uintptr_t vaddr,
+                      frame_ref_t *frames, size_t *n_frames, bool writable)
+{
+    size_t n = *n_frames;
+    *n_frames = 0;
+
+    size_t mapped = pager_map_pages(cspace, pt, loadee, vaddr, frames, n, writable);
+    if (mapped < n) {
+        ZF_LOGE("Failed to map into loadee at %p", (void *)(vaddr + mapped * PAGE_SIZE_4K));
+        for (size_t i = mapped; i < n; i++) {
+            free_frame(frames[i]);
+        }
+        return -1;
+    }
+
+    /* Invalidate the caches in the loadee forcing data to be loaded
+     * from memory. A page that has already been unmapped again by the
+     * pager is flushed on the way back in. */
+    for (size_t i = 0; i < n; i++) {
+        pte_t *pte = page_table_lookup(pt, vaddr + i * PAGE_SIZE_4K);
+        if (!pte->referenced) {
+            continue;
+        }
+        if (writable) {
+            seL4_ARM_Page_Invalidate_Data(pte->cap, 0, PAGE_SIZE_4K);
+        }
+        seL4_ARM_Page_Unify_Instruction(pte->cap, 0, PAGE_SIZE_4K);
+    }
+    return 0;
+}
+
 /*
  * Load an elf segment into the given vspace.
  *
@@ -61,8 +122,8 @@ static inline seL4_CapRights_t get_sel4_rights_from_elf(unsigned long permission
  * Note: if file_size == 0, the whole segment is just zero filled.
  *
  * @param cspace        of the loader, to allocate slots with
- * @param loader        vspace of the loader
  * @param loadee        vspace to load the segment in to
+ * @param pt            page table of the loadee, recording the pages loaded
  * @param src           pointer to the content to load
  * @param segment_size  size of segment to load
  * @param file_size     end of section that should be zero'd
@@ -71,102 +132,97 @@ static inline seL4_CapRights_t get_sel4_rights_from_elf(unsigned long permission
  * @return
  *
  */
-static int load_segment_into_vspace(cspace_t *cspace, seL4_CPtr loadee, const char *src, size_t segment_size,
-                                    size_t file_size, uintptr_t dst, seL4_CapRights_t permissions)
+static int load_segment_into_vspace(cspace_t *cspace, seL4_CPtr loadee, page_table_t *pt, const char *src,
+                                    size_t segment_size, size_t file_size, uintptr_t dst,
+                                    seL4_CapRights_t permissions)
 {
     assert(file_size <= segment_size);
 
+    bool writable = seL4_CapRights_get_capAllowWrite(permissions);
+
+    /* Frames loaded but not yet mapped, for consecutive pages from batch_vaddr. */
+    frame_ref_t frames[LOAD_BATCH];
+    size_t n_frames = 0;
+    uintptr_t batch_vaddr = 0;
+
     /* We work a page at a time in the destination vspace. */
     unsigned int pos = 0;
-    seL4_Error err = seL4_NoError;
     while (pos < segment_size) {
         uintptr_t loadee_vaddr = (ROUND_DOWN(dst, PAGE_SIZE_4K));
 
-        /* create slot for the frame to load the data into */
-        seL4_CPtr loadee_frame = cspace_alloc_slot(cspace);
-        if (loadee_frame == seL4_CapNull) {
-            ZF_LOGD("Failed to alloc slot");
-            return -1;
-        }
-
-        /* allocate the untyped for the loadees address space */
-        frame_ref_t frame = alloc_frame();
-        if (frame == NULL_FRAME) {
-            ZF_LOGD("Failed to alloc frame");
-            return -1;
-        }
-
-        /* copy it */
-        err = cspace_copy(cspace, loadee_frame, frame_table_cspace(), frame_page(frame), seL4_AllRights);
-        if (err != seL4_NoError) {
-            ZF_LOGD("Failed to untyped reypte");
-            return -1;
-        }
-
-        /* map the frame into the loadee address space */
-        err = map_frame(cspace, loadee_frame, loadee, loadee_vaddr, permissions,
-                        seL4_ARM_Default_VMAttributes);
-
         /* A frame has already been mapped at this address. This occurs when segments overlap in
-         * the same frame, which is permitted by the standard. That's fine as we
-         * leave all the frames mapped in, and this one is already mapped. Give back
-         * the ut we allocated and continue on to do the write.
-         *
-         * Note that while the standard permits segments to overlap, this should not occur if the segments
-         * have different permissions - you should check this and return an error if this case is detected. */
-        bool already_mapped = (err == seL4_DeleteFirst);
+         * the same frame, which is permitted by the standard. In that case the data is
+         * written into the frame that is already there. elf_load() rejects segments with different
+         * permissions that overlap like this. */
+        pte_t *pte = page_table_lookup(pt, loadee_vaddr);
+        bool already_mapped = pte != NULL && pte->valid;
 
+        frame_ref_t frame;
         if (already_mapped) {
-            cspace_delete(cspace, loadee_frame);
-            cspace_free_slot(cspace, loadee_frame);
-            free_frame(frame);
-        } else if (err != seL4_NoError) {
-            ZF_LOGE("Failed to map into loadee at %p, error %u", (void *) loadee_vaddr, err);
+            /* The earlier segment may have been paged out since. */
+            frame = pager_page_in(pte);
+        } else {
+            /* allocate the frame for the loadees address space */
+            frame = alloc_zeroed_frame();
+        }
+        if (frame == NULL_FRAME) {
+            ZF_LOGD("Failed to alloc frame");
+            for (size_t i = 0; i < n_frames; i++) {
+                free_frame(frames[i]);
+            }
             return -1;
         }
 
         /* finally copy the data */
         unsigned char *loader_data = frame_data(frame);
 
-        /* Write any zeroes at the start of the block. */
+        /* The frame is already zeroed, so skip any zeroes at the start of the block. */
         size_t leading_zeroes = dst % PAGE_SIZE_4K;
-        memset(loader_data, 0, leading_zeroes);
         loader_data += leading_zeroes;
 
-        /* Copy the data from the source. */
+        /* Copy the data from the source, the rest of the frame stays zero. */
         size_t segment_bytes = PAGE_SIZE_4K - leading_zeroes;
         if (pos < file_size) {
             size_t file_bytes = MIN(segment_bytes, file_size - pos);
             memcpy(loader_data, src, file_bytes);
-            loader_data += file_bytes;
-            
-            /* Fill in the end of the frame with zereos */
-            size_t trailing_zeroes = PAGE_SIZE_4K - (leading_zeroes + file_bytes);
-            memset(loader_data, 0, trailing_zeroes);
-        } else {
-            memset(loader_data, 0, segment_bytes);
         }
 
         /* Flush the frame contents from loader caches out to memory. */
         flush_frame(frame);
 
-        /* Invalidate the caches in the loadee forcing data to be loaded
-         * from memory. */
-        if (seL4_CapRights_get_capAllowWrite(permissions)) {
-            seL4_ARM_Page_Invalidate_Data(loadee_frame, 0, PAGE_SIZE_4K);
+        if (already_mapped) {
+            if (pte->referenced) {
+                if (writable) {
+                    seL4_ARM_Page_Invalidate_Data(pte->cap, 0, PAGE_SIZE_4K);
+                }
+                seL4_ARM_Page_Unify_Instruction(pte->cap, 0, PAGE_SIZE_4K);
+            }
+        } else {
+            /* Queue the frame to be mapped along with its neighbours. */
+            if (n_frames == 0) {
+                batch_vaddr = loadee_vaddr;
+            }
+            frames[n_frames++] = frame;
+            if (n_frames == LOAD_BATCH
+                && map_loaded(cspace, loadee, pt, batch_vaddr, frames, &n_frames, writable) != 0) {
+                return -1;
+            }
         }
-        seL4_ARM_Page_Unify_Instruction(loadee_frame, 0, PAGE_SIZE_4K);
 
         pos += segment_bytes;
         dst += segment_bytes;
         src += segment_bytes;
     }
+
+    if (n_frames > 0) {
+        return map_loaded(cspace, loadee, pt, batch_vaddr, frames, &n_frames, writable);
+    }
     return 0;
 }
 
-int elf_load(cspace_t *cspace, seL4_CPtr loadee_vspace, elf_t *elf_file)
+int elf_segments(elf_t *elf_file, elf_segment_t *segments, size_t max)
 {
-
+    size_t n = 0;
     int num_headers = elf_getNumProgramHeaders(elf_file);
     for (int i = 0; i < num_headers; i++) {
 
@@ -174,18 +230,91 @@ int elf_load(cspace_t *cspace, seL4_CPtr loadee_vspace, elf_t *elf_file)
         if (elf_getProgramHeaderType(elf_file, i) != PT_LOAD) {
             continue;
         }
+        if (n == max) {
+            ZF_LOGE("More than %zu loadable segments", max);
+            return -1;
+        }
+
+        segments[n++] = (elf_segment_t) {
+            .data = elf_file->elfFile + elf_getProgramHeaderOffset(elf_file, i),
+            .file_size = elf_getProgramHeaderFileSize(elf_file, i),
+            .mem_size = elf_getProgramHeaderMemorySize(elf_file, i),
+            .vaddr = elf_getProgramHeaderVaddr(elf_file, i),
+            .flags = elf_getProgramHeaderFlags(elf_file, i),
+        };
+    }
+    return n;
+}
 
+int elf_load(cspace_t *cspace, addrspace_t *as, const elf_segment_t *segments, size_t n_segments)
+{
+    for (size_t i = 0; i < n_segments; i++) {
         /* Fetch information about this segment. */
-        const char *source_addr = elf_file->elfFile + elf_getProgramHeaderOffset(elf_file, i);
-        size_t file_size = elf_getProgramHeaderFileSize(elf_file, i);
-        size_t segment_size = elf_getProgramHeaderMemorySize(elf_file, i);
-        uintptr_t vaddr = elf_getProgramHeaderVaddr(elf_file, i);
-        seL4_Word flags = elf_getProgramHeaderFlags(elf_file, i);
+        const char *source_addr = segments[i].data;
+        size_t file_size = segments[i].file_size;
+        size_t segment_size = segments[i].mem_size;
+        uintptr_t vaddr = segments[i].vaddr;
+        seL4_Word flags = segments[i].flags;
+
+        /* Record the segment as a region of the address space, which is loaded a page at a
+         * time as the process faults on it. A page shared with the previous segment already
+         * belongs to that segment's region. */
+        uintptr_t region_start = ROUND_DOWN(vaddr, PAGE_SIZE_4K);
+        uintptr_t region_end = ROUND_UP(vaddr + segment_size, PAGE_SIZE_4K);
+        region_t *prev = as_find_region(as, region_start);
+        if (prev != NULL && prev->perms != get_region_perms_from_elf(flags)) {
+            /* The page is mapped with the permissions of one segment, which would not do for
+             * the other. */
+            ZF_LOGE("Segment %zu shares a page with a segment of different permissions", i);
+            return -1;
+        }
+        if (prev != NULL) {
+            region_start = prev->end;
+        }
+        if (region_start < region_end) {
+            region_t *region = as_define_region(as, region_start, region_end - region_start,
+                                                get_region_perms_from_elf(flags), REGION_ELF);
+            if (region == NULL) {
+                ZF_LOGE("Failed to define region for segment %zu", i);
+                return -1;
+            }
+            region->data = source_addr;
+            region->data_vaddr = vaddr;
+            region->data_size = file_size;
+        }
+
+        /* Only the previous region is loaded into a shared page on a fault, so that page is
+         * loaded now, as are the first pages of the segment that are prefaulted. */
+        uintptr_t load_end = MIN(region_start + CONFIG_SOS_ELF_PREFAULT * PAGE_SIZE_4K, vaddr + segment_size);
+        if (!(flags & PF_W)) {
+            /* Read only pages are prefaulted through the page cache, so that they are shared
+             * like the pages faulted in later. */
+            for (uintptr_t page = region_start; page < load_end; page += PAGE_SIZE_4K) {
+                if (as_handle_fault(cspace, as, page, 0, false) != 0) {
+                    ZF_LOGE("Failed to prefault page of segment %zu", i);
+                    return -1;
+                }
+            }
+            load_end = vaddr;
+        }
+        if (prev != NULL) {
+            /* The page may already be loaded, if it was prefaulted with the previous segment. */
+            pte_t *pte = page_table_lookup(&as->page_table, ROUND_DOWN(vaddr, PAGE_SIZE_4K));
+            if ((pte == NULL || !pte->valid)
+                && as_handle_fault(cspace, as, ROUND_DOWN(vaddr, PAGE_SIZE_4K), 0, false) != 0) {
+                ZF_LOGE("Failed to load page shared by segment %zu", i);
+                return -1;
+            }
+            load_end = MAX(load_end, MIN(region_start, vaddr + segment_size));
+        }
+        if (load_end <= vaddr) {
+            continue;
+        }
 
         /* Copy it across into the vspace. */
-        ZF_LOGD(" * Loading segment %p-->%p\n", (void *) vaddr, (void *)(vaddr + segment_size));
-        int err = load_segment_into_vspace(cspace, loadee_vspace, source_addr, segment_size, file_size, vaddr,
-                                           get_sel4_rights_from_elf(flags));
+        ZF_LOGD(" * Loading segment %p-->%p\n", (void *) vaddr, (void *) load_end);
+        int err = load_segment_into_vspace(cspace, as->vspace, &as->page_table, source_addr, load_end - vaddr,
+                                           MIN(file_size, load_end - vaddr), vaddr, get_sel4_rights_from_elf(flags));
         if (err) {
             ZF_LOGE("Elf loading failed!");
             return -1;
@@ -16,4 +16,30 @@
 #include <elf/elf.h>
 #include <elf.h>
 
-int elf_load(cspace_t *cspace, seL4_CPtr loadee_vspace, elf_t *elf_file);
+#include "addrspace.h"
+
+/* A loadable segment of an ELF file. */
+typedef struct {
+    /* Contents of the segment in the file, file_size bytes of the mem_size loaded at vaddr. */
+    const char *data;
+    size_t file_size;
+    size_t mem_size;
+    uintptr_t vaddr;
+    /* PF_ permissions of the segment. */
+    seL4_Word flags;
+} elf_segment_t;
+
+/*
+ * Find the loadable segments of an ELF file, in file order.
+ *
+ * @return the number of segments, or -1 if there are more than max.
+ */
+int elf_segments(elf_t *elf_file, elf_segment_t *segments, size_t max);
+
+/*
+ * Load the segments of an ELF file into an address space, as regions that
+ * are faulted in on demand.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int elf_load(cspace_t *cspace, addrspace_t *as, const elf_segment_t *segments, size_t n_segments);
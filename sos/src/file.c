@@ -0,0 +1,297 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "file.h"
+#include "console.h"
+#include "network.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/util.h>
+#include <nfsc/libnfs.h>
+
+/* Descriptors below this are the standard streams of muslc. */
+#define FIRST_FD 3
+
+/* Most NFS requests a single read or write has outstanding at once. */
+#define NFS_MAX_REQUESTS 64
+
+/* Copy the data read by a request to its buffer. */
+static void copy_read(nfs_req_t *req, const void *data, size_t len)
+{
+    memcpy(req->buf, data, len);
+}
+
+/* Copy the attributes of a file to the request's buffer. */
+static void copy_stat(nfs_req_t *req, const void *data, UNUSED size_t len)
+{
+    *(struct nfs_stat_64 *) req->buf = *(const struct nfs_stat_64 *) data;
+}
+
+/*
+ * Read or write each buffer with a request of its own, all outstanding at once so
+ * that the transfer is not serialised on round trips to the server.
+ */
+static ssize_t nfs_file_io(file_t *file, const struct iovec *iov, size_t iovcnt, uint64_t offset, bool write)
+{
+    struct nfs_context *nfs = network_nfs();
+    nfs_batch_t batch = {};
+    nfs_req_t reqs[NFS_MAX_REQUESTS];
+    iovcnt = MIN(iovcnt, NFS_MAX_REQUESTS);
+
+    size_t n;
+    for (n = 0; n < iovcnt; n++) {
+        reqs[n] = (nfs_req_t) { .batch = &batch, .copy = write ? NULL : copy_read, .buf = iov[n].iov_base };
+        int err;
+        if (write) {
+            err = nfs_pwrite_async(nfs, file->data, offset, iov[n].iov_len, iov[n].iov_base, network_nfs_cb, &reqs[n]);
+        } else {
+            err = nfs_pread_async(nfs, file->data, offset, iov[n].iov_len, network_nfs_cb, &reqs[n]);
+        }
+        if (err != 0) {
+            ZF_LOGE("Failed to queue NFS request: %s", nfs_get_error(nfs));
+            break;
+        }
+        batch.outstanding++;
+        offset += iov[n].iov_len;
+    }
+    network_batch_wait(&batch);
+
+    /* The result is what was done before the first request that came up short. */
+    size_t done = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (reqs[i].status < 0) {
+            break;
+        }
+        done += reqs[i].status;
+        if ((size_t) reqs[i].status < iov[i].iov_len) {
+            break;
+        }
+    }
+    if (done == 0 && (n == 0 || reqs[0].status < 0)) {
+        return -1;
+    }
+    return done;
+}
+
+static ssize_t nfs_file_read(file_t *file, const struct iovec *iov, size_t iovcnt, uint64_t offset)
+{
+    return nfs_file_io(file, iov, iovcnt, offset, false);
+}
+
+static ssize_t nfs_file_write(file_t *file, const struct iovec *iov, size_t iovcnt, uint64_t offset)
+{
+    return nfs_file_io(file, iov, iovcnt, offset, true);
+}
+
+static int nfs_file_size(file_t *file, uint64_t *size)
+{
+    struct nfs_context *nfs = network_nfs();
+    struct nfs_stat_64 stat;
+    nfs_req_t req = { .copy = copy_stat, .buf = &stat };
+    if (network_nfs_wait(&req, nfs_fstat64_async(nfs, file->data, network_nfs_cb, &req)) < 0) {
+        return -1;
+    }
+    *size = stat.nfs_size;
+    return 0;
+}
+
+static void nfs_file_close(file_t *file)
+{
+    struct nfs_context *nfs = network_nfs();
+    nfs_req_t req = {};
+    network_nfs_wait(&req, nfs_close_async(nfs, file->data, network_nfs_cb, &req));
+}
+
+static const file_ops_t nfs_file_ops = {
+    .read = nfs_file_read,
+    .write = nfs_file_write,
+    .size = nfs_file_size,
+    .close = nfs_file_close,
+};
+
+static int nfs_file_open(file_t *file, const char *path)
+{
+    struct nfs_context *nfs = network_nfs();
+    if (nfs == NULL) {
+        ZF_LOGE("No NFS to open %s on", path);
+        return -1;
+    }
+
+    nfs_req_t req = {};
+    int err = network_nfs_wait(&req, nfs_open_async(nfs, path, file->flags & O_ACCMODE, network_nfs_cb, &req));
+    if (err == -ENOENT) {
+        req = (nfs_req_t) {};
+        err = network_nfs_wait(&req, nfs_creat_async(nfs, path, 0666, network_nfs_cb, &req));
+    }
+    if (err < 0) {
+        return -1;
+    }
+
+    file->ops = &nfs_file_ops;
+    file->data = req.file;
+    return 0;
+}
+
+file_t *file_open(const char *path, int flags)
+{
+    file_t *file = malloc(sizeof(file_t));
+    if (file == NULL) {
+        ZF_LOGE("Out of memory for file");
+        return NULL;
+    }
+    *file = (file_t) {
+        .path = strdup(path),
+        .flags = flags,
+        .refs = 1,
+    };
+    if (file->path == NULL) {
+        ZF_LOGE("Out of memory for file");
+        free(file);
+        return NULL;
+    }
+
+    int err;
+    if (strcmp(path, CONSOLE_PATH) == 0) {
+        err = console_open(file);
+    } else {
+        err = nfs_file_open(file, path);
+    }
+    if (err != 0) {
+        free(file->path);
+        free(file);
+        return NULL;
+    }
+    return file;
+}
+
+file_t *file_get(file_t *file)
+{
+    file->refs++;
+    return file;
+}
+
+void file_put(file_t *file)
+{
+    assert(file->refs > 0);
+    file->refs--;
+    if (file->refs == 0) {
+        file->ops->close(file);
+        free(file->path);
+        free(file);
+    }
+}
+
+ssize_t file_pread(file_t *file, const struct iovec *iov, size_t iovcnt, uint64_t offset)
+{
+    if ((file->flags & O_ACCMODE) == O_WRONLY) {
+        return -1;
+    }
+    return file->ops->read(file, iov, iovcnt, offset);
+}
+
+ssize_t file_pwrite(file_t *file, const struct iovec *iov, size_t iovcnt, uint64_t offset)
+{
+    if ((file->flags & O_ACCMODE) == O_RDONLY) {
+        return -1;
+    }
+    return file->ops->write(file, iov, iovcnt, offset);
+}
+
+ssize_t file_read(file_t *file, const struct iovec *iov, size_t iovcnt)
+{
+    ssize_t done = file_pread(file, iov, iovcnt, file->offset);
+    if (done > 0) {
+        file->offset += done;
+    }
+    return done;
+}
+
+void file_wait(file_t *file, file_waiter_t *waiter)
+{
+    assert(file->ops->wait != NULL);
+    file->ops->wait(file, waiter);
+}
+
+void file_cancel(file_t *file, file_waiter_t *waiter)
+{
+    assert(file->ops->cancel != NULL);
+    file->ops->cancel(file, waiter);
+}
+
+ssize_t file_write(file_t *file, const struct iovec *iov, size_t iovcnt)
+{
+    ssize_t done = file_pwrite(file, iov, iovcnt, file->offset);
+    if (done > 0) {
+        file->offset += done;
+    }
+    return done;
+}
+
+int file_size(file_t *file, uint64_t *size)
+{
+    if (file->ops->size == NULL) {
+        return -1;
+    }
+    return file->ops->size(file, size);
+}
+
+int fdtable_add(fdtable_t *fds, file_t *file)
+{
+    for (int fd = FIRST_FD; fd < PROCESS_MAX_FILES; fd++) {
+        if (fds->files[fd] == NULL) {
+            fds->files[fd] = file;
+            return fd;
+        }
+    }
+    ZF_LOGE("Too many open files");
+    return -1;
+}
+
+file_t *fdtable_get(fdtable_t *fds, int fd)
+{
+    if (fd < 0 || fd >= PROCESS_MAX_FILES) {
+        return NULL;
+    }
+    return fds->files[fd];
+}
+
+int fdtable_close(fdtable_t *fds, int fd)
+{
+    file_t *file = fdtable_get(fds, fd);
+    if (file == NULL) {
+        return -1;
+    }
+    fds->files[fd] = NULL;
+    file_put(file);
+    return 0;
+}
+
+void fdtable_copy(fdtable_t *dst, fdtable_t *src)
+{
+    for (int fd = 0; fd < PROCESS_MAX_FILES; fd++) {
+        dst->files[fd] = src->files[fd];
+        if (dst->files[fd] != NULL) {
+            file_get(dst->files[fd]);
+        }
+    }
+}
+
+void fdtable_close_all(fdtable_t *fds)
+{
+    for (int fd = 0; fd < PROCESS_MAX_FILES; fd++) {
+        fdtable_close(fds, fd);
+    }
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sos_protocol.h>
+
+/* Name of the console device, every other path names a file on NFS. */
+#define CONSOLE_PATH "console"
+
+typedef struct file file_t;
+
+/* Returned by a read of a file that has no data yet, which is then left to complete with file_wait(). */
+#define FILE_READ_LATER (-2)
+
+/* A read waiting for a file to have data, see file_wait(). */
+typedef struct file_waiter file_waiter_t;
+struct file_waiter {
+    /* The buffers to read into, which must stay valid until the read completes. */
+    const struct iovec *iov;
+    size_t iovcnt;
+    /* Called when the read completes, with the bytes read or -1. */
+    void (*done)(file_waiter_t *waiter, ssize_t result);
+    file_waiter_t *next;
+};
+
+/*
+ * Operations of a kind of file. Data is transferred to or from a list of
+ * buffers, which are parts of user pages accessed through the frame table.
+ */
+typedef struct {
+    /* @return bytes read from offset, which is less than asked for at the end of the data, or -1 */
+    ssize_t (*read)(file_t *file, const struct iovec *iov, size_t iovcnt, uint64_t offset);
+    /* @return bytes written at offset, or -1 */
+    ssize_t (*write)(file_t *file, const struct iovec *iov, size_t iovcnt, uint64_t offset);
+    /* Queue a read that returned FILE_READ_LATER, NULL if reads never do */
+    void (*wait)(file_t *file, file_waiter_t *waiter);
+    /* Remove a queued read that has not completed */
+    void (*cancel)(file_t *file, file_waiter_t *waiter);
+    /* Find the size of the file, NULL if it has none. @return 0 on success, -1 on failure */
+    int (*size)(file_t *file, uint64_t *size);
+    /* Release the resources of the file, which is then freed */
+    void (*close)(file_t *file);
+} file_ops_t;
+
+/* An open file, which may be shared by the file descriptors of several processes. */
+struct file {
+    const file_ops_t *ops;
+    /* The path the file was opened with, which identifies it */
+    char *path;
+    /* O_ flags the file was opened with */
+    int flags;
+    /* Number of references to the file, from file descriptors and mappings */
+    unsigned refs;
+    /* Position of the next read or write */
+    uint64_t offset;
+    /* State of the kind of file */
+    void *data;
+};
+
+/* The file descriptors of a process, NULL where not in use. */
+typedef struct {
+    file_t *files[PROCESS_MAX_FILES];
+} fdtable_t;
+
+/*
+ * Open a file, creating it if it does not exist.
+ *
+ * @param flags  O_ flags, of which the access mode is used.
+ * @return the file with a single reference, or NULL on failure.
+ */
+file_t *file_open(const char *path, int flags);
+
+/* Take another reference to a file. */
+file_t *file_get(file_t *file);
+
+/* Drop a reference to a file, closing it once none remain. */
+void file_put(file_t *file);
+
+/* Read into a list of buffers, from the current position of the file. */
+ssize_t file_read(file_t *file, const struct iovec *iov, size_t iovcnt);
+
+/*
+ * Complete a read that returned FILE_READ_LATER once the file has data, by
+ * reading into the buffers of the waiter and calling its done function.
+ */
+void file_wait(file_t *file, file_waiter_t *waiter);
+
+/* Give up on a read passed to file_wait() that has not completed. */
+void file_cancel(file_t *file, file_waiter_t *waiter);
+
+/* Write from a list of buffers, at the current position of the file. */
+ssize_t file_write(file_t *file, const struct iovec *iov, size_t iovcnt);
+
+/* Read into a list of buffers from an offset, leaving the position of the file alone. */
+ssize_t file_pread(file_t *file, const struct iovec *iov, size_t iovcnt, uint64_t offset);
+
+/* Write from a list of buffers at an offset, leaving the position of the file alone. */
+ssize_t file_pwrite(file_t *file, const struct iovec *iov, size_t iovcnt, uint64_t offset);
+
+/* Find the size of a file. @return 0 on success, -1 if it has no size. */
+int file_size(file_t *file, uint64_t *size);
+
+/*
+ * Give a file the lowest free descriptor. Descriptors 0 to 2 are never given out, as
+ * muslc assumes they are its standard streams.
+ *
+ * @return the descriptor, which owns the reference to file, or -1 if none are free.
+ */
+int fdtable_add(fdtable_t *fds, file_t *file);
+
+/* @return the file of a descriptor, NULL if it is not open. */
+file_t *fdtable_get(fdtable_t *fds, int fd);
+
+/* Close a descriptor. @return 0 on success, -1 if it is not open. */
+int fdtable_close(fdtable_t *fds, int fd);
+
+/* Open the files of one table in another, empty, one. */
+void fdtable_copy(fdtable_t *dst, fdtable_t *src);
+
+/* Close every descriptor of a table. */
+void fdtable_close_all(fdtable_t *fds);
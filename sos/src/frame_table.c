@@ -12,6 +12,7 @@
 #include "frame_table.h"
 #include "mapping.h"
 #include "vmem_layout.h"
+#include "pager.h"
 
 #include <assert.h>
 #include <string.h>
@@ -28,6 +29,8 @@ char *frame_table_list_names[] = {
     LIST_NAME_ENTRY(NO_LIST),
     LIST_NAME_ENTRY(FREE_LIST),
     LIST_NAME_ENTRY(ALLOCATED_LIST),
+    LIST_NAME_ENTRY(ZEROED_LIST),
+    LIST_NAME_ENTRY(PAGEABLE_LIST),
 };
 
 /*
@@ -36,6 +39,20 @@ char *frame_table_list_names[] = {
 typedef unsigned char frame_data_t[BIT(seL4_PageBits)];
 compile_time_assert("Frame data size correct", sizeof(frame_data_t) == BIT(seL4_PageBits));
 
+/*
+ * Sharing state of a frame, kept in an array alongside the frame table
+ * and indexed by the same frame_ref.
+ */
+typedef struct frame_meta frame_meta_t;
+PACKED struct frame_meta {
+    /* Number of references held to the frame. */
+    uint16_t refcount;
+    /* Number of outstanding pins on the frame. */
+    uint16_t pins;
+    /* Pager handle of the page backed by a pageable frame. */
+    uint32_t owner;
+};
+
 /* Memory-efficient doubly linked list of frames
  *
  * As all frame objects will live in effectively an array, we only need
@@ -63,10 +80,32 @@ static struct {
     size_t used;
     /* The current size of the frame table in bytes. */
     size_t byte_length;
+    /* The sharing state of every frame in the table. */
+    frame_meta_t *meta;
+    /* The current size of the sharing state array in bytes. */
+    size_t meta_byte_length;
     /* The free frames. */
     frame_list_t free;
     /* The allocated frames. */
     frame_list_t allocated;
+    /* The free frames that are known to be zeroed. */
+    frame_list_t zeroed;
+    /* The allocated frames that may be evicted, in clock order. */
+    frame_list_t pageable;
+    /* Allocations satisfied directly from the free list. */
+    size_t reserve_hits;
+    /* Allocations that found the free list empty. */
+    size_t reserve_misses;
+    /* Batches of frames provisioned. */
+    size_t refills;
+    /* Zeroed allocations satisfied from the zeroed list. */
+    size_t zeroed_hits;
+    /* Zeroed allocations that found the zeroed list empty. */
+    size_t zeroed_misses;
+    /* The most frames ever allocated at once. */
+    size_t max_allocated;
+    /* The last refill could not provision frames, so refills wait for a frame to be freed. */
+    bool refill_failed;
     /* cspace used to make allocations of capabilities. */
     cspace_t *cspace;
     /* vspace used to map pages into SOS. */
@@ -74,12 +113,29 @@ static struct {
 } frame_table = {
     .frames = (void *)SOS_FRAME_TABLE,
     .frame_data = (void *)SOS_FRAME_DATA,
+    .meta = (void *)SOS_FRAME_META,
     .free = { .list_id = FREE_LIST },
     .allocated = { .list_id = ALLOCATED_LIST },
+    .zeroed = { .list_id = ZEROED_LIST },
+    .pageable = { .list_id = PAGEABLE_LIST },
 };
 
 /* Management of frame nodes */
 static frame_ref_t ref_from_frame(frame_t *frame);
+static frame_meta_t *meta_from_ref(frame_ref_t frame_ref);
+
+/* Return a frame with no references or pins to the free list. */
+static void release_frame(frame_ref_t frame_ref);
+
+/* Move a frame taken off the free or zeroed list onto the allocated list. */
+static frame_ref_t mark_allocated(frame_t *frame);
+
+/* Zero the contents of a frame. */
+static void zero_frame_data(unsigned char *data);
+
+/* Zeroed pool watermarks. */
+#define ZEROED_POOL_HIGH (CONFIG_SOS_FRAME_ZEROED_POOL)
+#define ZEROED_POOL_LOW  (CONFIG_SOS_FRAME_ZEROED_POOL / 2)
 
 /* Management of frame list */
 static void push_front(frame_list_t *list, frame_t *frame);
@@ -95,14 +151,44 @@ static void remove_frame(frame_list_t *list, frame_t *frame);
  */
 static seL4_ARM_Page alloc_frame_at(uintptr_t vaddr);
 
-/* Allocate a new frame. */
-static frame_t *alloc_fresh_frame(void);
+/* Number of frames created and mapped into SOS together. */
+#define PROVISION_CHUNK 64
+
+/*
+ * Create new frames onto the back of the free list, mapping them into
+ * SOS together.
+ *
+ * @param n  Number of frames to create, at most PROVISION_CHUNK.
+ * @return   Number of frames actually created.
+ */
+static size_t create_frames(size_t n);
+
+/*
+ * Provision a batch of new frames onto the back of the free list.
+ *
+ * @param n  Number of frames to provision.
+ * @return   Number of frames actually provisioned.
+ */
+static size_t provision_frames(size_t n);
 
 /* Increase the capacity of the frame table.
  *
  * @return  0 on succuss, -ve on failure. */
 static int bump_capacity(void);
 
+/*
+ * Map more memory at the end of one of the frame table's arrays, using
+ * a large page where one is available and the end is suitably aligned.
+ *
+ * @param base              Address of the array in SOS.
+ * @param(in,out) byte_length  Mapped size of the array.
+ * @return                  0 on success, -ve on failure.
+ */
+static int grow_array(uintptr_t base, size_t *byte_length);
+
+/* Allocate a large page at a particular address in SOS. */
+static seL4_ARM_Page alloc_large_frame_at(uintptr_t vaddr);
+
 void frame_table_init(cspace_t *cspace, seL4_CPtr vspace)
 {
     frame_table.cspace = cspace;
@@ -118,25 +204,232 @@ frame_ref_t alloc_frame(void)
 {
     frame_t *frame = pop_front(&frame_table.free);
 
+    if (frame != NULL) {
+        frame_table.reserve_hits += 1;
+    } else {
+        /* Provision a whole batch so the next allocations hit the reserve. */
+        frame_table.reserve_misses += 1;
+        if (provision_frames(CONFIG_SOS_FRAME_RESERVE_BATCH) > 0) {
+            frame = pop_front(&frame_table.free);
+        }
+    }
+
     if (frame == NULL) {
-        frame = alloc_fresh_frame();
+        /* Nothing else left, use up the zeroed pool. */
+        frame = pop_front(&frame_table.zeroed);
+    }
+
+    if (frame == NULL && pager_evict() == 0) {
+        /* Evicting a page returns its frame to the free list. */
+        frame = pop_front(&frame_table.free);
     }
 
+    if (frame == NULL) {
+        return NULL_FRAME;
+    }
+
+    return mark_allocated(frame);
+}
+
+frame_ref_t alloc_zeroed_frame(void)
+{
+    frame_t *frame = pop_front(&frame_table.zeroed);
     if (frame != NULL) {
-        push_back(&frame_table.allocated, frame);
+        frame_table.zeroed_hits += 1;
+        return mark_allocated(frame);
     }
 
-    return ref_from_frame(frame);
+    frame_table.zeroed_misses += 1;
+    frame_ref_t frame_ref = alloc_frame();
+    if (frame_ref != NULL_FRAME) {
+        zero_frame_data(frame_data(frame_ref));
+    }
+    return frame_ref;
 }
 
 void free_frame(frame_ref_t frame_ref)
 {
-    if (frame_ref != NULL_FRAME) {
-        frame_t *frame = frame_from_ref(frame_ref);
+    frame_ref_put(frame_ref);
+}
+
+frame_ref_t frame_ref_get(frame_ref_t frame_ref)
+{
+    frame_meta_t *meta = meta_from_ref(frame_ref);
+    assert(meta->refcount > 0);
+    assert(meta->refcount < UINT16_MAX);
+    meta->refcount += 1;
+    return frame_ref;
+}
+
+void frame_ref_put(frame_ref_t frame_ref)
+{
+    if (frame_ref == NULL_FRAME) {
+        return;
+    }
+
+    frame_meta_t *meta = meta_from_ref(frame_ref);
+    assert(meta->refcount > 0);
+    meta->refcount -= 1;
+    if (meta->refcount == 0 && meta->pins == 0) {
+        release_frame(frame_ref);
+    }
+}
 
+void frame_ref_pin(frame_ref_t frame_ref)
+{
+    frame_meta_t *meta = meta_from_ref(frame_ref);
+    assert(meta->refcount > 0 || meta->pins > 0);
+    assert(meta->pins < UINT16_MAX);
+    meta->pins += 1;
+}
+
+void frame_ref_unpin(frame_ref_t frame_ref)
+{
+    frame_meta_t *meta = meta_from_ref(frame_ref);
+    assert(meta->pins > 0);
+    meta->pins -= 1;
+    if (meta->refcount == 0 && meta->pins == 0) {
+        release_frame(frame_ref);
+    }
+}
+
+size_t frame_ref_count(frame_ref_t frame_ref)
+{
+    return meta_from_ref(frame_ref)->refcount;
+}
+
+bool frame_pinned(frame_ref_t frame_ref)
+{
+    return meta_from_ref(frame_ref)->pins > 0;
+}
+
+void frame_set_pageable(frame_ref_t frame_ref, uint32_t owner)
+{
+    frame_t *frame = frame_from_ref(frame_ref);
+    meta_from_ref(frame_ref)->owner = owner;
+    if (frame->list_id == ALLOCATED_LIST) {
         remove_frame(&frame_table.allocated, frame);
-        push_front(&frame_table.free, frame);
+        push_back(&frame_table.pageable, frame);
     }
+    assert(frame->list_id == PAGEABLE_LIST);
+}
+
+void frame_set_unpageable(frame_ref_t frame_ref)
+{
+    frame_t *frame = frame_from_ref(frame_ref);
+    if (frame->list_id == PAGEABLE_LIST) {
+        remove_frame(&frame_table.pageable, frame);
+        push_back(&frame_table.allocated, frame);
+    }
+    assert(frame->list_id == ALLOCATED_LIST);
+}
+
+bool frame_evictable(frame_ref_t frame_ref)
+{
+    frame_meta_t *meta = meta_from_ref(frame_ref);
+    return frame_from_ref(frame_ref)->list_id == PAGEABLE_LIST && meta->pins == 0 && meta->refcount == 1;
+}
+
+uint32_t frame_owner(frame_ref_t frame_ref)
+{
+    assert(frame_from_ref(frame_ref)->list_id == PAGEABLE_LIST);
+    return meta_from_ref(frame_ref)->owner;
+}
+
+frame_ref_t frame_clock_next(void)
+{
+    /* Rotating the list moves the hand on, so stop after a full turn. */
+    for (size_t i = 0; i < frame_table.pageable.length; i++) {
+        frame_t *frame = pop_front(&frame_table.pageable);
+        push_back(&frame_table.pageable, frame);
+
+        frame_ref_t frame_ref = ref_from_frame(frame);
+        if (frame_evictable(frame_ref)) {
+            return frame_ref;
+        }
+    }
+    return NULL_FRAME;
+}
+
+static frame_ref_t mark_allocated(frame_t *frame)
+{
+    push_back(&frame_table.allocated, frame);
+    frame_table.max_allocated = MAX(frame_table.max_allocated,
+                                    frame_table.allocated.length + frame_table.pageable.length);
+
+    frame_ref_t frame_ref = ref_from_frame(frame);
+    *meta_from_ref(frame_ref) = (frame_meta_t) {
+        .refcount = 1,
+    };
+    return frame_ref;
+}
+
+static void release_frame(frame_ref_t frame_ref)
+{
+    frame_t *frame = frame_from_ref(frame_ref);
+
+    if (frame->list_id == PAGEABLE_LIST) {
+        remove_frame(&frame_table.pageable, frame);
+    } else {
+        remove_frame(&frame_table.allocated, frame);
+    }
+    push_front(&frame_table.free, frame);
+    frame_table.refill_failed = false;
+}
+
+bool frame_table_needs_refill(void)
+{
+    return !frame_table.refill_failed
+           && (frame_table.free.length < CONFIG_SOS_FRAME_RESERVE_LOW
+               || frame_table.zeroed.length < ZEROED_POOL_LOW);
+}
+
+void frame_table_refill(void)
+{
+    if (!frame_table_needs_refill()) {
+        return;
+    }
+
+    /* Zero frames from the reserve into the zeroed pool. */
+    while (frame_table.zeroed.length < ZEROED_POOL_HIGH) {
+        frame_t *frame = pop_front(&frame_table.free);
+        if (frame == NULL && provision_frames(CONFIG_SOS_FRAME_RESERVE_BATCH) > 0) {
+            frame = pop_front(&frame_table.free);
+        }
+        if (frame == NULL) {
+            frame_table.refill_failed = true;
+            break;
+        }
+        zero_frame_data(frame_data(ref_from_frame(frame)));
+        push_back(&frame_table.zeroed, frame);
+    }
+
+    while (frame_table.free.length < CONFIG_SOS_FRAME_RESERVE_HIGH) {
+        size_t batch = MIN(CONFIG_SOS_FRAME_RESERVE_BATCH,
+                           CONFIG_SOS_FRAME_RESERVE_HIGH - frame_table.free.length);
+        if (provision_frames(batch) < batch) {
+            /* Out of memory (or at the frame limit), stop trying until a frame is freed. */
+            frame_table.refill_failed = true;
+            break;
+        }
+    }
+}
+
+void frame_table_stats(frame_table_stats_t *stats)
+{
+    *stats = (frame_table_stats_t) {
+        .frames = frame_table.used > 0 ? frame_table.used - 1 : 0,
+        .reserve = frame_table.free.length,
+        .allocated = frame_table.allocated.length + frame_table.pageable.length,
+        .reserve_hits = frame_table.reserve_hits,
+        .reserve_misses = frame_table.reserve_misses,
+        .refills = frame_table.refills,
+        .zeroed = frame_table.zeroed.length,
+        .zeroed_hits = frame_table.zeroed_hits,
+        .zeroed_misses = frame_table.zeroed_misses,
+        .pageable = frame_table.pageable.length,
+        .max_allocated = frame_table.max_allocated,
+    };
 }
 
 seL4_ARM_Page frame_page(frame_ref_t frame_ref)
@@ -172,6 +465,36 @@ frame_t *frame_from_ref(frame_ref_t frame_ref)
     return &frame_table.frames[frame_ref];
 }
 
+static void zero_frame_data(unsigned char *data)
+{
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    /* Zero 64 bytes per iteration with paired 128-bit NEON stores. */
+    size_t remaining = BIT(seL4_PageBits);
+    asm volatile(
+        "movi v0.16b, #0\n"
+        "movi v1.16b, #0\n"
+        "1:\n"
+        "stp q0, q1, [%[data]]\n"
+        "stp q0, q1, [%[data], #32]\n"
+        "add %[data], %[data], #64\n"
+        "subs %[remaining], %[remaining], #64\n"
+        "b.ne 1b\n"
+        : [data] "+r"(data), [remaining] "+r"(remaining)
+        :
+        : "v0", "v1", "cc", "memory"
+    );
+#else
+    memset(data, 0, BIT(seL4_PageBits));
+#endif
+}
+
+static frame_meta_t *meta_from_ref(frame_ref_t frame_ref)
+{
+    assert(frame_ref != NULL_FRAME);
+    assert(frame_ref < frame_table.capacity);
+    return &frame_table.meta[frame_ref];
+}
+
 static frame_ref_t ref_from_frame(frame_t *frame)
 {
     assert(frame >= frame_table.frames);
@@ -284,8 +607,31 @@ static void remove_frame(frame_list_t *list, frame_t *frame)
     ZF_LOGD("%s.length = %lu", LIST_NAME(list), list->length);
 }
 
-static frame_t *alloc_fresh_frame(void)
+static size_t provision_frames(size_t n)
 {
+    size_t provisioned = 0;
+    while (provisioned < n) {
+        size_t batch = MIN(n - provisioned, PROVISION_CHUNK);
+        size_t created = create_frames(batch);
+        if (created == 0) {
+            break;
+        }
+        provisioned += created;
+        if (created < batch) {
+            break;
+        }
+    }
+
+    if (provisioned > 0) {
+        frame_table.refills += 1;
+        ZF_LOGD("Provisioned %zu frames, %lu in reserve", provisioned, frame_table.free.length);
+    }
+    return provisioned;
+}
+
+static size_t create_frames(size_t n)
+{
+    assert(n <= PROVISION_CHUNK);
     assert(frame_table.used <= frame_table.capacity);
 #ifdef CONFIG_SOS_FRAME_LIMIT
     if (CONFIG_SOS_FRAME_LIMIT != 0ul) {
@@ -293,37 +639,74 @@ static frame_t *alloc_fresh_frame(void)
     }
 #endif
 
-    if (frame_table.used == frame_table.capacity) {
-        if (bump_capacity() != 0) {
-            /* Could not increase capacity. */
-            return NULL;
+    if (frame_table.used == 0) {
+        if (frame_table.capacity == 0 && bump_capacity() != 0) {
+            return 0;
         }
+        /* The first frame is a sentinel NULL frame. */
+        frame_table.used += 1;
     }
 
-    assert(frame_table.used < frame_table.capacity);
+    /* Retype the frames first, growing the table to fit them. */
+    ut_t *uts[PROVISION_CHUNK];
+    seL4_ARM_Page caps[PROVISION_CHUNK];
+    size_t created = 0;
+    for (; created < n; created++) {
+        if (frame_table.used + created == frame_table.capacity && bump_capacity() != 0) {
+            /* Could not increase capacity. */
+            break;
+        }
 
-    if (frame_table.used == 0) {
-        /* The first frame is a sentinel NULL frame. */
-        frame_table.used += 1;
+        uts[created] = ut_alloc_4k_untyped(NULL);
+        if (uts[created] == NULL) {
+            break;
+        }
+
+        caps[created] = cspace_alloc_slot(frame_table.cspace);
+        if (caps[created] == seL4_CapNull) {
+            ut_free(uts[created]);
+            break;
+        }
+
+        int err = cspace_untyped_retype(frame_table.cspace, uts[created]->cap, caps[created],
+                                        seL4_ARM_SmallPageObject, seL4_PageBits);
+        if (err != 0) {
+            cspace_free_slot(frame_table.cspace, caps[created]);
+            ut_free(uts[created]);
+            break;
+        }
     }
 
-    frame_t *frame = &frame_table.frames[frame_table.used];
-    frame_table.used += 1;
+    if (created == 0) {
+        return 0;
+    }
 
-    uintptr_t vaddr = (uintptr_t)frame_data(ref_from_frame(frame));
-    seL4_ARM_Page sos_page = alloc_frame_at(vaddr);
-    if (sos_page == seL4_CapNull) {
-        frame_table.used -= 1;
-        return NULL;
+    /* Then map them all into consecutive entries of the data region. */
+    uintptr_t vaddr = (uintptr_t)frame_table.frame_data[frame_table.used];
+    seL4_ARM_VMAttributes attrs = seL4_ARM_Default_VMAttributes | seL4_ARM_ExecuteNever;
+    seL4_Error err = map_frames_range(frame_table.cspace, caps, created, frame_table.vspace, vaddr,
+                                      seL4_ReadWrite, attrs, NULL);
+    if (err != seL4_NoError) {
+        for (size_t i = 0; i < created; i++) {
+            cspace_delete(frame_table.cspace, caps[i]);
+            cspace_free_slot(frame_table.cspace, caps[i]);
+            ut_free(uts[i]);
+        }
+        return 0;
     }
 
-    *frame = (frame_t) {
-        .sos_page = sos_page,
-        .list_id = NO_LIST,
-    };
+    for (size_t i = 0; i < created; i++) {
+        frame_t *frame = &frame_table.frames[frame_table.used];
+        frame_table.used += 1;
+        *frame = (frame_t) {
+            .sos_page = caps[i],
+            .list_id = NO_LIST,
+        };
+        push_back(&frame_table.free, frame);
+    }
 
     ZF_LOGD("Frame table contains %lu/%lu frames", frame_table.used, frame_table.capacity);
-    return frame;
+    return created;
 }
 
 static int bump_capacity(void)
@@ -335,26 +718,89 @@ static int bump_capacity(void)
     }
 #endif
 
-    uintptr_t vaddr = (uintptr_t)frame_table.frames + frame_table.byte_length;
-
-    seL4_ARM_Page cptr = alloc_frame_at(vaddr);
-    if (cptr == seL4_CapNull) {
-        return -1;
+    /* A previous attempt may have grown the frames array but not the
+     * sharing state, in which case there is still room. */
+    if (frame_table.byte_length / sizeof(frame_t) <= frame_table.capacity) {
+        if (grow_array((uintptr_t)frame_table.frames, &frame_table.byte_length) != 0) {
+            return -1;
+        }
     }
 
-    frame_table.byte_length += BIT(seL4_PageBits);
-    frame_table.capacity = frame_table.byte_length / sizeof(frame_t);
+    size_t capacity = frame_table.byte_length / sizeof(frame_t);
 
 #ifdef CONFIG_SOS_FRAME_LIMIT
     if (CONFIG_SOS_FRAME_LIMIT != 0ul) {
-        frame_table.capacity = MIN(CONFIG_SOS_FRAME_LIMIT, frame_table.capacity);
+        capacity = MIN(CONFIG_SOS_FRAME_LIMIT, capacity);
     }
 #endif
 
+    /* Make sure there is sharing state for every frame in the new capacity. */
+    while (frame_table.meta_byte_length < capacity * sizeof(frame_meta_t)) {
+        if (grow_array((uintptr_t)frame_table.meta, &frame_table.meta_byte_length) != 0) {
+            return -1;
+        }
+    }
+
+    frame_table.capacity = capacity;
+
     ZF_LOGD("Frame table contains %lu/%lu frames", frame_table.used, frame_table.capacity);
     return 0;
 }
 
+static int grow_array(uintptr_t base, size_t *byte_length)
+{
+    uintptr_t vaddr = base + *byte_length;
+
+    /* Prefer a whole large page when at a large page boundary. */
+    if (IS_ALIGNED(vaddr, seL4_LargePageBits) && alloc_large_frame_at(vaddr) != seL4_CapNull) {
+        *byte_length += BIT(seL4_LargePageBits);
+        return 0;
+    }
+
+    if (alloc_frame_at(vaddr) == seL4_CapNull) {
+        return -1;
+    }
+    *byte_length += BIT(seL4_PageBits);
+    return 0;
+}
+
+static seL4_ARM_Page alloc_large_frame_at(uintptr_t vaddr)
+{
+    /* Allocate an untyped for the frame, if any were set aside. */
+    ut_t *ut = ut_alloc_2m_untyped(NULL);
+    if (ut == NULL) {
+        return seL4_CapNull;
+    }
+
+    /* Allocate a slot for the page capability. */
+    seL4_ARM_Page cptr = cspace_alloc_slot(frame_table.cspace);
+    if (cptr == seL4_CapNull) {
+        ut_free(ut);
+        return seL4_CapNull;
+    }
+
+    /* Retype the untyped into a large page. */
+    int err = cspace_untyped_retype(frame_table.cspace, ut->cap, cptr, seL4_ARM_LargePageObject,
+                                    seL4_LargePageBits);
+    if (err != 0) {
+        cspace_free_slot(frame_table.cspace, cptr);
+        ut_free(ut);
+        return seL4_CapNull;
+    }
+
+    /* Map the frame into SOS. */
+    seL4_ARM_VMAttributes attrs = seL4_ARM_Default_VMAttributes | seL4_ARM_ExecuteNever;
+    err = map_large_frame(frame_table.cspace, cptr, frame_table.vspace, vaddr, seL4_ReadWrite, attrs);
+    if (err != 0) {
+        cspace_delete(frame_table.cspace, cptr);
+        cspace_free_slot(frame_table.cspace, cptr);
+        ut_free(ut);
+        return seL4_CapNull;
+    }
+
+    return cptr;
+}
+
 static seL4_ARM_Page alloc_frame_at(uintptr_t vaddr)
 {
     /* Allocate an untyped for the frame. */
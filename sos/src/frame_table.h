@@ -36,13 +36,15 @@ typedef size_t frame_ref_t;
  * Identifiers of the different lists in the frame table.
  *
  * These are used to ensure that frame table entries move correctly
- * between the two lists and that those lists maintain a consistently
+ * between the lists and that those lists maintain a consistently
  * correct structure.
  */
 typedef enum {
     NO_LIST = 1,
     FREE_LIST = 2,
     ALLOCATED_LIST = 3,
+    ZEROED_LIST = 4,
+    PAGEABLE_LIST = 5,
 } list_id_t;
 
 /* Array of names for each of the lists above. */
@@ -61,12 +63,38 @@ PACKED struct frame {
     /* Index in frame table of next element in list. */
     frame_ref_t next : 19;
     /* Indicates which list the frame is in. */
-    list_id_t list_id : 2;
+    list_id_t list_id : 3;
     /* Unused bits */
-    size_t unused : 4;
+    size_t unused : 3;
 };
 compile_time_assert("Small CPtr size", 20 >= INITIAL_TASK_CSPACE_BITS);
 
+/* Counters describing the state of the frame table. */
+typedef struct {
+    /* Frames provisioned into the frame table (mapped into SOS). */
+    size_t frames;
+    /* Frames currently held in reserve, ready to be allocated. */
+    size_t reserve;
+    /* Frames currently allocated. */
+    size_t allocated;
+    /* Allocations satisfied directly from the reserve. */
+    size_t reserve_hits;
+    /* Allocations that found the reserve empty. */
+    size_t reserve_misses;
+    /* Batches of frames provisioned into the reserve. */
+    size_t refills;
+    /* Frames currently held zeroed, ready for alloc_zeroed_frame(). */
+    size_t zeroed;
+    /* Zeroed allocations satisfied from the zeroed pool. */
+    size_t zeroed_hits;
+    /* Zeroed allocations that had to zero a frame on demand. */
+    size_t zeroed_misses;
+    /* Allocated frames that the pager may evict. */
+    size_t pageable;
+    /* The most frames ever allocated at once. */
+    size_t max_allocated;
+} frame_table_stats_t;
+
 /*
  * Initialise frame table.
  *
@@ -83,10 +111,10 @@ cspace_t *frame_table_cspace(void);
 /*
  * Allocate a frame from the frame table.
  *
- * This allocates a frame from the frame table, using a 4K untyped if no
- * frames are spare. This frame may be dirty so make sure to zero-out
- * any memory in the frame that is not explicitly written over with
- * data.
+ * This allocates a frame from the frame table reserve. If the reserve is
+ * empty a batch of frames is provisioned from 4K untypeds first. This
+ * frame may be dirty so make sure to zero-out any memory in the frame
+ * that is not explicitly written over with data.
  *
  * DO NOT append the untypeds returned from this function into another
  * list. When they are allocated they are still tracked in a list within
@@ -97,22 +125,127 @@ cspace_t *frame_table_cspace(void);
  * untyped. This means that additional mappings to the frame can be made
  * by copying the capability.
  *
- * This function returns NULL if there are no free untypeds and an
- * untyped could not be allocated from the untyped manager.
- *
- * You will need to modify the frame table to deal with the case where
- * only a limited number of frames may be held by the frame table.
+ * If no untyped can be allocated from the untyped manager, or the frame
+ * table has reached CONFIG_SOS_FRAME_LIMIT, a pageable frame is evicted
+ * to swap to make room. This function returns NULL if that fails too.
  */
 frame_ref_t alloc_frame(void);
 
+/*
+ * Allocate a frame whose contents are all zero.
+ *
+ * This prefers frames from the pool of pre-zeroed frames, and otherwise
+ * allocates a frame as alloc_frame() does and zeroes it before
+ * returning.
+ */
+frame_ref_t alloc_zeroed_frame(void);
+
+/*
+ * Top up the reserve of provisioned frames and the zeroed pool.
+ *
+ * If the number of frames held in reserve has dropped below
+ * CONFIG_SOS_FRAME_RESERVE_LOW, new frames are provisioned in batches of
+ * CONFIG_SOS_FRAME_RESERVE_BATCH until CONFIG_SOS_FRAME_RESERVE_HIGH is
+ * reached (or memory runs out). If the zeroed pool has dropped below
+ * half of CONFIG_SOS_FRAME_ZEROED_POOL, free frames are zeroed until it
+ * is full again.
+ *
+ * Provisioning a frame costs several kernel invocations, so this should
+ * be called where that work is off the critical path, e.g. after a
+ * reply has been sent and before waiting for the next message.
+ */
+void frame_table_refill(void);
+
+/*
+ * Check if the reserve or the zeroed pool has dropped below its low
+ * watermark. Once a refill has failed to provision frames, e.g. at
+ * CONFIG_SOS_FRAME_LIMIT or with no 4K untypeds left, this is false until
+ * a frame is freed, so that refills are not retried on every message.
+ */
+bool frame_table_needs_refill(void);
+
+/*
+ * Get the current frame table counters.
+ */
+void frame_table_stats(frame_table_stats_t *stats);
+
 /*
  * Free a frame allocated by the frame table.
  *
- * This returns the frame to the frame table for re-use rather than
- * returning it to the untyped allocator.
+ * This drops the reference returned by alloc_frame(). The frame is only
+ * returned to the frame table for re-use (rather than to the untyped
+ * allocator) once the last reference is dropped and no pins remain.
  */
 void free_frame(frame_ref_t frame_ref);
 
+/*
+ * Take an additional reference to a frame.
+ *
+ * Every frame returned by alloc_frame() starts with a single reference.
+ * Each party sharing the frame (e.g. each address space it is mapped
+ * into) should hold its own reference.
+ *
+ * @return the frame_ref passed in.
+ */
+frame_ref_t frame_ref_get(frame_ref_t frame_ref);
+
+/*
+ * Drop a reference to a frame, freeing it if it was the last reference
+ * and the frame is not pinned.
+ */
+void frame_ref_put(frame_ref_t frame_ref);
+
+/*
+ * Pin a frame in memory.
+ *
+ * A pinned frame is never reused, even if all references are dropped,
+ * until it is unpinned. Pins should be held while a frame is in use for
+ * DMA or I/O.
+ */
+void frame_ref_pin(frame_ref_t frame_ref);
+
+/*
+ * Release a pin on a frame, freeing it if it was the last pin and no
+ * references remain.
+ */
+void frame_ref_unpin(frame_ref_t frame_ref);
+
+/* Get the number of references held to a frame. */
+size_t frame_ref_count(frame_ref_t frame_ref);
+
+/* Check if a frame is currently pinned. */
+bool frame_pinned(frame_ref_t frame_ref);
+
+/*
+ * Make an allocated frame a candidate for eviction by the pager.
+ *
+ * @param owner  handle the pager uses to find the page backed by the
+ *               frame.
+ */
+void frame_set_pageable(frame_ref_t frame_ref, uint32_t owner);
+
+/*
+ * Stop a frame being a candidate for eviction, e.g. as it is being shared.
+ */
+void frame_set_unpageable(frame_ref_t frame_ref);
+
+/* Check if a frame is pageable and not held by anything but its owner. */
+bool frame_evictable(frame_ref_t frame_ref);
+
+/* Get the owner of a pageable frame. */
+uint32_t frame_owner(frame_ref_t frame_ref);
+
+/*
+ * Advance the clock hand over the pageable frames.
+ *
+ * Frames are visited in a round-robin order, skipping any that are
+ * pinned or shared.
+ *
+ * @return the frame under the hand, or NULL_FRAME if no frame is
+ *         currently eligible for eviction.
+ */
+frame_ref_t frame_clock_next(void);
+
 /*
  * Get the contents of a frame as mapped into SOS.
  *
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "lz.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <utils/util.h>
+
+/* Shortest copy worth encoding. */
+#define LZ_MIN_MATCH    4
+/* A block ends with at least this many literals. */
+#define LZ_LAST_LITERALS 5
+/* No match starts within this many bytes of the end of a block. */
+#define LZ_MATCH_LIMIT  12
+/* Lengths in a token above which more length bytes follow. */
+#define LZ_RUN_MASK     15
+#define LZ_HASH_BITS    12
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Bytes taken by a literal run and match of the given lengths, at most. */
+static size_t sequence_size(size_t literals, size_t match)
+{
+    return 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+}
+
+/* Write the bytes extending a length that does not fit in its token. */
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+    for (len -= LZ_RUN_MASK; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+/* Write a literal run, and the token for the match that follows it. */
+static uint8_t *put_literals(uint8_t *op, const uint8_t *literals, size_t len, size_t match)
+{
+    *op++ = MIN(len, LZ_RUN_MASK) << 4 | MIN(match, LZ_RUN_MASK);
+    if (len >= LZ_RUN_MASK) {
+        op = put_length(op, len);
+    }
+    memcpy(op, literals, len);
+    return op + len;
+}
+
+size_t lz_compress(const void *src, size_t len, void *dst, size_t max)
+{
+    assert(len <= LZ_MAX_INPUT);
+    const uint8_t *base = src;
+    const uint8_t *end = base + len;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    uint8_t *op = dst;
+    uint8_t *oend = op + max;
+    /* Positions of recent sequences, which need checking as they may collide. */
+    uint16_t table[BIT(LZ_HASH_BITS)] = {};
+
+    while (len >= LZ_MATCH_LIMIT && ip <= end - LZ_MATCH_LIMIT) {
+        uint32_t seq = read32(ip);
+        unsigned h = hash(seq);
+        const uint8_t *ref = base + table[h];
+        table[h] = ip - base;
+        if (ref >= ip || read32(ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        const uint8_t *match_end = ip + LZ_MIN_MATCH;
+        ref += LZ_MIN_MATCH;
+        while (match_end < end - LZ_LAST_LITERALS && *match_end == *ref) {
+            match_end++;
+            ref++;
+        }
+
+        size_t literals = ip - anchor;
+        size_t match = match_end - ip - LZ_MIN_MATCH;
+        if (sequence_size(literals, match) > (size_t) (oend - op)) {
+            return 0;
+        }
+        op = put_literals(op, anchor, literals, match);
+        size_t offset = match_end - ref;
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        if (match >= LZ_RUN_MASK) {
+            op = put_length(op, match);
+        }
+        ip = anchor = match_end;
+    }
+
+    size_t literals = end - anchor;
+    if (sequence_size(literals, 0) > (size_t) (oend - op)) {
+        return 0;
+    }
+    op = put_literals(op, anchor, literals, 0);
+    return op - (uint8_t *) dst;
+}
+
+/* Read the bytes extending a length from its token. @return 0 on success, -1 if src runs out. */
+static int get_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+    uint8_t b;
+    do {
+        if (*ip == end) {
+            return -1;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+ssize_t lz_decompress(const void *src, size_t len, void *dst, size_t max)
+{
+    const uint8_t *ip = src;
+    const uint8_t *end = ip + len;
+    uint8_t *op = dst;
+    uint8_t *oend = op + max;
+
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == LZ_RUN_MASK && get_length(&ip, end, &literals) != 0) {
+            return -1;
+        }
+        if (literals > (size_t) (end - ip) || literals > (size_t) (oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == end) {
+            /* The last sequence has no match */
+            break;
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t match = token & LZ_RUN_MASK;
+        if (match == LZ_RUN_MASK && get_length(&ip, end, &match) != 0) {
+            return -1;
+        }
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t) (op - (uint8_t *) dst) || match > (size_t) (oend - op)) {
+            return -1;
+        }
+        /* Copy a byte at a time, as the match may overlap what it produces */
+        const uint8_t *ref = op - offset;
+        while (match-- > 0) {
+            *op++ = *ref++;
+        }
+    }
+    return op - (uint8_t *) dst;
+}
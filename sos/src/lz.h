@@ -0,0 +1,43 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * A fast LZ77 compressor in the style of LZ4, whose block format it uses: a
+ * sequence of literal runs each followed by a copy of earlier output. It
+ * trades ratio for speed, so that pages can be compressed inline as they are
+ * evicted.
+ */
+
+/* Largest input that can be compressed, as match offsets are 16 bits. */
+#define LZ_MAX_INPUT 65535
+
+/*
+ * Compress a buffer.
+ *
+ * @param len  length of src, at most LZ_MAX_INPUT.
+ * @param max  room in dst.
+ * @return the compressed length, or 0 if it would not fit in max bytes.
+ */
+size_t lz_compress(const void *src, size_t len, void *dst, size_t max);
+
+/*
+ * Decompress a buffer produced by lz_compress().
+ *
+ * @param max  room in dst.
+ * @return the decompressed length, or -1 if src is corrupt or does not
+ *         decompress into max bytes.
+ */
+ssize_t lz_decompress(const void *src, size_t len, void *dst, size_t max);
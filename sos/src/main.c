@@ -21,7 +21,6 @@
 #include <aos/debug.h>
 
 #include <clock/clock.h>
-#include <cpio/cpio.h>
 #include <elf/elf.h>
 #include <serial/serial.h>
 
@@ -31,18 +30,31 @@
 #include "bootstrap.h"
 #include "irq.h"
 #include "network.h"
+#include "console.h"
+#include "file.h"
+#include "mapped_file.h"
 #include "frame_table.h"
 #include "drivers/uart.h"
 #include "ut.h"
 #include "vmem_layout.h"
 #include "mapping.h"
+#include "objpool.h"
 #include "elfload.h"
+#include "addrspace.h"
+#include "pager.h"
+#include "swap.h"
+#include "zswap.h"
+#include "asid.h"
+#include "process.h"
 #include "syscalls.h"
 #include "tests.h"
 #include "utils.h"
 #include "threads.h"
 
 #include <aos/vsyscall.h>
+#include <sos_protocol.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 /*
  * To differentiate between signals from notification objects and and IPC messages,
@@ -57,22 +69,7 @@
 #define IRQ_IDENT_BADGE_BITS MASK(seL4_BadgeBits - 1ul)
 
 #define TTY_NAME             "tty_test"
-#define TTY_PRIORITY         (0)
-#define TTY_EP_BADGE         (101)
 
-/* The number of additional stack pages to provide to the initial
- * process */
-#define INITIAL_PROCESS_EXTRA_STACK_PAGES 4
-
-/*
- * A dummy starting syscall
- */
-#define SOS_SYSCALL0 0
-
-/* The linker will link this symbol to the start address  *
- * of an archive of attached applications.                */
-extern char _cpio_archive[];
-extern char _cpio_archive_end[];
 extern char __eh_frame_start[];
 /* provided by gcc */
 extern void (__register_frame)(void *);
@@ -83,30 +80,258 @@ cspace_t cspace;
 static seL4_CPtr sched_ctrl_start;
 static seL4_CPtr sched_ctrl_end;
 
-/* the one process we start */
-static struct {
-    ut_t *tcb_ut;
-    seL4_CPtr tcb;
-    ut_t *vspace_ut;
-    seL4_CPtr vspace;
+/* The reply object that syscall_loop receives on, replaced when a read keeps it. */
+static ut_t *reply_ut;
+static seL4_CPtr reply;
 
-    ut_t *ipc_buffer_ut;
-    seL4_CPtr ipc_buffer;
+/*
+ * Report the memory usage of SOS in the message registers.
+ */
+static seL4_MessageInfo_t handle_mem_stats(void)
+{
+    compile_time_assert("Memory statistics fit in a message", SOS_MEM_STATS_WORDS <= seL4_MsgMaxLength);
+    compile_time_assert("Memory statistics cover every untyped size",
+                        SOS_MEM_SIZE_CLASSES == N_UNTYPED_LISTS);
+
+    frame_table_stats_t frames;
+    frame_table_stats(&frames);
+    ut_stats_t uts;
+    ut_stats(&uts);
+    swap_stats_t swaps;
+    swap_stats(&swaps);
+    pager_stats_t pages;
+    pager_stats(&pages);
+    zswap_stats_t zswaps;
+    zswap_stats(&zswaps);
+    asid_stats_t asids;
+    asid_stats(&asids);
+
+    sos_mem_stats_t stats = {
+        .frames = frames.frames,
+        .frames_free = frames.reserve + frames.zeroed,
+        .frames_allocated = frames.allocated,
+        .frames_pageable = frames.pageable,
+        .frames_max_allocated = frames.max_allocated,
+        .ut_bytes = ut_size(),
+        .page_table_frames = page_table_frames(),
+        .paging_structures = mapping_paging_structures(),
+        .cslots_used = cspace.n_slots_used,
+        .cslots_max_used = cspace.max_slots_used,
+        .swap_used = swaps.used,
+        .swap_pageouts = swaps.writes,
+        .swap_writes = swaps.write_clusters,
+        .swap_pageins = swaps.reads,
+        .swap_reads = swaps.read_clusters,
+        .swap_prefetches = pages.prefetches,
+        .zswap_frames = zswaps.frames,
+        .zswap_pages = zswaps.pages,
+        .zswap_bytes = zswaps.bytes,
+        .zswap_pageouts = zswaps.stores,
+        .zswap_pageins = zswaps.loads,
+        .zswap_rejects = zswaps.rejects + zswaps.full,
+        .asid_pools = asids.pools,
+        .asids_used = asids.used,
+        .asids_capacity = asids.capacity,
+    };
+    for (size_t i = 0; i < SOS_MEM_SIZE_CLASSES; i++) {
+        stats.ut_free[i] = uts.free[i];
+        stats.ut_split[i] = uts.split[i];
+    }
 
-    ut_t *sched_context_ut;
-    seL4_CPtr sched_context;
+    seL4_Word *words = (seL4_Word *) &stats;
+    for (size_t i = 0; i < SOS_MEM_STATS_WORDS; i++) {
+        seL4_SetMR(i, words[i]);
+    }
+    return seL4_MessageInfo_new(0, 0, 0, SOS_MEM_STATS_WORDS);
+}
 
-    cspace_t cspace;
+/*
+ * Convert PROT_ flags of an mmap request to region permissions.
+ */
+static seL4_Word prot_to_region_perms(seL4_Word prot)
+{
+    seL4_Word perms = 0;
+    if (prot & PROT_READ) {
+        perms |= REGION_READ;
+    }
+    if (prot & PROT_WRITE) {
+        perms |= REGION_WRITE;
+    }
+    if (prot & PROT_EXEC) {
+        perms |= REGION_EXEC;
+    }
+    return perms;
+}
 
-    ut_t *stack_ut;
-    seL4_CPtr stack;
-} tty_test_process;
+/*
+ * Open a file for a process, with a path in its address space.
+ */
+static int handle_open(process_t *proc, uintptr_t path_vaddr, size_t len, int flags)
+{
+    if (len > SOS_PATH_MAX) {
+        ZF_LOGE("Path of %zu bytes is too long", len);
+        return -1;
+    }
+
+    char path[SOS_PATH_MAX + 1];
+    size_t copied = 0;
+    while (copied < len) {
+        struct iovec iov[IO_BATCH_PAGES];
+        frame_ref_t frames[IO_BATCH_PAGES];
+        ssize_t n = as_pin(&cspace, &proc->as, path_vaddr + copied, len - copied, false,
+                           iov, frames, IO_BATCH_PAGES);
+        if (n < 0) {
+            return -1;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            memcpy(path + copied, iov[i].iov_base, iov[i].iov_len);
+            copied += iov[i].iov_len;
+        }
+        as_unpin(frames, n);
+    }
+    path[len] = '\0';
+
+    file_t *file = file_open(path, flags);
+    if (file == NULL) {
+        return -1;
+    }
+    int fd = fdtable_add(&proc->fds, file);
+    if (fd < 0) {
+        file_put(file);
+    }
+    return fd;
+}
+
+/*
+ * Hand a read that found no input, with its pinned pages and the reply object, to the
+ * process to complete later, and receive the next message on a fresh reply object.
+ */
+static int read_later(process_t *proc, file_t *file, struct iovec *iov, frame_ref_t *frames,
+                      size_t pages)
+{
+    seL4_CPtr next_reply;
+    ut_t *next_reply_ut = objpool_alloc(OBJPOOL_REPLY, &next_reply);
+    if (next_reply_ut == NULL) {
+        ZF_LOGE("Failed to alloc reply object ut");
+        as_unpin(frames, pages);
+        return -1;
+    }
+    process_read_later(proc, file, iov, frames, pages, reply, reply_ut);
+    reply = next_reply;
+    reply_ut = next_reply_ut;
+    return 0;
+}
+
+/*
+ * Read a file into a buffer in a process's address space, or write it from the buffer.
+ * The pages of the buffer are accessed in place through the frame table, rather than
+ * copied through the IPC buffer, so a buffer of any size is transferred by a single syscall.
+ * A read of a file with no input yet is replied to once input arrives, rather than
+ * SOS waiting for it, and clears have_reply.
+ */
+static ssize_t handle_io(process_t *proc, int fd, uintptr_t vaddr, size_t len, bool to_user,
+                         bool *have_reply)
+{
+    file_t *file = fdtable_get(&proc->fds, fd);
+    if (file == NULL) {
+        ZF_LOGE("Invalid file descriptor %d", fd);
+        return -1;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        struct iovec iov[IO_BATCH_PAGES];
+        frame_ref_t frames[IO_BATCH_PAGES];
+        ssize_t n = as_pin(&cspace, &proc->as, vaddr + done, len - done, to_user,
+                           iov, frames, IO_BATCH_PAGES);
+        if (n < 0) {
+            return done == 0 ? -1 : (ssize_t) done;
+        }
+
+        size_t want = 0;
+        for (ssize_t i = 0; i < n; i++) {
+            want += iov[i].iov_len;
+        }
+        ssize_t result = to_user ? file_read(file, iov, n) : file_write(file, iov, n);
+        if (result == FILE_READ_LATER && done == 0) {
+            if (read_later(proc, file, iov, frames, n) != 0) {
+                return -1;
+            }
+            *have_reply = false;
+            return 0;
+        }
+        as_unpin(frames, n);
+        if (result < 0) {
+            return done == 0 ? -1 : (ssize_t) done;
+        }
+
+        done += result;
+        if ((size_t) result < want) {
+            break;
+        }
+    }
+    return done;
+}
+
+/*
+ * Describe the processes that exist in an array in a process's address space.
+ */
+static int handle_process_status(process_t *proc, uintptr_t vaddr, size_t max)
+{
+    sos_process_t status[MAX_PROCESSES];
+    size_t n = process_status(status, MIN(max, MAX_PROCESSES));
+
+    size_t len = n * sizeof(sos_process_t);
+    size_t copied = 0;
+    while (copied < len) {
+        struct iovec iov[IO_BATCH_PAGES];
+        frame_ref_t frames[IO_BATCH_PAGES];
+        ssize_t pages = as_pin(&cspace, &proc->as, vaddr + copied, len - copied, true,
+                               iov, frames, IO_BATCH_PAGES);
+        if (pages < 0) {
+            return -1;
+        }
+        for (ssize_t i = 0; i < pages; i++) {
+            memcpy(iov[i].iov_base, (char *) status + copied, iov[i].iov_len);
+            copied += iov[i].iov_len;
+        }
+        as_unpin(frames, pages);
+    }
+    return n;
+}
+
+/*
+ * Map anonymous memory, or part of an open file, into a process.
+ */
+static uintptr_t handle_mmap(process_t *proc, size_t length, seL4_Word prot, seL4_Word flags, int fd,
+                             uint64_t offset)
+{
+    seL4_Word perms = prot_to_region_perms(prot);
+    if (flags & MAP_ANONYMOUS) {
+        return as_mmap(&proc->as, length, perms);
+    }
+
+    file_t *file = fdtable_get(&proc->fds, fd);
+    if (file == NULL || (file->flags & O_ACCMODE) == O_WRONLY) {
+        ZF_LOGE("File descriptor %d can not be mapped", fd);
+        return 0;
+    }
+
+    bool shared = flags & MAP_SHARED;
+    mapped_file_t *mf = mapped_file_get(file, shared && (perms & REGION_WRITE));
+    if (mf == NULL) {
+        return 0;
+    }
+    uintptr_t vaddr = as_mmap_file(&proc->as, length, perms, mf, offset, shared);
+    mapped_file_put(mf);
+    return vaddr;
+}
 
 /**
  * Deals with a syscall and sets the message registers before returning the
  * message info to be passed through to seL4_ReplyRecv()
  */
-seL4_MessageInfo_t handle_syscall(UNUSED seL4_Word badge, UNUSED int num_args, bool *have_reply)
+seL4_MessageInfo_t handle_syscall(process_t *proc, UNUSED int num_args, bool *have_reply)
 {
     seL4_MessageInfo_t reply_msg;
 
@@ -128,6 +353,70 @@ seL4_MessageInfo_t handle_syscall(UNUSED seL4_Word badge, UNUSED int num_args, b
 
         break;
 
+    case SOS_SYSCALL_MEM_STATS:
+        reply_msg = handle_mem_stats();
+        break;
+
+    case SOS_SYSCALL_BRK:
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, as_brk(&proc->as, seL4_GetMR(1)));
+        break;
+
+    case SOS_SYSCALL_MMAP:
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, handle_mmap(proc, seL4_GetMR(1), seL4_GetMR(2), seL4_GetMR(3), seL4_GetMR(4),
+                                  seL4_GetMR(5)));
+        break;
+
+    case SOS_SYSCALL_MSYNC:
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, as_msync(&proc->as, seL4_GetMR(1), seL4_GetMR(2)));
+        break;
+
+    case SOS_SYSCALL_FORK: {
+        process_t *child = process_fork(proc);
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, child == NULL ? -1 : child->pid);
+        break;
+    }
+
+    case SOS_SYSCALL_SHARE_VM:
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, as_share(&proc->as, seL4_GetMR(1), seL4_GetMR(2), seL4_GetMR(3)));
+        break;
+
+    case SOS_SYSCALL_MUNMAP:
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, as_munmap(&proc->as, seL4_GetMR(1), seL4_GetMR(2)));
+        break;
+
+    case SOS_SYSCALL_OPEN:
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, handle_open(proc, seL4_GetMR(1), seL4_GetMR(2), seL4_GetMR(3)));
+        break;
+
+    case SOS_SYSCALL_CLOSE:
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, fdtable_close(&proc->fds, seL4_GetMR(1)));
+        break;
+
+    case SOS_SYSCALL_MY_ID:
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, proc->pid);
+        break;
+
+    case SOS_SYSCALL_PROCESS_STATUS:
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, handle_process_status(proc, seL4_GetMR(1), seL4_GetMR(2)));
+        break;
+
+    case SOS_SYSCALL_READ:
+    case SOS_SYSCALL_WRITE:
+        reply_msg = seL4_MessageInfo_new(0, 0, 0, 1);
+        seL4_SetMR(0, handle_io(proc, seL4_GetMR(1), seL4_GetMR(2), seL4_GetMR(3),
+                                syscall_number == SOS_SYSCALL_READ, have_reply));
+        break;
+
     default:
         reply_msg = seL4_MessageInfo_new(0, 0, 0, 0);
         ZF_LOGE("Unknown syscall %lu\n", syscall_number);
@@ -140,10 +429,8 @@ seL4_MessageInfo_t handle_syscall(UNUSED seL4_Word badge, UNUSED int num_args, b
 
 NORETURN void syscall_loop(seL4_CPtr ep)
 {
-    seL4_CPtr reply;
-    
     /* Create reply object */
-    ut_t *reply_ut = alloc_retype(&reply, seL4_ReplyObject, seL4_ReplyBits);
+    reply_ut = objpool_alloc(OBJPOOL_REPLY, &reply);
     if (reply_ut == NULL) {
         ZF_LOGF("Failed to alloc reply object ut");
     }
@@ -166,322 +453,53 @@ NORETURN void syscall_loop(seL4_CPtr ep)
         /* Awake! We got a message - check the label and badge to
          * see what the message is about */
         seL4_Word label = seL4_MessageInfo_get_label(message);
+        process_t *proc = NULL;
 
         if (badge & IRQ_EP_BADGE) {
             /* It's a notification from our bound notification
              * object! */
             sos_handle_irq_notification(&badge, &have_reply);
+        } else if ((proc = process_from_badge(badge)) == NULL) {
+            ZF_LOGE("Message with unknown badge %lu", badge);
+            have_reply = false;
         } else if (label == seL4_Fault_NullFault) {
 
             /* It's not a fault or an interrupt, it must be an IPC
-             * message from tty_test! */
-            reply_msg = handle_syscall(badge, seL4_MessageInfo_get_length(message) - 1, &have_reply);
+             * message from a process! */
+            reply_msg = handle_syscall(proc, seL4_MessageInfo_get_length(message) - 1, &have_reply);
+        } else if (label == seL4_Fault_VMFault
+                   && as_handle_fault(&cspace, &proc->as,
+                                      seL4_Fault_VMFault_get_Addr(seL4_getFault(message)),
+                                      seL4_Fault_VMFault_get_FSR(seL4_getFault(message)),
+                                      seL4_Fault_VMFault_get_PrefetchFault(seL4_getFault(message))) == 0) {
+            /* The page was paged in or allocated, replying restarts the
+             * faulting instruction. */
+            reply_msg = seL4_MessageInfo_new(0, 0, 0, 0);
+            have_reply = true;
         } else {
             /* some kind of fault */
-            debug_print_fault(message, TTY_NAME);
+            debug_print_fault(message, proc->name);
             /* dump registers too */
-            debug_dump_registers(tty_test_process.tcb);
+            debug_dump_registers(proc->tcb);
             /* Don't reply and recv on nothing */
             have_reply = false;
 
-            ZF_LOGF("The SOS skeleton does not know how to handle faults!");
-        }
-    }
-}
-
-static int stack_write(seL4_Word *mapped_stack, int index, uintptr_t val)
-{
-    mapped_stack[index] = val;
-    return index - 1;
-}
-
-/* set up System V ABI compliant stack, so that the process can
- * start up and initialise the C library */
-static uintptr_t init_process_stack(cspace_t *cspace, seL4_CPtr local_vspace, elf_t *elf_file)
-{
-    /* Create a stack frame */
-    tty_test_process.stack_ut = alloc_retype(&tty_test_process.stack, seL4_ARM_SmallPageObject, seL4_PageBits);
-    if (tty_test_process.stack_ut == NULL) {
-        ZF_LOGE("Failed to allocate stack");
-        return 0;
-    }
-
-    /* virtual addresses in the target process' address space */
-    uintptr_t stack_top = PROCESS_STACK_TOP;
-    uintptr_t stack_bottom = PROCESS_STACK_TOP - PAGE_SIZE_4K;
-    /* virtual addresses in the SOS's address space */
-    void *local_stack_top  = (seL4_Word *) SOS_SCRATCH;
-    uintptr_t local_stack_bottom = SOS_SCRATCH - PAGE_SIZE_4K;
-
-    /* find the vsyscall table */
-    uintptr_t sysinfo = *((uintptr_t *) elf_getSectionNamed(elf_file, "__vsyscall", NULL));
-    if (sysinfo == 0) {
-        ZF_LOGE("could not find syscall table for c library");
-        return 0;
-    }
-
-    /* Map in the stack frame for the user app */
-    seL4_Error err = map_frame(cspace, tty_test_process.stack, tty_test_process.vspace, stack_bottom,
-                               seL4_AllRights, seL4_ARM_Default_VMAttributes);
-    if (err != 0) {
-        ZF_LOGE("Unable to map stack for user app");
-        return 0;
-    }
-
-    /* allocate a slot to duplicate the stack frame cap so we can map it into our address space */
-    seL4_CPtr local_stack_cptr = cspace_alloc_slot(cspace);
-    if (local_stack_cptr == seL4_CapNull) {
-        ZF_LOGE("Failed to alloc slot for stack");
-        return 0;
-    }
-
-    /* copy the stack frame cap into the slot */
-    err = cspace_copy(cspace, local_stack_cptr, cspace, tty_test_process.stack, seL4_AllRights);
-    if (err != seL4_NoError) {
-        cspace_free_slot(cspace, local_stack_cptr);
-        ZF_LOGE("Failed to copy cap");
-        return 0;
-    }
-
-    /* map it into the sos address space */
-    err = map_frame(cspace, local_stack_cptr, local_vspace, local_stack_bottom, seL4_AllRights,
-                    seL4_ARM_Default_VMAttributes);
-    if (err != seL4_NoError) {
-        cspace_delete(cspace, local_stack_cptr);
-        cspace_free_slot(cspace, local_stack_cptr);
-        return 0;
-    }
-
-    int index = -2;
-
-    /* null terminate the aux vectors */
-    index = stack_write(local_stack_top, index, 0);
-    index = stack_write(local_stack_top, index, 0);
-
-    /* write the aux vectors */
-    index = stack_write(local_stack_top, index, PAGE_SIZE_4K);
-    index = stack_write(local_stack_top, index, AT_PAGESZ);
-
-    index = stack_write(local_stack_top, index, sysinfo);
-    index = stack_write(local_stack_top, index, AT_SYSINFO);
-
-    index = stack_write(local_stack_top, index, PROCESS_IPC_BUFFER);
-    index = stack_write(local_stack_top, index, AT_SEL4_IPC_BUFFER_PTR);
-
-    /* null terminate the environment pointers */
-    index = stack_write(local_stack_top, index, 0);
-
-    /* we don't have any env pointers - skip */
-
-    /* null terminate the argument pointers */
-    index = stack_write(local_stack_top, index, 0);
-
-    /* no argpointers - skip */
-
-    /* set argc to 0 */
-    stack_write(local_stack_top, index, 0);
-
-    /* adjust the initial stack top */
-    stack_top += (index * sizeof(seL4_Word));
-
-    /* the stack *must* remain aligned to a double word boundary,
-     * as GCC assumes this, and horrible bugs occur if this is wrong */
-    assert(index % 2 == 0);
-    assert(stack_top % (sizeof(seL4_Word) * 2) == 0);
-
-    /* unmap our copy of the stack */
-    err = seL4_ARM_Page_Unmap(local_stack_cptr);
-    assert(err == seL4_NoError);
-
-    /* delete the copy of the stack frame cap */
-    err = cspace_delete(cspace, local_stack_cptr);
-    assert(err == seL4_NoError);
-
-    /* mark the slot as free */
-    cspace_free_slot(cspace, local_stack_cptr);
-
-    /* Exend the stack with extra pages */
-    for (int page = 0; page < INITIAL_PROCESS_EXTRA_STACK_PAGES; page++) {
-        stack_bottom -= PAGE_SIZE_4K;
-        frame_ref_t frame = alloc_frame();
-        if (frame == NULL_FRAME) {
-            ZF_LOGE("Couldn't allocate additional stack frame");
-            return 0;
+            /* The process can not continue, but the rest of the system can */
+            ZF_LOGE("Unable to resolve fault of %s, destroying process %d", proc->name, proc->pid);
+            process_destroy(proc);
         }
 
-        /* allocate a slot to duplicate the stack frame cap so we can map it into the application */
-        seL4_CPtr frame_cptr = cspace_alloc_slot(cspace);
-        if (frame_cptr == seL4_CapNull) {
-            free_frame(frame);
-            ZF_LOGE("Failed to alloc slot for stack extra stack frame");
-            return 0;
+        /* Top up the frame reserve and object pools once the caller has its reply,
+         * keeping frame provisioning and retyping off the critical path of the syscall. */
+        if (frame_table_needs_refill() || objpool_needs_refill()) {
+            if (have_reply) {
+                seL4_Send(reply, reply_msg);
+                have_reply = false;
+            }
+            frame_table_refill();
+            objpool_refill();
         }
-
-        /* copy the stack frame cap into the slot */
-        err = cspace_copy(cspace, frame_cptr, cspace, frame_page(frame), seL4_AllRights);
-        if (err != seL4_NoError) {
-            cspace_free_slot(cspace, frame_cptr);
-            free_frame(frame);
-            ZF_LOGE("Failed to copy cap");
-            return 0;
-        }
-
-        err = map_frame(cspace, frame_cptr, tty_test_process.vspace, stack_bottom,
-                        seL4_AllRights, seL4_ARM_Default_VMAttributes);
-        if (err != 0) {
-            cspace_delete(cspace, frame_cptr);
-            cspace_free_slot(cspace, frame_cptr);
-            free_frame(frame);
-            ZF_LOGE("Unable to map extra stack frame for user app");
-            return 0;
-        }
-    }
-
-    return stack_top;
-}
-
-/* Start the first process, and return true if successful
- *
- * This function will leak memory if the process does not start successfully.
- * TODO: avoid leaking memory once you implement real processes, otherwise a user
- *       can force your OS to run out of memory by creating lots of failed processes.
- */
-bool start_first_process(char *app_name, seL4_CPtr ep)
-{
-    /* Create a VSpace */
-    tty_test_process.vspace_ut = alloc_retype(&tty_test_process.vspace, seL4_ARM_PageGlobalDirectoryObject,
-                                              seL4_PGDBits);
-    if (tty_test_process.vspace_ut == NULL) {
-        return false;
-    }
-
-    /* assign the vspace to an asid pool */
-    seL4_Word err = seL4_ARM_ASIDPool_Assign(seL4_CapInitThreadASIDPool, tty_test_process.vspace);
-    if (err != seL4_NoError) {
-        ZF_LOGE("Failed to assign asid pool");
-        return false;
-    }
-
-    /* Create a simple 1 level CSpace */
-    err = cspace_create_one_level(&cspace, &tty_test_process.cspace);
-    if (err != CSPACE_NOERROR) {
-        ZF_LOGE("Failed to create cspace");
-        return false;
-    }
-
-    /* Create an IPC buffer */
-    tty_test_process.ipc_buffer_ut = alloc_retype(&tty_test_process.ipc_buffer, seL4_ARM_SmallPageObject,
-                                                  seL4_PageBits);
-    if (tty_test_process.ipc_buffer_ut == NULL) {
-        ZF_LOGE("Failed to alloc ipc buffer ut");
-        return false;
-    }
-
-    /* allocate a new slot in the target cspace which we will mint a badged endpoint cap into --
-     * the badge is used to identify the process, which will come in handy when you have multiple
-     * processes. */
-    seL4_CPtr user_ep = cspace_alloc_slot(&tty_test_process.cspace);
-    if (user_ep == seL4_CapNull) {
-        ZF_LOGE("Failed to alloc user ep slot");
-        return false;
-    }
-
-    /* now mutate the cap, thereby setting the badge */
-    err = cspace_mint(&tty_test_process.cspace, user_ep, &cspace, ep, seL4_AllRights, TTY_EP_BADGE);
-    if (err) {
-        ZF_LOGE("Failed to mint user ep");
-        return false;
-    }
-
-    /* Create a new TCB object */
-    tty_test_process.tcb_ut = alloc_retype(&tty_test_process.tcb, seL4_TCBObject, seL4_TCBBits);
-    if (tty_test_process.tcb_ut == NULL) {
-        ZF_LOGE("Failed to alloc tcb ut");
-        return false;
-    }
-
-    /* Configure the TCB */
-    err = seL4_TCB_Configure(tty_test_process.tcb,
-                             tty_test_process.cspace.root_cnode, seL4_NilData,
-                             tty_test_process.vspace, seL4_NilData, PROCESS_IPC_BUFFER,
-                             tty_test_process.ipc_buffer);
-    if (err != seL4_NoError) {
-        ZF_LOGE("Unable to configure new TCB");
-        return false;
-    }
-
-    /* Create scheduling context */
-    tty_test_process.sched_context_ut = alloc_retype(&tty_test_process.sched_context, seL4_SchedContextObject,
-                                                     seL4_MinSchedContextBits);
-    if (tty_test_process.sched_context_ut == NULL) {
-        ZF_LOGE("Failed to alloc sched context ut");
-        return false;
-    }
-
-    /* Configure the scheduling context to use the first core with budget equal to period */
-    err = seL4_SchedControl_Configure(sched_ctrl_start, tty_test_process.sched_context, US_IN_MS, US_IN_MS, 0, 0);
-    if (err != seL4_NoError) {
-        ZF_LOGE("Unable to configure scheduling context");
-        return false;
-    }
-
-    /* bind sched context, set fault endpoint and priority
-     * In MCS, fault end point needed here should be in current thread's cspace.
-     * NOTE this will use the unbadged ep unlike above, you might want to mint it with a badge
-     * so you can identify which thread faulted in your fault handler */
-    err = seL4_TCB_SetSchedParams(tty_test_process.tcb, seL4_CapInitThreadTCB, seL4_MinPrio, TTY_PRIORITY,
-                                  tty_test_process.sched_context, ep);
-    if (err != seL4_NoError) {
-        ZF_LOGE("Unable to set scheduling params");
-        return false;
     }
-
-    /* Provide a name for the thread -- Helpful for debugging */
-    NAME_THREAD(tty_test_process.tcb, app_name);
-
-    /* parse the cpio image */
-    ZF_LOGI("\nStarting \"%s\"...\n", app_name);
-    elf_t elf_file = {};
-    unsigned long elf_size;
-    size_t cpio_len = _cpio_archive_end - _cpio_archive;
-    const char *elf_base = cpio_get_file(_cpio_archive, cpio_len, app_name, &elf_size);
-    if (elf_base == NULL) {
-        ZF_LOGE("Unable to locate cpio header for %s", app_name);
-        return false;
-    }
-    /* Ensure that the file is an elf file. */
-    if (elf_newFile(elf_base, elf_size, &elf_file)) {
-        ZF_LOGE("Invalid elf file");
-        return -1;
-    }
-
-    /* set up the stack */
-    seL4_Word sp = init_process_stack(&cspace, seL4_CapInitThreadVSpace, &elf_file);
-
-    /* load the elf image from the cpio file */
-    err = elf_load(&cspace, tty_test_process.vspace, &elf_file);
-    if (err) {
-        ZF_LOGE("Failed to load elf image");
-        return false;
-    }
-
-    /* Map in the IPC buffer for the thread */
-    err = map_frame(&cspace, tty_test_process.ipc_buffer, tty_test_process.vspace, PROCESS_IPC_BUFFER,
-                    seL4_AllRights, seL4_ARM_Default_VMAttributes);
-    if (err != 0) {
-        ZF_LOGE("Unable to map IPC buffer for user app");
-        return false;
-    }
-
-    /* Start the new process */
-    seL4_UserContext context = {
-        .pc = elf_getEntryPoint(&elf_file),
-        .sp = sp,
-    };
-    printf("Starting ttytest at %p\n", (void *) context.pc);
-    err = seL4_TCB_WriteRegisters(tty_test_process.tcb, 1, 0, 2, &context);
-    ZF_LOGE_IF(err, "Failed to write registers");
-    return err == seL4_NoError;
 }
 
 /* Allocate an endpoint and a notification object for sos.
@@ -491,7 +509,7 @@ bool start_first_process(char *app_name, seL4_CPtr ep)
 static void sos_ipc_init(seL4_CPtr *ipc_ep, seL4_CPtr *ntfn)
 {
     /* Create an notification object for interrupts */
-    ut_t *ut = alloc_retype(ntfn, seL4_NotificationObject, seL4_NotificationBits);
+    ut_t *ut = objpool_alloc(OBJPOOL_NOTIFICATION, ntfn);
     ZF_LOGF_IF(!ut, "No memory for notification object");
 
     /* Bind the notification object to our TCB */
@@ -499,7 +517,7 @@ static void sos_ipc_init(seL4_CPtr *ipc_ep, seL4_CPtr *ntfn)
     ZF_LOGF_IFERR(err, "Failed to bind notification object to TCB");
 
     /* Create an endpoint for user application IPC */
-    ut = alloc_retype(ipc_ep, seL4_EndpointObject, seL4_EndpointBits);
+    ut = objpool_alloc(OBJPOOL_ENDPOINT, ipc_ep);
     ZF_LOGF_IF(!ut, "No memory for endpoint");
 }
 
@@ -552,6 +570,7 @@ void init_muslc(void)
 NORETURN void *main_continued(UNUSED void *arg)
 {
     /* Initialise other system compenents here */
+    objpool_init();
     seL4_CPtr ipc_ep, ntfn;
     sos_ipc_init(&ipc_ep, &ntfn);
     sos_init_irq_dispatch(
@@ -575,6 +594,9 @@ NORETURN void *main_continued(UNUSED void *arg)
     printf("Network init\n");
     network_init(&cspace, timer_vaddr, ntfn);
 
+    /* The console runs over the network */
+    console_init();
+
     /* Initialises the timer */
     printf("Timer init\n");
     start_timer(timer_vaddr);
@@ -583,8 +605,10 @@ NORETURN void *main_continued(UNUSED void *arg)
 
     /* Start the user application */
     printf("Start first process\n");
-    bool success = start_first_process(TTY_NAME, ipc_ep);
-    ZF_LOGF_IF(!success, "Failed to start first process");
+    init_processes(ipc_ep, sched_ctrl_start);
+    run_process_tests(&cspace, TTY_NAME);
+    process_t *first = process_start(TTY_NAME);
+    ZF_LOGF_IF(first == NULL, "Failed to start first process");
 
     printf("\nSOS entering syscall loop\n");
     init_threads(ipc_ep, sched_ctrl_start, sched_ctrl_end);
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "mapped_file.h"
+#include "page_cache.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/util.h>
+
+struct mapped_file {
+    /* Open file the pages are read from and written back to. */
+    file_t *file;
+    /* Size of the file when it was last mapped, beyond which pages are not written back. */
+    uint64_t size;
+    unsigned refs;
+    /* Next in the list of mapped files. */
+    mapped_file_t *next;
+};
+
+static mapped_file_t *mapped_files;
+
+mapped_file_t *mapped_file_get(file_t *file, bool writable)
+{
+    if (writable && (file->flags & O_ACCMODE) != O_RDWR) {
+        ZF_LOGE("%s is not open for reading and writing", file->path);
+        return NULL;
+    }
+
+    uint64_t size;
+    if (file_size(file, &size) != 0) {
+        ZF_LOGE("%s can not be mapped", file->path);
+        return NULL;
+    }
+
+    mapped_file_t *mf = mapped_files;
+    while (mf != NULL && strcmp(mf->file->path, file->path) != 0) {
+        mf = mf->next;
+    }
+    if (mf == NULL) {
+        mf = malloc(sizeof(mapped_file_t));
+        if (mf == NULL) {
+            ZF_LOGE("Out of memory for mapped file");
+            return NULL;
+        }
+        *mf = (mapped_file_t) {
+            .file = file_get(file),
+            .next = mapped_files,
+        };
+        mapped_files = mf;
+    } else if (writable && (mf->file->flags & O_ACCMODE) != O_RDWR) {
+        /* Write back through a file that allows it */
+        file_put(mf->file);
+        mf->file = file_get(file);
+    }
+
+    mf->size = size;
+    mf->refs++;
+    return mf;
+}
+
+mapped_file_t *mapped_file_dup(mapped_file_t *mf)
+{
+    mf->refs++;
+    return mf;
+}
+
+void mapped_file_put(mapped_file_t *mf)
+{
+    assert(mf->refs > 0);
+    mf->refs--;
+    if (mf->refs > 0) {
+        return;
+    }
+
+    page_cache_remove(mf);
+    mapped_file_t **prev = &mapped_files;
+    while (*prev != mf) {
+        prev = &(*prev)->next;
+    }
+    *prev = mf->next;
+    file_put(mf->file);
+    free(mf);
+}
+
+static int write_page(const void *file, uintptr_t offset, frame_ref_t frame)
+{
+    const mapped_file_t *mf = file;
+    if (offset >= mf->size) {
+        return 0;
+    }
+
+    /* Never grow the file to a whole page */
+    struct iovec iov = {
+        .iov_base = frame_data(frame),
+        .iov_len = MIN(PAGE_SIZE_4K, mf->size - offset),
+    };
+    ssize_t done = file_pwrite(mf->file, &iov, 1, offset);
+    if (done != (ssize_t) iov.iov_len) {
+        ZF_LOGE("Failed to write back page at %p of %s", (void *) offset, mf->file->path);
+        return -1;
+    }
+    return 0;
+}
+
+frame_ref_t mapped_file_page(mapped_file_t *mf, uint64_t offset)
+{
+    assert(IS_ALIGNED(offset, seL4_PageBits));
+    frame_ref_t frame = page_cache_lookup(mf, offset);
+    if (frame != NULL_FRAME) {
+        return frame_ref_get(frame);
+    }
+
+    frame = alloc_zeroed_frame();
+    if (frame == NULL_FRAME) {
+        ZF_LOGE("Out of memory for page of %s", mf->file->path);
+        return NULL_FRAME;
+    }
+
+    struct iovec iov = { .iov_base = frame_data(frame), .iov_len = PAGE_SIZE_4K };
+    if (offset < mf->size && file_pread(mf->file, &iov, 1, offset) < 0) {
+        free_frame(frame);
+        return NULL_FRAME;
+    }
+    /* The page may hold code, so make it visible to instruction fetch. */
+    flush_frame(frame);
+
+    if (page_cache_insert(mf, offset, frame, write_page) != 0) {
+        ZF_LOGE("Page cache is full");
+        free_frame(frame);
+        return NULL_FRAME;
+    }
+    return frame;
+}
+
+void mapped_file_dirty(mapped_file_t *mf, uint64_t offset)
+{
+    page_cache_set_dirty(mf, offset);
+}
+
+int mapped_file_sync(mapped_file_t *mf, uint64_t start, uint64_t end)
+{
+    return page_cache_flush(mf, start, end);
+}
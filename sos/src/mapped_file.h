@@ -0,0 +1,61 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "file.h"
+#include "frame_table.h"
+
+/*
+ * A file mapped into address spaces. Every mapping of the same path shares
+ * one, which identifies the pages of the file in the page cache, so that the
+ * mappings share frames.
+ *
+ * The pages are not coherent with reads and writes of the file through file
+ * descriptors, which bypass the page cache.
+ */
+typedef struct mapped_file mapped_file_t;
+
+/*
+ * Find the mapped file of an open file, or start mapping it.
+ *
+ * @param writable  the file is to be mapped shared and writable, so must be open for writing.
+ * @return the mapped file with a reference taken, or NULL on failure.
+ */
+mapped_file_t *mapped_file_get(file_t *file, bool writable);
+
+/* Take another reference to a mapped file. */
+mapped_file_t *mapped_file_dup(mapped_file_t *mf);
+
+/* Drop a reference to a mapped file, writing back and dropping its pages once none remain. */
+void mapped_file_put(mapped_file_t *mf);
+
+/*
+ * Get the frame of a page of the file, reading it in to the page cache if needed.
+ * Pages beyond the end of the file are zero filled.
+ *
+ * @param offset  of the page in the file, page aligned.
+ * @return the frame with a reference taken, or NULL_FRAME on failure.
+ */
+frame_ref_t mapped_file_page(mapped_file_t *mf, uint64_t offset);
+
+/* Record that a page of the file is about to be written through a mapping. */
+void mapped_file_dirty(mapped_file_t *mf, uint64_t offset);
+
+/*
+ * Write the dirty pages from start to end back to the file.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int mapped_file_sync(mapped_file_t *mf, uint64_t start, uint64_t end);
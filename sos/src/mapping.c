@@ -9,6 +9,7 @@
  *
  * @TAG(DATA61_GPL)
  */
+#include <stdlib.h>
 #include <sel4/sel4.h>
 #include <sel4/sel4_arch/mapping.h>
 
@@ -16,6 +17,9 @@
 #include "ut.h"
 #include "vmem_layout.h"
 
+/* Paging structures allocated by the mapping functions and not yet freed. */
+static size_t n_paging_structures;
+
 /**
  * Retypes and maps a page table into the root servers page global directory
  * @param cspace that the cptrs refer to
@@ -75,7 +79,7 @@ static seL4_Error retype_map_pud(cspace_t *cspace, seL4_CPtr vspace, seL4_Word v
 
 static seL4_Error map_frame_impl(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vspace, seL4_Word vaddr,
                                  seL4_CapRights_t rights, seL4_ARM_VMAttributes attr,
-                                 seL4_CPtr *free_slots, seL4_Word *used)
+                                 seL4_CPtr *free_slots, seL4_Word *used, paging_structures_t *structures)
 {
     /* Attempt the mapping */
     seL4_Error err = seL4_ARM_Page_Map(frame_cap, vspace, vaddr, rights, attr);
@@ -83,10 +87,20 @@ static seL4_Error map_frame_impl(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPt
         /* save this so nothing else trashes the message register value */
         seL4_Word failed = seL4_MappingFailedLookupLevel();
 
+        paging_structure_t *structure = NULL;
+        if (structures != NULL) {
+            structure = malloc(sizeof(paging_structure_t));
+            if (structure == NULL) {
+                ZF_LOGE("Out of memory for paging structure");
+                return -1;
+            }
+        }
+
         /* Assume the error was because we are missing a paging structure */
         ut_t *ut = ut_alloc_4k_untyped(NULL);
         if (ut == NULL) {
             ZF_LOGE("Out of 4k untyped");
+            free(structure);
             return -1;
         }
 
@@ -101,6 +115,8 @@ static seL4_Error map_frame_impl(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPt
 
         if (slot == seL4_CapNull) {
             ZF_LOGE("No cptr to alloc paging structure");
+            ut_free(ut);
+            free(structure);
             return -1;
         }
 
@@ -117,7 +133,24 @@ static seL4_Error map_frame_impl(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPt
             break;
         }
 
+        if (err != seL4_NoError && structure != NULL) {
+            cspace_delete(cspace, slot);
+            cspace_free_slot(cspace, slot);
+            ut_free(ut);
+            free(structure);
+            return err;
+        }
+
         if (!err) {
+            n_paging_structures++;
+            if (structure != NULL) {
+                *structure = (paging_structure_t) {
+                    .cap = slot,
+                    .ut = ut,
+                    .next = structures->head,
+                };
+                structures->head = structure;
+            }
             /* Try the mapping again */
             err = seL4_ARM_Page_Map(frame_cap, vspace, vaddr, rights, attr);
         }
@@ -134,15 +167,84 @@ seL4_Error map_frame_cspace(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vsp
         ZF_LOGE("Invalid arguments");
         return -1;
     }
-    return map_frame_impl(cspace, frame_cap, vspace, vaddr, rights, attr, free_slots, used);
+    return map_frame_impl(cspace, frame_cap, vspace, vaddr, rights, attr, free_slots, used, NULL);
 }
 
 seL4_Error map_frame(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vspace, seL4_Word vaddr,
                      seL4_CapRights_t rights, seL4_ARM_VMAttributes attr)
 {
-    return map_frame_impl(cspace, frame_cap, vspace, vaddr, rights, attr, NULL, NULL);
+    return map_frame_impl(cspace, frame_cap, vspace, vaddr, rights, attr, NULL, NULL, NULL);
+}
+
+seL4_Error map_user_frame(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vspace, seL4_Word vaddr,
+                          seL4_CapRights_t rights, seL4_ARM_VMAttributes attr, paging_structures_t *structures)
+{
+    return map_frame_impl(cspace, frame_cap, vspace, vaddr, rights, attr, NULL, NULL, structures);
+}
+
+void paging_structures_free(cspace_t *cspace, paging_structures_t *structures)
+{
+    /* Deleting the last cap to a structure destroys it, so its untyped can be reused */
+    while (structures->head != NULL) {
+        paging_structure_t *structure = structures->head;
+        structures->head = structure->next;
+        cspace_delete(cspace, structure->cap);
+        cspace_free_slot(cspace, structure->cap);
+        ut_free(structure->ut);
+        free(structure);
+        n_paging_structures--;
+    }
+}
+
+seL4_Error map_frames_range(cspace_t *cspace, seL4_CPtr *caps, size_t n, seL4_CPtr vspace, seL4_Word vaddr,
+                            seL4_CapRights_t rights, seL4_ARM_VMAttributes attr,
+                            paging_structures_t *structures)
+{
+    assert(IS_ALIGNED(vaddr, seL4_PageBits));
+
+    for (size_t i = 0; i < n; i++) {
+        seL4_Word page_vaddr = vaddr + i * PAGE_SIZE_4K;
+        seL4_Error err;
+        if (i == 0 || IS_ALIGNED(page_vaddr, seL4_PageTableIndexBits + seL4_PageBits)) {
+            /* The first page under each page table finds and creates any missing
+             * structures, after which the rest of that page table maps directly. */
+            err = map_frame_impl(cspace, caps[i], vspace, page_vaddr, rights, attr, NULL, NULL, structures);
+        } else {
+            err = seL4_ARM_Page_Map(caps[i], vspace, page_vaddr, rights, attr);
+        }
+
+        if (err != seL4_NoError) {
+            ZF_LOGE("Failed to map page %zu of range at %p", i, (void *) vaddr);
+            unmap_frames_range(caps, i);
+            return err;
+        }
+    }
+    return seL4_NoError;
+}
+
+seL4_Error unmap_frames_range(seL4_CPtr *caps, size_t n)
+{
+    seL4_Error result = seL4_NoError;
+    for (size_t i = 0; i < n; i++) {
+        seL4_Error err = seL4_ARM_Page_Unmap(caps[i]);
+        if (err != seL4_NoError && result == seL4_NoError) {
+            result = err;
+        }
+    }
+    return result;
 }
 
+seL4_Error map_large_frame(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vspace, seL4_Word vaddr,
+                           seL4_CapRights_t rights, seL4_ARM_VMAttributes attr)
+{
+    if (!IS_ALIGNED(vaddr, seL4_LargePageBits)) {
+        ZF_LOGE("Large page at unaligned address %p", (void *) vaddr);
+        return seL4_AlignmentError;
+    }
+    /* A large page is mapped by the page directory, so at most a PD and PUD are
+     * ever missing. */
+    return map_frame_impl(cspace, frame_cap, vspace, vaddr, rights, attr, NULL, NULL, NULL);
+}
 
 static uintptr_t device_virt = SOS_DEVICE_START;
 
@@ -188,3 +290,8 @@ void *sos_map_device(cspace_t *cspace, uintptr_t addr, size_t size)
 
     return vstart;
 }
+
+size_t mapping_paging_structures(void)
+{
+    return n_paging_structures;
+}
@@ -15,6 +15,24 @@
 #include <sel4/sel4.h>
 #include <cspace/cspace.h>
 
+#include "ut.h"
+
+/* A paging structure allocated to map pages into a vspace. */
+typedef struct paging_structure {
+    seL4_CPtr cap;
+    /* Untyped the structure was retyped from. */
+    ut_t *ut;
+    struct paging_structure *next;
+} paging_structure_t;
+
+/*
+ * The paging structures allocated to map pages into a user vspace, recorded
+ * so that they can be freed along with the vspace.
+ */
+typedef struct {
+    paging_structure_t *head;
+} paging_structures_t;
+
 /**
  * Maps a page.
  *
@@ -52,9 +70,8 @@ seL4_Error map_frame_cspace(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vsp
  * If you *know* you can map the vaddr without allocating any other paging structures, or that it is
  * safe to allocate cslots, you can provide NULL as the cspace.
 
- * TODO: any allocated intermediate paging structures and slots are thrown away by this function.
- * This is fine for basic SOS, but once you have a structure for tracking process virtual memory,
- * you'll need to modify this function, or write a new one, that stores the intermediate structures, such that
+ * Any allocated intermediate paging structures and slots are thrown away by this function, which is
+ * fine for SOS's own vspace. User vspaces are mapped with map_user_frame, which records them so that
  * they can be deleted later.
  *
  * @param cspace          CSpace which can be used to allocate slots for intermediate paging structures.
@@ -69,6 +86,73 @@ seL4_Error map_frame_cspace(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vsp
 seL4_Error map_frame(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vspace, seL4_Word vaddr, seL4_CapRights_t rights,
                      seL4_ARM_VMAttributes attr);
 
+/* Maps a page into a user vspace, as map_frame does, recording any intermediate paging structures
+ * allocated so that they can be freed with paging_structures_free().
+ *
+ * @param structures      Where to record the paging structures allocated.
+ *
+ * @return 0 on success
+ */
+seL4_Error map_user_frame(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vspace, seL4_Word vaddr,
+                          seL4_CapRights_t rights, seL4_ARM_VMAttributes attr, paging_structures_t *structures);
+
+/*
+ * Free the paging structures recorded for a vspace, returning their untypeds to the untyped
+ * allocator. Any pages mapped through them are unmapped.
+ *
+ * @param cspace          CSpace the structures were allocated slots in.
+ */
+void paging_structures_free(cspace_t *cspace, paging_structures_t *structures);
+
+/* Maps a run of pages at consecutive virtual addresses, allocating intermediate structures and
+ * cslots with the cspace provided.
+ *
+ * seL4 can not be asked which paging structures exist, so only the first page mapped under each
+ * page table (every 2MiB) is used to discover and create missing structures. Every other page is
+ * mapped with a single invocation. On failure, any pages already mapped are unmapped again.
+ *
+ * @param cspace          CSpace which can be used to allocate slots for intermediate paging structures.
+ * @param caps            Capabilities to the frames to be mapped (seL4_ARM_SmallPageObject).
+ * @param n               The number of frames to map.
+ * @param vspace          A capability to the vspace (seL4_ARM_PageGlobalDirectoryObject).
+ * @param vaddr           The virtual address to map the first frame, following frames are mapped
+ *                        at the following pages.
+ * @param rights          The access rights for the mappings
+ * @param attr            The VM attributes to use for the mappings
+ * @param structures      Where to record the paging structures allocated, as for map_user_frame, or NULL
+ *                        if they are to be thrown away as map_frame does.
+ *
+ * @return 0 on success
+ */
+seL4_Error map_frames_range(cspace_t *cspace, seL4_CPtr *caps, size_t n, seL4_CPtr vspace, seL4_Word vaddr,
+                            seL4_CapRights_t rights, seL4_ARM_VMAttributes attr,
+                            paging_structures_t *structures);
+
+/* Unmaps a set of pages mapped with map_frames_range.
+ *
+ * @param caps  Capabilities to the frames to be unmapped.
+ * @param n     The number of frames to unmap.
+ *
+ * @return 0 on success, otherwise the first error encountered.
+ */
+seL4_Error unmap_frames_range(seL4_CPtr *caps, size_t n);
+
+/* Maps a large page (2MiB), allocating intermediate structures and cslots with the cspace provided.
+ *
+ * As for map_frame, any intermediate paging structures allocated are thrown away.
+ *
+ * @param cspace          CSpace which can be used to allocate slots for intermediate paging structures.
+ * @param frame_cap       A capbility to the frame to be mapped (seL4_ARM_LargePageObject).
+ * @param vspace          A capability to the vspace (seL4_ARM_PageGlobalDirectoryObject).
+ * @param vaddr           The virtual address to map the frame, aligned to 2MiB.
+ * @param rights          The access rights for the mapping
+ * @param attr            The VM attributes to use for the mapping
+ *
+ * @return 0 on success
+ */
+seL4_Error map_large_frame(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vspace, seL4_Word vaddr,
+                           seL4_CapRights_t rights, seL4_ARM_VMAttributes attr);
+
 /*
  * Map a device and return the virtual address it is mapped to.
  *
@@ -78,3 +162,6 @@ seL4_Error map_frame(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vspace, se
  * @return address that the device is mapped at.
  * */
 void *sos_map_device(cspace_t *cspace, uintptr_t addr, size_t size);
+
+/* The number of paging structures allocated by the functions above and not yet freed, each a 4K object. */
+size_t mapping_paging_structures(void);
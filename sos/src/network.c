@@ -66,6 +66,8 @@
 
 static struct pico_device pico_dev;
 static struct nfs_context *nfs = NULL;
+static volatile bool nfs_mounted = false;
+static seL4_CPtr network_ntfn;
 static int dhcp_status = DHCP_STATUS_WAIT;
 static char nfs_dir_buf[PATH_MAX];
 static uint8_t ip_octet;
@@ -216,6 +218,8 @@ void network_init(cspace_t *cspace, void *timer_vaddr, seL4_CPtr irq_ntfn)
     int error;
     ZF_LOGI("\nInitialising network...\n\n");
 
+    network_ntfn = irq_ntfn;
+
     /* set up the network device irq */
     init_irq(NETWORK_IRQ, true, network_irq);
 
@@ -301,4 +305,62 @@ void nfs_mount_cb(int status, UNUSED struct nfs_context *nfs, void *data,
     }
 
     printf("Mounted nfs dir %s\n", nfs_dir_buf);
+    nfs_mounted = true;
+}
+
+void network_wait(volatile bool *done)
+{
+    while (!*done) {
+        seL4_Word badge;
+        seL4_Wait(network_ntfn, &badge);
+
+        UNUSED bool have_reply;
+        sos_handle_irq_notification(&badge, &have_reply);
+    }
+}
+
+void network_nfs_cb(int status, UNUSED struct nfs_context *nfs, void *data, void *private_data)
+{
+    nfs_req_t *req = private_data;
+    req->status = status;
+    if (status >= 0 && req->copy != NULL) {
+        req->copy(req, data, status);
+    } else if (status >= 0) {
+        req->file = data;
+    } else {
+        ZF_LOGE("NFS request failed: %s", (char *) data);
+    }
+
+    if (req->batch == NULL) {
+        req->done = true;
+    } else if (--req->batch->outstanding == 0) {
+        req->batch->done = true;
+    }
+}
+
+int network_nfs_wait(nfs_req_t *req, int err)
+{
+    assert(req->batch == NULL);
+    if (err != 0) {
+        ZF_LOGE("Failed to queue NFS request: %s", nfs_get_error(nfs));
+        return -1;
+    }
+    network_wait(&req->done);
+    return req->status;
+}
+
+void network_batch_wait(nfs_batch_t *batch)
+{
+    if (batch->outstanding > 0) {
+        network_wait(&batch->done);
+    }
+}
+
+struct nfs_context *network_nfs(void)
+{
+    if (nfs == NULL) {
+        return NULL;
+    }
+    network_wait(&nfs_mounted);
+    return nfs;
 }
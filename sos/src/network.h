@@ -11,6 +11,8 @@
  */
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <sel4/types.h>
 #include <cspace/cspace.h>
 
@@ -25,3 +27,61 @@
  *                       and has a completely different programming model!)
  */
 void network_init(cspace_t *cspace, void *timer_vaddr, seL4_CPtr irq_ntfn);
+
+/**
+ * Handle interrupts until an asynchronous operation completes.
+ *
+ * Used to wait on NFS requests that SOS cannot make progress without, such as
+ * paging I/O. Interrupts other than the network ones are handled as usual.
+ *
+ * @param done  set by the completion callback of the operation
+ */
+void network_wait(volatile bool *done);
+
+struct nfs_context;
+struct nfsfh;
+
+/* A batch of NFS requests that are waited on together. */
+typedef struct {
+    volatile bool done;
+    /* Requests queued and not yet complete. */
+    size_t outstanding;
+} nfs_batch_t;
+
+/* State of an outstanding NFS request, the private data of network_nfs_cb(). */
+typedef struct nfs_req nfs_req_t;
+struct nfs_req {
+    /* Batch the request is counted in, or NULL to wait on it alone. */
+    nfs_batch_t *batch;
+    volatile bool done;
+    /* Result of the request, negative on failure. */
+    int status;
+    /* The handle returned when opening a file. */
+    struct nfsfh *file;
+    /* Takes the data returned by a successful request other than an open, e.g.
+     * to copy read data to buf. The data is only valid for the duration of the
+     * call. */
+    void (*copy)(nfs_req_t *req, const void *data, size_t len);
+    void *buf;
+    size_t offset;
+};
+
+/* Completion callback of NFS requests, given their nfs_req_t as private data. */
+void network_nfs_cb(int status, struct nfs_context *nfs, void *data, void *private_data);
+
+/**
+ * Wait for a single NFS request that is not in a batch.
+ *
+ * @param err  result of queueing the request.
+ * @return the status of the request, or -1 if it could not be queued.
+ */
+int network_nfs_wait(nfs_req_t *req, int err);
+
+/* Wait for all the requests queued in a batch. */
+void network_batch_wait(nfs_batch_t *batch);
+
+/**
+ * @return the NFS context, once the NFS directory is mounted, or NULL if the
+ *         network has not been initialised.
+ */
+struct nfs_context *network_nfs(void);
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "objpool.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <utils/util.h>
+#include <sos/gen_config.h>
+
+#include "utils.h"
+
+/* An object ready to be handed out. */
+typedef struct {
+    seL4_CPtr cap;
+    ut_t *ut;
+} pooled_t;
+
+typedef struct {
+    seL4_Word type;
+    size_t size_bits;
+    size_t size;
+    pooled_t *objects;
+    size_t n_objects;
+    size_t hits;
+    size_t misses;
+    size_t recycled;
+} pool_t;
+
+static pool_t pools[OBJPOOL_TYPES] = {
+    [OBJPOOL_TCB] = { seL4_TCBObject, seL4_TCBBits, CONFIG_SOS_POOL_TCBS },
+    [OBJPOOL_SCHED_CONTEXT] = { seL4_SchedContextObject, seL4_MinSchedContextBits, CONFIG_SOS_POOL_SCHED_CONTEXTS },
+    [OBJPOOL_VSPACE] = { seL4_ARM_PageGlobalDirectoryObject, seL4_PGDBits, CONFIG_SOS_POOL_VSPACES },
+    [OBJPOOL_PAGE] = { seL4_ARM_SmallPageObject, seL4_PageBits, CONFIG_SOS_POOL_PAGES },
+    [OBJPOOL_ENDPOINT] = { seL4_EndpointObject, seL4_EndpointBits, CONFIG_SOS_POOL_ENDPOINTS },
+    [OBJPOOL_NOTIFICATION] = { seL4_NotificationObject, seL4_NotificationBits, CONFIG_SOS_POOL_NOTIFICATIONS },
+    [OBJPOOL_REPLY] = { seL4_ReplyObject, seL4_ReplyBits, CONFIG_SOS_POOL_REPLIES },
+};
+
+/* The last refill ran out of memory, so refills wait for an object to be freed. */
+static bool refill_failed;
+
+void objpool_init(void)
+{
+    for (size_t i = 0; i < OBJPOOL_TYPES; i++) {
+        pools[i].objects = malloc(pools[i].size * sizeof(pooled_t));
+        ZF_LOGF_IF(pools[i].objects == NULL && pools[i].size > 0, "Failed to allocate object pool");
+    }
+    objpool_refill();
+}
+
+ut_t *objpool_alloc(objpool_type_t type, seL4_CPtr *cptr)
+{
+    pool_t *pool = &pools[type];
+    if (pool->n_objects == 0) {
+        pool->misses += 1;
+        return alloc_retype(cptr, pool->type, pool->size_bits);
+    }
+
+    pool->hits += 1;
+    pooled_t *object = &pool->objects[--pool->n_objects];
+    *cptr = object->cap;
+    return object->ut;
+}
+
+/* Destroy an object and hand its memory and cslot back. */
+static void destroy(seL4_CPtr cptr, ut_t *ut)
+{
+    cspace_delete(&cspace, cptr);
+    cspace_free_slot(&cspace, cptr);
+    ut_free(ut);
+}
+
+void objpool_free(objpool_type_t type, seL4_CPtr cptr, ut_t *ut)
+{
+    if (ut == NULL) {
+        return;
+    }
+    refill_failed = false;
+
+    pool_t *pool = &pools[type];
+    if (pool->n_objects == pool->size) {
+        destroy(cptr, ut);
+        return;
+    }
+
+    /* The untyped has no other children once the object is deleted, so it can be retyped again */
+    cspace_delete(&cspace, cptr);
+    seL4_Error err = cspace_untyped_retype(&cspace, ut->cap, cptr, pool->type, pool->size_bits);
+    if (err != seL4_NoError) {
+        ZF_LOGE("Failed to recycle object: %d", err);
+        cspace_free_slot(&cspace, cptr);
+        ut_free(ut);
+        return;
+    }
+    pool->objects[pool->n_objects++] = (pooled_t) { .cap = cptr, .ut = ut };
+    pool->recycled += 1;
+}
+
+bool objpool_needs_refill(void)
+{
+    if (refill_failed) {
+        return false;
+    }
+    for (size_t i = 0; i < OBJPOOL_TYPES; i++) {
+        if (pools[i].n_objects <= pools[i].size / 2 && pools[i].n_objects < pools[i].size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void objpool_refill(void)
+{
+    for (size_t i = 0; i < OBJPOOL_TYPES; i++) {
+        pool_t *pool = &pools[i];
+        while (pool->n_objects < pool->size) {
+            pooled_t *object = &pool->objects[pool->n_objects];
+            object->ut = alloc_retype(&object->cap, pool->type, pool->size_bits);
+            if (object->ut == NULL) {
+                /* Out of memory, leave the pool short */
+                refill_failed = true;
+                return;
+            }
+            pool->n_objects += 1;
+        }
+    }
+}
+
+void objpool_drain(void)
+{
+    for (size_t i = 0; i < OBJPOOL_TYPES; i++) {
+        pool_t *pool = &pools[i];
+        while (pool->n_objects > 0) {
+            pooled_t *object = &pool->objects[--pool->n_objects];
+            destroy(object->cap, object->ut);
+        }
+    }
+}
+
+void objpool_stats(objpool_type_t type, objpool_stats_t *stats)
+{
+    pool_t *pool = &pools[type];
+    *stats = (objpool_stats_t) {
+        .objects = pool->n_objects,
+        .size = pool->size,
+        .hits = pool->hits,
+        .misses = pool->misses,
+        .recycled = pool->recycled,
+    };
+}
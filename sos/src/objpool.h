@@ -0,0 +1,81 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sel4/sel4.h>
+
+#include "ut.h"
+
+/*
+ * Pools of kernel objects retyped ahead of time, so that creating a process
+ * or thread takes objects that already exist rather than allocating an
+ * untyped and a cslot and retyping each one.
+ *
+ * The pools are filled in batches by objpool_refill(), off the critical path
+ * of syscalls. A freed object goes back to its pool if there is room: its
+ * cap is deleted, destroying the object, and the same untyped is retyped
+ * into the same cslot, so the pool gets a fresh object without going back
+ * to the allocators. The size of each pool is a config option.
+ */
+
+typedef enum {
+    OBJPOOL_TCB,
+    OBJPOOL_SCHED_CONTEXT,
+    OBJPOOL_VSPACE,
+    /* 4K frames, e.g. for IPC buffers */
+    OBJPOOL_PAGE,
+    OBJPOOL_ENDPOINT,
+    OBJPOOL_NOTIFICATION,
+    OBJPOOL_REPLY,
+    OBJPOOL_TYPES
+} objpool_type_t;
+
+/* Counters describing a pool. */
+typedef struct {
+    /* Objects in the pool, and the most it holds. */
+    size_t objects;
+    size_t size;
+    /* Allocations taken from the pool, and made directly as it was empty. */
+    size_t hits;
+    size_t misses;
+    /* Freed objects retyped back into the pool. */
+    size_t recycled;
+} objpool_stats_t;
+
+/* Fill the pools, once the untyped allocator and SOS cspace are set up. */
+void objpool_init(void);
+
+/*
+ * Allocate an object, in the manner of alloc_retype().
+ *
+ * @param cptr[out]  set to the cap of the object in the SOS cspace.
+ * @return the untyped the object was retyped from, or NULL if out of memory.
+ */
+ut_t *objpool_alloc(objpool_type_t type, seL4_CPtr *cptr);
+
+/* Free an object allocated with objpool_alloc(). Does nothing if ut is NULL. */
+void objpool_free(objpool_type_t type, seL4_CPtr cptr, ut_t *ut);
+
+/* Whether any pool has fallen to half its size. False after a refill runs out
+ * of memory, until an object is freed. */
+bool objpool_needs_refill(void);
+
+/* Fill all pools back up. */
+void objpool_refill(void);
+
+/* Return the objects of all pools to the untyped allocator. */
+void objpool_drain(void);
+
+/* Get the current counters of a pool. */
+void objpool_stats(objpool_type_t type, objpool_stats_t *stats);
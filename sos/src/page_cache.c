@@ -0,0 +1,193 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "page_cache.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <utils/util.h>
+#include <sos/gen_config.h>
+
+#define N_BUCKETS 256
+
+typedef struct cache_entry cache_entry_t;
+struct cache_entry {
+    /* NULL while the entry is free. */
+    const void *file;
+    uintptr_t offset;
+    frame_ref_t frame;
+    page_cache_write_t write;
+    bool dirty;
+    /* Next entry in the same bucket, or on the free list. */
+    cache_entry_t *next;
+};
+
+static struct {
+    cache_entry_t *buckets[N_BUCKETS];
+    cache_entry_t entries[CONFIG_SOS_PAGE_CACHE_PAGES];
+    /* Entries are used in order until the cache first fills. */
+    size_t n_used;
+    /* Entries freed since, when the pages of a file were removed. */
+    cache_entry_t *free;
+    size_t n_free;
+    /* Next entry considered for dropping once the cache is full. */
+    size_t hand;
+    size_t hits;
+    size_t misses;
+    size_t drops;
+    size_t writebacks;
+} cache;
+
+static cache_entry_t **bucket(const void *file, uintptr_t offset)
+{
+    uintptr_t hash = (uintptr_t) file ^ (offset >> seL4_PageBits);
+    hash ^= hash >> 16;
+    return &cache.buckets[hash % N_BUCKETS];
+}
+
+static cache_entry_t *find(const void *file, uintptr_t offset)
+{
+    for (cache_entry_t *entry = *bucket(file, offset); entry != NULL; entry = entry->next) {
+        if (entry->file == file && entry->offset == offset) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Write a dirty page back, keeping it dirty while it is mapped. */
+static int writeback(cache_entry_t *entry)
+{
+    if (!entry->dirty) {
+        return 0;
+    }
+    if (entry->write(entry->file, entry->offset, entry->frame) != 0) {
+        return -1;
+    }
+    entry->dirty = frame_ref_count(entry->frame) > 1;
+    cache.writebacks += 1;
+    return 0;
+}
+
+/* Take an entry out of its bucket and drop its page. */
+static void unlink_entry(cache_entry_t *entry)
+{
+    cache_entry_t **prev = bucket(entry->file, entry->offset);
+    while (*prev != entry) {
+        prev = &(*prev)->next;
+    }
+    *prev = entry->next;
+    frame_ref_put(entry->frame);
+    entry->file = NULL;
+}
+
+/* Drop a page only the cache holds a reference to, freeing its entry. */
+static cache_entry_t *drop_unused(void)
+{
+    for (size_t i = 0; i < cache.n_used; i++) {
+        cache_entry_t *entry = &cache.entries[cache.hand];
+        cache.hand = (cache.hand + 1) % cache.n_used;
+        if (entry->file == NULL || frame_ref_count(entry->frame) > 1 || writeback(entry) != 0) {
+            continue;
+        }
+
+        unlink_entry(entry);
+        cache.drops += 1;
+        return entry;
+    }
+    return NULL;
+}
+
+frame_ref_t page_cache_lookup(const void *file, uintptr_t offset)
+{
+    cache_entry_t *entry = find(file, offset);
+    if (entry != NULL) {
+        cache.hits += 1;
+        return entry->frame;
+    }
+    cache.misses += 1;
+    return NULL_FRAME;
+}
+
+int page_cache_insert(const void *file, uintptr_t offset, frame_ref_t frame, page_cache_write_t write)
+{
+    cache_entry_t *entry;
+    if (cache.free != NULL) {
+        entry = cache.free;
+        cache.free = entry->next;
+        cache.n_free--;
+    } else if (cache.n_used < ARRAY_SIZE(cache.entries)) {
+        entry = &cache.entries[cache.n_used++];
+    } else {
+        entry = drop_unused();
+        if (entry == NULL) {
+            return -1;
+        }
+    }
+
+    cache_entry_t **head = bucket(file, offset);
+    *entry = (cache_entry_t) {
+        .file = file,
+        .offset = offset,
+        .frame = frame_ref_get(frame),
+        .write = write,
+        .next = *head,
+    };
+    *head = entry;
+    return 0;
+}
+
+void page_cache_set_dirty(const void *file, uintptr_t offset)
+{
+    cache_entry_t *entry = find(file, offset);
+    assert(entry != NULL && entry->write != NULL);
+    entry->dirty = true;
+}
+
+int page_cache_flush(const void *file, uintptr_t start, uintptr_t end)
+{
+    int err = 0;
+    for (size_t i = 0; i < cache.n_used; i++) {
+        cache_entry_t *entry = &cache.entries[i];
+        if (entry->file == file && entry->offset >= start && entry->offset < end && writeback(entry) != 0) {
+            err = -1;
+        }
+    }
+    return err;
+}
+
+void page_cache_remove(const void *file)
+{
+    for (size_t i = 0; i < cache.n_used; i++) {
+        cache_entry_t *entry = &cache.entries[i];
+        if (entry->file != file) {
+            continue;
+        }
+        if (writeback(entry) != 0) {
+            ZF_LOGE("Lost a dirty page at %p of a file", (void *) entry->offset);
+        }
+        unlink_entry(entry);
+        entry->next = cache.free;
+        cache.free = entry;
+        cache.n_free++;
+    }
+}
+
+void page_cache_stats(page_cache_stats_t *stats)
+{
+    *stats = (page_cache_stats_t) {
+        .pages = cache.n_used - cache.n_free,
+        .hits = cache.hits,
+        .misses = cache.misses,
+        .drops = cache.drops,
+        .writebacks = cache.writebacks,
+    };
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame_table.h"
+
+/*
+ * The page cache holds frames loaded from pages of files, so that every
+ * address space mapping the same page of the same file shares a frame.
+ *
+ * A page is identified by the file it was loaded from and its offset. The
+ * cache holds a reference to each of its frames, and holds at most
+ * CONFIG_SOS_PAGE_CACHE_PAGES of them. When it is full, a page no longer
+ * mapped anywhere else is dropped to make room, being written back to its
+ * file first if it is dirty.
+ */
+
+/*
+ * Write a page back to the file it was loaded from.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+typedef int (*page_cache_write_t)(const void *file, uintptr_t offset, frame_ref_t frame);
+
+/* Counters describing the page cache. */
+typedef struct {
+    /* Pages currently in the cache. */
+    size_t pages;
+    /* Lookups that found the page. */
+    size_t hits;
+    /* Lookups that did not. */
+    size_t misses;
+    /* Pages dropped to make room for others. */
+    size_t drops;
+    /* Dirty pages written back to their files. */
+    size_t writebacks;
+} page_cache_stats_t;
+
+/*
+ * Find a page in the cache.
+ *
+ * @param file    identifies the file the page is from.
+ * @param offset  of the page in the file.
+ * @return the frame holding the page, or NULL_FRAME if it is not cached. No
+ *         reference is taken on the frame.
+ */
+frame_ref_t page_cache_lookup(const void *file, uintptr_t offset);
+
+/*
+ * Add a page to the cache, which takes its own reference to the frame.
+ *
+ * @param write  writes the page back once it is dirtied, NULL if it never is.
+ * @return 0 on success, -1 if the cache is full of pages still in use.
+ */
+int page_cache_insert(const void *file, uintptr_t offset, frame_ref_t frame, page_cache_write_t write);
+
+/* Record that a cached page has been written to, so must be written back. */
+void page_cache_set_dirty(const void *file, uintptr_t offset);
+
+/*
+ * Write back the dirty pages of a file with offsets from start up to end.
+ *
+ * A page stays dirty while it is mapped by anyone, as it may be written to
+ * again without the cache knowing.
+ *
+ * @return 0 on success, -1 if any page could not be written.
+ */
+int page_cache_flush(const void *file, uintptr_t start, uintptr_t end);
+
+/*
+ * Write back and drop every page of a file, which is no longer mapped
+ * anywhere. The cache does not refer to the file again.
+ */
+void page_cache_remove(const void *file);
+
+/* Get the current page cache counters. */
+void page_cache_stats(page_cache_stats_t *stats);
@@ -0,0 +1,558 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "pager.h"
+#include "mapping.h"
+#include "swap.h"
+#include "zswap.h"
+
+#include <assert.h>
+#include <string.h>
+#include <utils/util.h>
+#include <aos/sel4_zf_logif.h>
+#include <sos/gen_config.h>
+
+/* Number of pages mapped with a single map_frames_range() call. */
+#define PAGER_MAP_BATCH 32
+
+static struct {
+    /* Set while a page is being written out, so that the swap path can
+     * never recurse into eviction. */
+    bool evicting;
+    size_t pageouts;
+    size_t pageins;
+    size_t second_chances;
+    size_t soft_faults;
+    size_t cow_copies;
+    size_t pageout_clusters;
+    size_t pagein_clusters;
+    size_t prefetches;
+} pager;
+
+/* Record a frame as the page at vaddr, with a copy of the frame cap for the
+ * user mapping. The page is not mapped yet. */
+static pte_t *record_page(cspace_t *cspace, page_table_t *pt, uintptr_t vaddr, frame_ref_t frame, bool writable)
+{
+    pte_t *pte = page_table_lookup_alloc(pt, vaddr);
+    if (pte == NULL) {
+        return NULL;
+    }
+
+    if (pte->valid) {
+        ZF_LOGE("Page at %p is already mapped", (void *) vaddr);
+        return NULL;
+    }
+
+    seL4_CPtr cap = cspace_alloc_slot(cspace);
+    if (cap == seL4_CapNull) {
+        ZF_LOGE("Failed to alloc slot for page");
+        return NULL;
+    }
+
+    seL4_Error err = cspace_copy(cspace, cap, frame_table_cspace(), frame_page(frame), seL4_AllRights);
+    if (err != seL4_NoError) {
+        cspace_free_slot(cspace, cap);
+        ZF_LOGE("Failed to copy page cap");
+        return NULL;
+    }
+
+    *pte = (pte_t) {
+        .cap = cap,
+        .frame = frame,
+        .valid = 1,
+        .writable = writable,
+    };
+    return pte;
+}
+
+/* Map a resident page into its address space, copying the frame cap if
+ * the page has no cap of its own yet. */
+static int map_pte(cspace_t *cspace, page_table_t *pt, pte_t *pte, seL4_CPtr vspace, uintptr_t vaddr)
+{
+    assert(pte->valid && !pte->swapped);
+
+    bool new_cap = pte->cap == seL4_CapNull;
+    if (new_cap) {
+        seL4_CPtr cap = cspace_alloc_slot(cspace);
+        if (cap == seL4_CapNull) {
+            ZF_LOGE("Failed to alloc slot for page");
+            return -1;
+        }
+
+        seL4_Error err = cspace_copy(cspace, cap, frame_table_cspace(), frame_page(pte->frame), seL4_AllRights);
+        if (err != seL4_NoError) {
+            cspace_free_slot(cspace, cap);
+            ZF_LOGE("Failed to copy page cap");
+            return -1;
+        }
+        pte->cap = cap;
+    }
+
+    seL4_CapRights_t rights = seL4_CapRights_new(false, false, true, pte->writable);
+    seL4_Error err = map_user_frame(cspace, pte->cap, vspace, ROUND_DOWN(vaddr, PAGE_SIZE_4K), rights,
+                                    seL4_ARM_Default_VMAttributes, &pt->structures);
+    if (err != seL4_NoError) {
+        ZF_LOGE("Failed to map page at %p, error %u", (void *) vaddr, err);
+        if (new_cap) {
+            cspace_delete(cspace, pte->cap);
+            cspace_free_slot(cspace, pte->cap);
+            pte->cap = seL4_CapNull;
+        }
+        return -1;
+    }
+
+    pte->referenced = 1;
+    return 0;
+}
+
+size_t pager_map_pages(cspace_t *cspace, page_table_t *pt, seL4_CPtr vspace, uintptr_t vaddr,
+                       frame_ref_t *frames, size_t n, bool writable)
+{
+    seL4_CapRights_t rights = seL4_CapRights_new(false, false, true, writable);
+    size_t done = 0;
+    while (done < n) {
+        size_t batch = MIN(n - done, PAGER_MAP_BATCH);
+        uintptr_t batch_vaddr = vaddr + done * PAGE_SIZE_4K;
+        seL4_CPtr caps[PAGER_MAP_BATCH];
+        pte_t *ptes[PAGER_MAP_BATCH];
+
+        /* Record the pages, each with its own copy of the frame cap. */
+        size_t i;
+        for (i = 0; i < batch; i++) {
+            ptes[i] = record_page(cspace, pt, batch_vaddr + i * PAGE_SIZE_4K, frames[done + i], writable);
+            if (ptes[i] == NULL) {
+                break;
+            }
+            caps[i] = ptes[i]->cap;
+        }
+
+        int err = -1;
+        if (i == batch) {
+            err = map_frames_range(cspace, caps, batch, vspace, batch_vaddr, rights,
+                                   seL4_ARM_Default_VMAttributes, &pt->structures);
+        }
+
+        if (err != 0) {
+            /* Forget this batch, earlier batches stay mapped. */
+            while (i-- > 0) {
+                cspace_delete(cspace, ptes[i]->cap);
+                cspace_free_slot(cspace, ptes[i]->cap);
+                *ptes[i] = (pte_t) {};
+            }
+            break;
+        }
+
+        for (i = 0; i < batch; i++) {
+            ptes[i]->referenced = 1;
+            frame_set_pageable(frames[done + i], pte_to_handle(ptes[i]));
+        }
+        done += batch;
+    }
+    return done;
+}
+
+int pager_map_shared(cspace_t *cspace, page_table_t *pt, seL4_CPtr vspace, uintptr_t vaddr, frame_ref_t frame,
+                     bool writable)
+{
+    pte_t *pte = record_page(cspace, pt, vaddr, frame, writable);
+    if (pte == NULL) {
+        return -1;
+    }
+
+    pte->shared = 1;
+    if (map_pte(cspace, pt, pte, vspace, vaddr) != 0) {
+        cspace_delete(cspace, pte->cap);
+        cspace_free_slot(cspace, pte->cap);
+        *pte = (pte_t) {};
+        return -1;
+    }
+    return 0;
+}
+
+int pager_make_writable(cspace_t *cspace, page_table_t *pt, seL4_CPtr vspace, uintptr_t vaddr)
+{
+    pte_t *pte = page_table_lookup(pt, vaddr);
+    if (pte == NULL || !pte->valid || pte->swapped) {
+        return -1;
+    }
+
+    if (pte->referenced) {
+        /* Unmap the page to map it again with write access */
+        seL4_Error err = seL4_ARM_Page_Unmap(pte->cap);
+        ZF_LOGF_IFERR(err, "Failed to unmap page");
+        pte->referenced = 0;
+    }
+    pte->writable = 1;
+    return map_pte(cspace, pt, pte, vspace, vaddr);
+}
+
+/*
+ * Find the run of entries around pte, in its last level table, that match it,
+ * of no more than CONFIG_SOS_SWAP_CLUSTER entries. The run grows over the
+ * pages after pte first, as those are the ones sequential access reaches next.
+ *
+ * @param match  whether the entry offset entries from pte belongs to the run.
+ * @param n      set to the number of entries in the run.
+ * @return the first entry of the run.
+ */
+static pte_t *find_cluster(pte_t *pte, bool (*match)(pte_t *pte, pte_t *base, ssize_t offset), size_t *n)
+{
+    pte_t *leaf = pte - pte_index(pte);
+    pte_t *first = pte;
+    pte_t *last = pte;
+    while (last + 1 < leaf + PT_ENTRIES && (size_t) (last - first) + 1 < CONFIG_SOS_SWAP_CLUSTER
+           && match(last + 1, pte, last + 1 - pte)) {
+        last++;
+    }
+    while (first > leaf && (size_t) (last - first) + 1 < CONFIG_SOS_SWAP_CLUSTER
+           && match(first - 1, pte, first - 1 - pte)) {
+        first--;
+    }
+    *n = last - first + 1;
+    return first;
+}
+
+/* A page that can be written out along with a victim of the clock. */
+static bool evictable(pte_t *pte, UNUSED pte_t *base, UNUSED ssize_t offset)
+{
+    return pte->valid && !pte->swapped && !pte->referenced && !pte->shared && frame_evictable(pte->frame)
+           && frame_owner(pte->frame) == pte_to_handle(pte);
+}
+
+/* A page held in swap next to the page being read in. */
+static bool swapped_neighbour(pte_t *pte, pte_t *base, ssize_t offset)
+{
+    return pte->valid && pte->swapped && !pte->compressed && (ssize_t) pte->frame == (ssize_t) base->frame + offset;
+}
+
+frame_ref_t pager_page_in(pte_t *pte)
+{
+    assert(pte->valid);
+    if (!pte->swapped) {
+        return pte->frame;
+    }
+
+    /* This may evict other pages, but never this one as it has no frame. */
+    frame_ref_t frame = alloc_frame();
+    if (frame == NULL_FRAME) {
+        ZF_LOGE("Out of memory paging in");
+        return NULL_FRAME;
+    }
+
+    if (pte->compressed) {
+        if (zswap_load(pte->frame, frame_data(frame)) != 0) {
+            free_frame(frame);
+            return NULL_FRAME;
+        }
+        flush_frame(frame);
+        pte->frame = frame;
+        pte->swapped = 0;
+        pte->compressed = 0;
+        pager.pageins += 1;
+        frame_set_pageable(frame, pte_to_handle(pte));
+        return frame;
+    }
+
+    /* Read in the neighbours of the page that were written out with it, but
+     * only into free frames, as evicting pages to make room for ones that may
+     * never be used would defeat the point. */
+    size_t n;
+    pte_t *first = find_cluster(pte, swapped_neighbour, &n);
+    size_t pos = pte - first;
+    frame_ref_t frames[CONFIG_SOS_SWAP_CLUSTER];
+    frames[pos] = frame;
+    pager.evicting = true;
+    for (size_t i = pos + 1; i < n; i++) {
+        frames[i] = alloc_frame();
+        if (frames[i] == NULL_FRAME) {
+            n = i;
+            break;
+        }
+    }
+    size_t start = pos;
+    while (start > 0) {
+        frames[start - 1] = alloc_frame();
+        if (frames[start - 1] == NULL_FRAME) {
+            break;
+        }
+        start--;
+    }
+    pager.evicting = false;
+
+    unsigned char *pages[CONFIG_SOS_SWAP_CLUSTER];
+    for (size_t i = start; i < n; i++) {
+        pages[i] = frame_data(frames[i]);
+    }
+    if (swap_in(first[start].frame, &pages[start], n - start) != 0) {
+        for (size_t i = start; i < n; i++) {
+            free_frame(frames[i]);
+        }
+        return NULL_FRAME;
+    }
+
+    /* Pages read in ahead stay unmapped and unreferenced, so the clock takes
+     * them back first if they go unused. */
+    for (size_t i = start; i < n; i++) {
+        /* The page may hold code, so make it visible to instruction fetch. */
+        flush_frame(frames[i]);
+        first[i].frame = frames[i];
+        first[i].swapped = 0;
+        frame_set_pageable(frames[i], pte_to_handle(&first[i]));
+    }
+    pager.pageins += n - start;
+    pager.pagein_clusters += 1;
+    pager.prefetches += n - start - 1;
+    return frame;
+}
+
+int pager_share_page(pte_t *src, page_table_t *dst_pt, uintptr_t vaddr)
+{
+    /* Allocating the table may page src out, so do it first */
+    pte_t *dst = page_table_lookup_alloc(dst_pt, vaddr);
+    if (dst == NULL) {
+        return -1;
+    }
+    if (dst->valid) {
+        ZF_LOGE("Page at %p is already mapped", (void *) vaddr);
+        return -1;
+    }
+    if (pager_page_in(src) == NULL_FRAME) {
+        return -1;
+    }
+
+    if (!src->shared) {
+        if (src->writable) {
+            /* Unmap the page so the next access maps it read only */
+            if (src->referenced) {
+                seL4_Error err = seL4_ARM_Page_Unmap(src->cap);
+                ZF_LOGF_IFERR(err, "Failed to unmap page");
+                src->referenced = 0;
+            }
+            src->writable = 0;
+            src->cow = 1;
+        }
+        src->shared = 1;
+        frame_set_unpageable(src->frame);
+    }
+
+    /* The mapping is made on the first fault, with a cap of its own */
+    *dst = (pte_t) {
+        .frame = frame_ref_get(src->frame),
+        .valid = 1,
+        .shared = 1,
+        .cow = src->cow,
+    };
+    return 0;
+}
+
+int pager_make_private(cspace_t *cspace, pte_t *pte)
+{
+    assert(pte->valid && pte->cow && pte->shared && !pte->swapped);
+
+    if (frame_ref_count(pte->frame) > 1) {
+        /* The frame is still shared, so copy it */
+        frame_ref_t copy = alloc_frame();
+        if (copy == NULL_FRAME) {
+            ZF_LOGE("Out of memory copying page");
+            return -1;
+        }
+        memcpy(frame_data(copy), frame_data(pte->frame), PAGE_SIZE_4K);
+        flush_frame(copy);
+
+        if (pte->cap != seL4_CapNull) {
+            cspace_delete(cspace, pte->cap);
+            cspace_free_slot(cspace, pte->cap);
+            pte->cap = seL4_CapNull;
+        }
+        frame_ref_put(pte->frame);
+        pte->frame = copy;
+        pager.cow_copies += 1;
+    } else if (pte->referenced) {
+        /* Everyone else has their own copy already, so take this one over,
+         * unmapping it to be mapped again with write access. */
+        seL4_Error err = seL4_ARM_Page_Unmap(pte->cap);
+        ZF_LOGF_IFERR(err, "Failed to unmap page");
+    }
+
+    pte->shared = 0;
+    pte->cow = 0;
+    pte->writable = 1;
+    pte->referenced = 0;
+    frame_set_pageable(pte->frame, pte_to_handle(pte));
+    return 0;
+}
+
+int pager_cow_fault(cspace_t *cspace, page_table_t *pt, seL4_CPtr vspace, uintptr_t vaddr)
+{
+    pte_t *pte = page_table_lookup(pt, vaddr);
+    if (pte == NULL || !pte->valid || !pte->cow) {
+        return -1;
+    }
+
+    if (pager_make_private(cspace, pte) != 0) {
+        return -1;
+    }
+    return map_pte(cspace, pt, pte, vspace, vaddr);
+}
+
+void pager_release_page(pte_t *pte)
+{
+    assert(pte->valid);
+    if (pte->swapped && pte->compressed) {
+        zswap_free(pte->frame);
+    } else if (pte->swapped) {
+        swap_free(pte->frame);
+    } else {
+        if (pte->cap != seL4_CapNull) {
+            /* Deleting the cap also removes the mapping. */
+            cspace_t *cspace = frame_table_cspace();
+            cspace_delete(cspace, pte->cap);
+            cspace_free_slot(cspace, pte->cap);
+        }
+        frame_ref_put(pte->frame);
+    }
+    *pte = (pte_t) {};
+}
+
+int pager_handle_fault(cspace_t *cspace, page_table_t *pt, seL4_CPtr vspace, uintptr_t vaddr)
+{
+    pte_t *pte = page_table_lookup(pt, vaddr);
+    if (pte == NULL || !pte->valid) {
+        return -1;
+    }
+
+    if (pte->referenced) {
+        /* The page is mapped, so this is a genuine access violation. */
+        return -1;
+    }
+
+    if (!pte->swapped) {
+        pager.soft_faults += 1;
+    } else if (pager_page_in(pte) == NULL_FRAME) {
+        return -1;
+    }
+
+    return map_pte(cspace, pt, pte, vspace, vaddr);
+}
+
+/*
+ * Record that a page has been written out, and drop its frame.
+ *
+ * @param where  swap slot or compressed store entry holding the page.
+ * @return whether the frame was returned to the frame table.
+ */
+static bool swapped_out(pte_t *pte, size_t where, bool compressed)
+{
+    frame_ref_t frame = pte->frame;
+    if (pte->cap != seL4_CapNull) {
+        cspace_t *cspace = frame_table_cspace();
+        cspace_delete(cspace, pte->cap);
+        cspace_free_slot(cspace, pte->cap);
+        pte->cap = seL4_CapNull;
+    }
+    pte->frame = where;
+    pte->swapped = 1;
+    pte->compressed = compressed;
+
+    bool freed = frame_ref_count(frame) == 1;
+    frame_ref_put(frame);
+    return freed;
+}
+
+int pager_evict(void)
+{
+    if (pager.evicting) {
+        return -1;
+    }
+    pager.evicting = true;
+
+    int result = -1;
+    frame_ref_t frame;
+    /* Every pass over a referenced page clears its bit, so this finds a
+     * victim within two turns of the clock. */
+    while ((frame = frame_clock_next()) != NULL_FRAME) {
+        pte_t *pte = pte_from_handle(frame_owner(frame));
+        assert(pte->valid && !pte->swapped && pte->frame == frame);
+
+        if (pte->referenced) {
+            /* Second chance: unmap the page so the next access is seen. */
+            seL4_Error err = seL4_ARM_Page_Unmap(pte->cap);
+            ZF_LOGF_IFERR(err, "Failed to unmap page");
+            pte->referenced = 0;
+            pager.second_chances += 1;
+            continue;
+        }
+
+        /* Evict the cold pages around the victim with it. Those that
+         * compress well stay in memory, the rest go to swap together. */
+        size_t n;
+        pte_t *first = find_cluster(pte, evictable, &n);
+        size_t freed = 0;
+        size_t stored = 0;
+        pte_t *rest[CONFIG_SOS_SWAP_CLUSTER];
+        size_t n_rest = 0;
+        for (size_t i = 0; i < n; i++) {
+            ssize_t entry = zswap_store(first[i].frame);
+            if (entry < 0) {
+                rest[n_rest++] = &first[i];
+            } else {
+                freed += swapped_out(&first[i], entry, true);
+                stored++;
+            }
+        }
+
+        ssize_t slot = -1;
+        if (n_rest > 0) {
+            unsigned char *pages[CONFIG_SOS_SWAP_CLUSTER];
+            for (size_t i = 0; i < n_rest; i++) {
+                pages[i] = frame_data(rest[i]->frame);
+            }
+            slot = swap_out(pages, n_rest);
+            if (slot < 0 && n_rest > 1) {
+                /* Swap may have no run of free slots long enough, so try a
+                 * page alone. */
+                n_rest = 1;
+                slot = swap_out(pages, n_rest);
+            }
+            for (size_t i = 0; slot >= 0 && i < n_rest; i++) {
+                freed += swapped_out(rest[i], slot + i, false);
+            }
+        }
+        pager.pageouts += stored + (slot < 0 ? 0 : n_rest);
+        pager.pageout_clusters += 1;
+
+        if (freed > 0) {
+            result = 0;
+            break;
+        }
+        if (slot < 0 && n_rest > 0) {
+            break;
+        }
+        /* The compressed store kept the frame to hold the page itself. */
+    }
+
+    pager.evicting = false;
+    return result;
+}
+
+void pager_stats(pager_stats_t *stats)
+{
+    *stats = (pager_stats_t) {
+        .pageouts = pager.pageouts,
+        .pageins = pager.pageins,
+        .second_chances = pager.second_chances,
+        .soft_faults = pager.soft_faults,
+        .cow_copies = pager.cow_copies,
+        .pageout_clusters = pager.pageout_clusters,
+        .pagein_clusters = pager.pagein_clusters,
+        .prefetches = pager.prefetches,
+    };
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <cspace/cspace.h>
+
+#include "frame_table.h"
+#include "pagetable.h"
+
+/*
+ * The pager moves user pages between frames and the swap file.
+ *
+ * Victims are chosen with the second-chance (clock) algorithm. A page
+ * is mapped into its address space only while its referenced bit is
+ * set: when the clock hand passes a referenced page the page is
+ * unmapped and the bit cleared, so the next access faults and sets it
+ * again. A page the hand finds unreferenced is written to swap.
+ *
+ * Evicted pages that compress well are kept in the compressed store, and
+ * the rest are written to the swap file. Pages move to and from the swap
+ * file in clusters. The unreferenced pages next to a
+ * victim, in the same last level table, are written out with it, and the
+ * neighbours written out with a page are read back in with it, as long as
+ * there are free frames for them.
+ */
+
+/* Counters describing the activity of the pager. */
+typedef struct {
+    /* Pages written out to swap. */
+    size_t pageouts;
+    /* Pages read back in from swap. */
+    size_t pageins;
+    /* Referenced pages passed over by the clock hand. */
+    size_t second_chances;
+    /* Faults resolved by remapping a page that was still resident. */
+    size_t soft_faults;
+    /* Copy on write pages copied on a write fault. */
+    size_t cow_copies;
+    /* Clusters of pages evicted together, and read back in from swap together. */
+    size_t pageout_clusters;
+    size_t pagein_clusters;
+    /* Pages read in from swap along with a faulting neighbour. */
+    size_t prefetches;
+} pager_stats_t;
+
+/*
+ * Map frames into a user address space as pageable pages.
+ *
+ * The references held on the frames pass to the page table, and the
+ * frames may be evicted as soon as this returns.
+ *
+ * @param cspace    of SOS, to allocate slots for the mappings
+ * @param pt        page table of the address space
+ * @param vspace    address space to map the frames into
+ * @param vaddr     address to map the first frame at, following frames
+ *                  are mapped at the following pages
+ * @param frames    frames to map
+ * @param n         number of frames
+ * @param writable  whether the user may write to the pages
+ * @return the number of frames mapped, which is less than n on failure.
+ *         The references to any frames not mapped are still held by the
+ *         caller.
+ */
+size_t pager_map_pages(cspace_t *cspace, page_table_t *pt, seL4_CPtr vspace, uintptr_t vaddr,
+                       frame_ref_t *frames, size_t n, bool writable);
+
+/*
+ * Map a frame shared with other address spaces into a user address space.
+ * The frame is not paged out while it is shared.
+ *
+ * The reference held on the frame passes to the page table on success.
+ *
+ * @param writable  map the page writable rather than read only.
+ * @return 0 on success, -1 on failure.
+ */
+int pager_map_shared(cspace_t *cspace, page_table_t *pt, seL4_CPtr vspace, uintptr_t vaddr, frame_ref_t frame,
+                     bool writable);
+
+/*
+ * Map a read only page writable, in place, e.g. once a write to a shared
+ * file page has been recorded.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int pager_make_writable(cspace_t *cspace, page_table_t *pt, seL4_CPtr vspace, uintptr_t vaddr);
+
+/*
+ * Share a page with another address space, copy on write if the page is
+ * writable. The page is read back in from swap first if need be, and is not
+ * paged out again while it is shared.
+ *
+ * @param src     the page to share, which loses write access if it has it.
+ * @param dst_pt  page table to add the page to, unmapped.
+ * @param vaddr   address of the page in dst_pt.
+ * @return 0 on success, -1 on failure.
+ */
+int pager_share_page(pte_t *src, page_table_t *dst_pt, uintptr_t vaddr);
+
+/*
+ * Give a copy on write page a frame of its own, unless no other address space
+ * still shares the frame, and make it writable. The page is left unmapped.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int pager_make_private(cspace_t *cspace, pte_t *pte);
+
+/*
+ * Resolve a write fault on a copy on write page, making it private with
+ * pager_make_private() and mapping it writable.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int pager_cow_fault(cspace_t *cspace, page_table_t *pt, seL4_CPtr vspace, uintptr_t vaddr);
+
+/*
+ * Ensure the contents of a page are resident in a frame.
+ *
+ * The page is not mapped back into its address space; that happens on
+ * the next fault. Neighbours of the page swapped out with it are read in
+ * too, if there are free frames for them.
+ *
+ * @return the frame backing the page, or NULL_FRAME if it could not be
+ *         read back from swap.
+ */
+frame_ref_t pager_page_in(pte_t *pte);
+
+/*
+ * Release whatever backs a page: its frame, or its slot in swap. The user
+ * mapping of the page is removed and the entry cleared.
+ */
+void pager_release_page(pte_t *pte);
+
+/*
+ * Resolve a fault on a page managed by the pager, reading it in from
+ * swap if required.
+ *
+ * @return 0 if the page is now mapped and the faulting thread can be
+ *         resumed, -1 if the fault was not caused by paging.
+ */
+int pager_handle_fault(cspace_t *cspace, page_table_t *pt, seL4_CPtr vspace, uintptr_t vaddr);
+
+/*
+ * Write a cluster of pageable frames out to swap and return them to the
+ * frame table.
+ *
+ * Called by the frame table when it can not otherwise satisfy an
+ * allocation.
+ *
+ * @return 0 if a frame was freed, -1 otherwise.
+ */
+int pager_evict(void);
+
+/* Get the current pager counters. */
+void pager_stats(pager_stats_t *stats);
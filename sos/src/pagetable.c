@@ -0,0 +1,166 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "pagetable.h"
+#include "vmem_layout.h"
+
+#include <assert.h>
+
+/* Frames currently holding levels of page tables. */
+static size_t n_table_frames;
+
+/* Index into the table at a particular level (0 being the top level). */
+static inline size_t pt_index(uintptr_t vaddr, int level)
+{
+    size_t shift = seL4_PageBits + PT_INDEX_BITS * (PT_LEVELS - 1 - level);
+    return (vaddr >> shift) & MASK(PT_INDEX_BITS);
+}
+
+/*
+ * Walk down to the last level of the table.
+ *
+ * @param alloc  allocate missing levels rather than failing.
+ * @return       the frame holding the last level, or NULL_FRAME.
+ */
+static frame_ref_t walk(page_table_t *pt, uintptr_t vaddr, bool alloc)
+{
+    frame_ref_t node = pt->root;
+    for (int level = 0; level < PT_LEVELS - 1 && node != NULL_FRAME; level++) {
+        frame_ref_t *entries = (frame_ref_t *) frame_data(node);
+        size_t index = pt_index(vaddr, level);
+        if (entries[index] == NULL_FRAME && alloc) {
+            /* The allocation may page out user memory, but never the
+             * table itself, so entries remains valid. */
+            entries[index] = alloc_zeroed_frame();
+            if (entries[index] != NULL_FRAME) {
+                n_table_frames++;
+            }
+        }
+        node = entries[index];
+    }
+    return node;
+}
+
+int page_table_init(page_table_t *pt)
+{
+    *pt = (page_table_t) {};
+    pt->root = alloc_zeroed_frame();
+    if (pt->root == NULL_FRAME) {
+        ZF_LOGE("Failed to allocate page table root");
+        return -1;
+    }
+    n_table_frames++;
+    return 0;
+}
+
+pte_t *page_table_lookup(page_table_t *pt, uintptr_t vaddr)
+{
+    frame_ref_t node = walk(pt, vaddr, false);
+    if (node == NULL_FRAME) {
+        return NULL;
+    }
+    return (pte_t *) frame_data(node) + pt_index(vaddr, PT_LEVELS - 1);
+}
+
+pte_t *page_table_lookup_alloc(page_table_t *pt, uintptr_t vaddr)
+{
+    frame_ref_t node = walk(pt, vaddr, true);
+    if (node == NULL_FRAME) {
+        ZF_LOGE("Failed to allocate page table for %p", (void *) vaddr);
+        return NULL;
+    }
+    return (pte_t *) frame_data(node) + pt_index(vaddr, PT_LEVELS - 1);
+}
+
+/* Free a level of the table and every level below it. */
+static void destroy_node(frame_ref_t node, int level, void (*release)(pte_t *pte))
+{
+    if (level == PT_LEVELS - 1) {
+        pte_t *ptes = (pte_t *) frame_data(node);
+        for (size_t i = 0; i < PT_ENTRIES; i++) {
+            if (ptes[i].valid) {
+                release(&ptes[i]);
+            }
+        }
+    } else {
+        frame_ref_t *entries = (frame_ref_t *) frame_data(node);
+        for (size_t i = 0; i < PT_ENTRIES; i++) {
+            if (entries[i] != NULL_FRAME) {
+                destroy_node(entries[i], level + 1, release);
+            }
+        }
+    }
+    free_frame(node);
+    n_table_frames--;
+}
+
+void page_table_destroy(page_table_t *pt, void (*release)(pte_t *pte))
+{
+    if (pt->root != NULL_FRAME) {
+        destroy_node(pt->root, 0, release);
+        pt->root = NULL_FRAME;
+    }
+    paging_structures_free(frame_table_cspace(), &pt->structures);
+}
+
+/* Visit the valid entries of a level of the table covering addresses from base. */
+static int walk_node(frame_ref_t node, int level, uintptr_t base,
+                     int (*visit)(pte_t *pte, uintptr_t vaddr, void *arg), void *arg)
+{
+    size_t shift = seL4_PageBits + PT_INDEX_BITS * (PT_LEVELS - 1 - level);
+    for (size_t i = 0; i < PT_ENTRIES; i++) {
+        uintptr_t vaddr = base + (i << shift);
+        int err = 0;
+        if (level == PT_LEVELS - 1) {
+            pte_t *pte = (pte_t *) frame_data(node) + i;
+            if (pte->valid) {
+                err = visit(pte, vaddr, arg);
+            }
+        } else {
+            frame_ref_t child = ((frame_ref_t *) frame_data(node))[i];
+            if (child != NULL_FRAME) {
+                err = walk_node(child, level + 1, vaddr, visit, arg);
+            }
+        }
+        if (err != 0) {
+            return err;
+        }
+    }
+    return 0;
+}
+
+int page_table_walk(page_table_t *pt, int (*visit)(pte_t *pte, uintptr_t vaddr, void *arg), void *arg)
+{
+    if (pt->root == NULL_FRAME) {
+        return 0;
+    }
+    return walk_node(pt->root, 0, 0, visit, arg);
+}
+
+size_t page_table_frames(void)
+{
+    return n_table_frames;
+}
+
+/* Entries live in the frame table data region, so their offset into that
+ * region identifies them in far fewer bits than a pointer. */
+uint32_t pte_to_handle(pte_t *pte)
+{
+    uintptr_t offset = (uintptr_t) pte - SOS_FRAME_DATA;
+    assert((uintptr_t) pte >= SOS_FRAME_DATA);
+    assert(offset / sizeof(pte_t) <= UINT32_MAX);
+    return offset / sizeof(pte_t);
+}
+
+pte_t *pte_from_handle(uint32_t handle)
+{
+    return (pte_t *) SOS_FRAME_DATA + handle;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <utils/util.h>
+#include <sel4/sel4.h>
+
+#include "bootstrap.h"
+#include "frame_table.h"
+#include "mapping.h"
+
+/*
+ * SOS keeps its own record of the pages of each user address space, as
+ * seL4 paging structures can not be read back. The table mirrors the
+ * 4-level hardware layout, with every level stored in a frame from the
+ * frame table.
+ */
+#define PT_LEVELS      4
+#define PT_INDEX_BITS  (seL4_PageBits - 3)
+#define PT_ENTRIES     BIT(PT_INDEX_BITS)
+
+/* A page of a user address space. */
+typedef struct pte pte_t;
+PACKED struct pte {
+    /* Copy of the frame capability mapped into the user address space. */
+    seL4_ARM_Page cap : 20;
+    /* Frame backing the page when resident, swap slot or compressed store
+     * entry when swapped out. */
+    size_t frame : 19;
+    /* The page has been allocated backing memory. */
+    size_t valid : 1;
+    /* The contents of the page are in swap rather than in a frame. */
+    size_t swapped : 1;
+    /* The page is mapped and may have been accessed since the pager last
+     * looked at it. */
+    size_t referenced : 1;
+    /* The page may be written by the user. */
+    size_t writable : 1;
+    /* The frame is shared with other address spaces, and is never paged out. */
+    size_t shared : 1;
+    /* The page is copied to a frame of its own when the user writes to it. */
+    size_t cow : 1;
+    /* The page is shared with other address spaces by sos_share_vm(). */
+    size_t share : 1;
+    /* This address space lets the others sharing the page write to it. */
+    size_t share_writable : 1;
+    /* This address space may write to the shared page, if the others let it. */
+    size_t share_may_write : 1;
+    /* The swapped out page is in the compressed store rather than the swap file. */
+    size_t compressed : 1;
+    /* Unused bits */
+    size_t unused : 15;
+};
+compile_time_assert("pte fits in a word", sizeof(pte_t) == sizeof(seL4_Word));
+compile_time_assert("Small CPtr size", 20 >= INITIAL_TASK_CSPACE_BITS);
+
+/* The shadow page table of a user address space. */
+typedef struct {
+    /* Frame holding the top level of the table. */
+    frame_ref_t root;
+    /* seL4 paging structures allocated to map the pages into a vspace. */
+    paging_structures_t structures;
+} page_table_t;
+
+/*
+ * Initialise an empty page table.
+ *
+ * @return 0 on success, -1 if no frame could be allocated for the table.
+ */
+int page_table_init(page_table_t *pt);
+
+/*
+ * Look up the entry for a virtual address.
+ *
+ * @return the entry, or NULL if no table exists for the address yet.
+ */
+pte_t *page_table_lookup(page_table_t *pt, uintptr_t vaddr);
+
+/*
+ * Look up the entry for a virtual address, allocating any missing levels
+ * of the table.
+ *
+ * @return the entry, or NULL if the table could not be extended.
+ */
+pte_t *page_table_lookup_alloc(page_table_t *pt, uintptr_t vaddr);
+
+/*
+ * Destroy a page table, returning all of its frames to the frame table, and
+ * freeing the seL4 paging structures its pages were mapped with.
+ *
+ * @param release  called on every valid entry before the table is freed,
+ *                 to release whatever backs the page.
+ */
+void page_table_destroy(page_table_t *pt, void (*release)(pte_t *pte));
+
+/*
+ * Visit every valid entry of a page table, in address order.
+ *
+ * @param visit  called with each entry and its address, stopping the walk
+ *               if it returns non-zero.
+ * @return the value returned by the last visit, 0 if all succeeded.
+ */
+int page_table_walk(page_table_t *pt, int (*visit)(pte_t *pte, uintptr_t vaddr, void *arg), void *arg);
+
+/* The number of frames holding page tables, across all page tables. */
+size_t page_table_frames(void);
+
+/*
+ * Convert an entry into a compact handle, which remains valid for as
+ * long as the page table exists.
+ */
+uint32_t pte_to_handle(pte_t *pte);
+
+/* Convert a handle from pte_to_handle() back into the entry. */
+pte_t *pte_from_handle(uint32_t handle);
+
+/*
+ * Get the index of an entry in the last level of its table. The entries of
+ * a last level table map consecutive pages, so pte - pte_index(pte) is the
+ * entry for the first page it maps.
+ */
+static inline size_t pte_index(pte_t *pte)
+{
+    return ((uintptr_t) pte % BIT(seL4_PageBits)) / sizeof(pte_t);
+}
@@ -0,0 +1,490 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "process.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <utils/util.h>
+#include <aos/debug.h>
+#include <clock/timestamp.h>
+#include <sel4runtime.h>
+#include <sel4runtime/auxv.h>
+#include <sos/gen_config.h>
+
+#include "asid.h"
+#include "elfload.h"
+#include "frame_table.h"
+#include "mapping.h"
+#include "objpool.h"
+#include "pager.h"
+#include "template.h"
+#include "utils.h"
+#include "vmem_layout.h"
+
+#define PROCESS_PRIORITY (0)
+
+static process_t processes[MAX_PROCESSES];
+/* Slots of the process table not in use, the next to be used last. */
+static int free_slots[MAX_PROCESSES];
+static int n_free_slots;
+/* The pid the next process in each slot will get. */
+static int next_pid[MAX_PROCESSES];
+
+static seL4_CPtr ipc_ep;
+static seL4_CPtr sched_ctrl_start;
+static uint64_t timer_freq;
+
+void init_processes(seL4_CPtr ep, seL4_CPtr sched_ctrl)
+{
+    ipc_ep = ep;
+    sched_ctrl_start = sched_ctrl;
+    timer_freq = timestamp_get_freq();
+
+    for (int slot = 0; slot < MAX_PROCESSES; slot++) {
+        free_slots[MAX_PROCESSES - 1 - slot] = slot;
+        next_pid[slot] = slot + 1;
+    }
+    n_free_slots = MAX_PROCESSES;
+}
+
+process_t *process_from_badge(seL4_Word badge)
+{
+    if (badge < PROCESS_BADGE_BASE || badge >= PROCESS_BADGE(MAX_PROCESSES)) {
+        return NULL;
+    }
+    process_t *proc = &processes[badge - PROCESS_BADGE_BASE];
+    return proc->active ? proc : NULL;
+}
+
+size_t process_status(sos_process_t *status, size_t max)
+{
+    size_t n = 0;
+    for (int slot = 0; slot < MAX_PROCESSES && n < max; slot++) {
+        process_t *proc = &processes[slot];
+        if (!proc->active) {
+            continue;
+        }
+        status[n] = (sos_process_t) {
+            .pid = proc->pid,
+            .size = as_pages(&proc->as),
+            .stime = proc->start_ms,
+        };
+        strncpy(status[n].command, proc->name, N_NAME - 1);
+        n++;
+    }
+    return n;
+}
+
+/* Take a free slot of the process table, and a pid for the process in it. */
+static process_t *alloc_slot(const char *name)
+{
+    if (n_free_slots == 0) {
+        ZF_LOGE("Too many processes");
+        return NULL;
+    }
+    int slot = free_slots[--n_free_slots];
+
+    /* Pids of a slot go up in steps of the table size, so a pid is not reused until the
+     * slot has been, MAX_PROCESSES times over. */
+    int pid = next_pid[slot];
+    next_pid[slot] = pid <= INT_MAX - MAX_PROCESSES ? pid + MAX_PROCESSES : slot + 1;
+
+    process_t *proc = &processes[slot];
+    *proc = (process_t) {
+        .pid = pid,
+        .slot = slot,
+        .name = name,
+        .start_ms = timestamp_ms(timer_freq),
+        .asid_pool = -1,
+    };
+    return proc;
+}
+
+static int stack_write(seL4_Word *mapped_stack, int index, uintptr_t val)
+{
+    mapped_stack[index] = val;
+    return index - 1;
+}
+
+/* set up System V ABI compliant stack, so that the process can
+ * start up and initialise the C library */
+static uintptr_t init_process_stack(process_t *proc, uintptr_t sysinfo)
+{
+    /* Create a stack frame */
+    frame_ref_t stack = alloc_zeroed_frame();
+    if (stack == NULL_FRAME) {
+        ZF_LOGE("Failed to allocate stack");
+        return 0;
+    }
+
+    /* virtual addresses in the target process' address space */
+    uintptr_t stack_top = PROCESS_STACK_TOP;
+    /* the frame is already mapped into the SOS's address space by the frame table */
+    void *local_stack_top = frame_data(stack) + PAGE_SIZE_4K;
+
+    int index = -2;
+
+    /* null terminate the aux vectors */
+    index = stack_write(local_stack_top, index, 0);
+    index = stack_write(local_stack_top, index, 0);
+
+    /* write the aux vectors */
+    index = stack_write(local_stack_top, index, PAGE_SIZE_4K);
+    index = stack_write(local_stack_top, index, AT_PAGESZ);
+
+    index = stack_write(local_stack_top, index, sysinfo);
+    index = stack_write(local_stack_top, index, AT_SYSINFO);
+
+    index = stack_write(local_stack_top, index, PROCESS_IPC_BUFFER);
+    index = stack_write(local_stack_top, index, AT_SEL4_IPC_BUFFER_PTR);
+
+    /* null terminate the environment pointers */
+    index = stack_write(local_stack_top, index, 0);
+
+    /* we don't have any env pointers - skip */
+
+    /* null terminate the argument pointers */
+    index = stack_write(local_stack_top, index, 0);
+
+    /* no argpointers - skip */
+
+    /* set argc to 0 */
+    stack_write(local_stack_top, index, 0);
+
+    /* adjust the initial stack top */
+    stack_top += (index * sizeof(seL4_Word));
+
+    /* the stack *must* remain aligned to a double word boundary,
+     * as GCC assumes this, and horrible bugs occur if this is wrong */
+    assert(index % 2 == 0);
+    assert(stack_top % (sizeof(seL4_Word) * 2) == 0);
+
+    /* Map in the initial stack frame for the user app, the rest of the stack
+     * is allocated as the app faults on it */
+    if (as_define_stack(&proc->as, PROCESS_STACK_TOP, CONFIG_SOS_STACK_LIMIT) == NULL) {
+        free_frame(stack);
+        ZF_LOGE("Unable to define stack region for user app");
+        return 0;
+    }
+    if (pager_map_pages(&cspace, &proc->as.page_table, proc->as.vspace,
+                        PROCESS_STACK_TOP - PAGE_SIZE_4K, &stack, 1, true) != 1) {
+        free_frame(stack);
+        ZF_LOGE("Unable to map stack for user app");
+        return 0;
+    }
+
+    return stack_top;
+}
+
+static void read_done(file_waiter_t *waiter, ssize_t result)
+{
+    process_t *proc = (process_t *) ((char *) waiter - offsetof(process_t, read.waiter));
+    as_unpin(proc->read.frames, proc->read.pages);
+
+    /* Input can arrive while SOS waits on the network for another syscall, whose
+     * reply must not be clobbered */
+    seL4_Word mr0 = seL4_GetMR(0);
+    seL4_SetMR(0, result);
+    seL4_Send(proc->read.reply, seL4_MessageInfo_new(0, 0, 0, 1));
+    seL4_SetMR(0, mr0);
+
+    objpool_free(OBJPOOL_REPLY, proc->read.reply, proc->read.reply_ut);
+    proc->read.file = NULL;
+}
+
+void process_read_later(process_t *proc, file_t *file, const struct iovec *iov,
+                        const frame_ref_t *frames, size_t pages, seL4_CPtr reply, ut_t *reply_ut)
+{
+    assert(proc->read.file == NULL && pages <= IO_BATCH_PAGES);
+    memcpy(proc->read.iov, iov, pages * sizeof(*iov));
+    memcpy(proc->read.frames, frames, pages * sizeof(*frames));
+    proc->read.pages = pages;
+    proc->read.reply = reply;
+    proc->read.reply_ut = reply_ut;
+    proc->read.file = file;
+    proc->read.waiter = (file_waiter_t) {
+        .iov = proc->read.iov,
+        .iovcnt = pages,
+        .done = read_done,
+    };
+    file_wait(file, &proc->read.waiter);
+}
+
+void process_destroy(process_t *proc)
+{
+    /* Stop the thread before taking its memory away */
+    objpool_free(OBJPOOL_TCB, proc->tcb, proc->tcb_ut);
+    objpool_free(OBJPOOL_SCHED_CONTEXT, proc->sched_context, proc->sched_context_ut);
+    if (proc->fault_ep != seL4_CapNull) {
+        cspace_delete(&cspace, proc->fault_ep);
+        cspace_free_slot(&cspace, proc->fault_ep);
+    }
+    if (proc->read.file != NULL) {
+        file_cancel(proc->read.file, &proc->read.waiter);
+        as_unpin(proc->read.frames, proc->read.pages);
+        objpool_free(OBJPOOL_REPLY, proc->read.reply, proc->read.reply_ut);
+    }
+
+    fdtable_close_all(&proc->fds);
+    /* This frees the paging structures as well as the pages */
+    as_destroy(&proc->as);
+    objpool_free(OBJPOOL_PAGE, proc->ipc_buffer, proc->ipc_buffer_ut);
+    if (proc->cspace.bootstrap != NULL) {
+        cspace_destroy(&proc->cspace);
+    }
+    objpool_free(OBJPOOL_VSPACE, proc->vspace, proc->vspace_ut);
+    /* Deleting the vspace gave its ASID back to the pool */
+    if (proc->asid_pool >= 0) {
+        asid_release(proc->asid_pool);
+    }
+
+    /* Pids start at 1, so a slot that was never taken has none */
+    if (proc->pid != 0) {
+        free_slots[n_free_slots++] = proc->slot;
+    }
+    *proc = (process_t) {};
+}
+
+/* Create the kernel objects of a new process in a free slot of the process table,
+ * ready to be given an address space and started. */
+static process_t *create_process(const char *name)
+{
+    process_t *proc = alloc_slot(name);
+    if (proc == NULL) {
+        return NULL;
+    }
+    seL4_Word badge = PROCESS_BADGE(proc->slot);
+
+    /* Create a VSpace */
+    proc->vspace_ut = objpool_alloc(OBJPOOL_VSPACE, &proc->vspace);
+    if (proc->vspace_ut == NULL) {
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* assign the vspace to an asid pool */
+    proc->asid_pool = asid_assign(proc->vspace);
+    if (proc->asid_pool < 0) {
+        ZF_LOGE("Failed to assign asid pool");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* Create the address space recording the memory of the process */
+    if (as_init(&proc->as, proc->vspace) != 0) {
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* Create a simple 1 level CSpace */
+    seL4_Word err = cspace_create_one_level(&cspace, &proc->cspace);
+    if (err != CSPACE_NOERROR) {
+        ZF_LOGE("Failed to create cspace");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* Create an IPC buffer */
+    proc->ipc_buffer_ut = objpool_alloc(OBJPOOL_PAGE, &proc->ipc_buffer);
+    if (proc->ipc_buffer_ut == NULL) {
+        ZF_LOGE("Failed to alloc ipc buffer ut");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* allocate a new slot in the target cspace which we will mint a badged endpoint cap into --
+     * the badge is used to identify the process */
+    seL4_CPtr user_ep = cspace_alloc_slot(&proc->cspace);
+    if (user_ep == seL4_CapNull) {
+        ZF_LOGE("Failed to alloc user ep slot");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* now mutate the cap, thereby setting the badge */
+    err = cspace_mint(&proc->cspace, user_ep, &cspace, ipc_ep, seL4_AllRights, badge);
+    if (err) {
+        ZF_LOGE("Failed to mint user ep");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* and the same for faults, which are delivered through a cap in our own cspace */
+    proc->fault_ep = cspace_alloc_slot(&cspace);
+    if (proc->fault_ep == seL4_CapNull) {
+        ZF_LOGE("Failed to alloc fault ep slot");
+        process_destroy(proc);
+        return NULL;
+    }
+    err = cspace_mint(&cspace, proc->fault_ep, &cspace, ipc_ep, seL4_AllRights, badge);
+    if (err) {
+        ZF_LOGE("Failed to mint fault ep");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* Create a new TCB object */
+    proc->tcb_ut = objpool_alloc(OBJPOOL_TCB, &proc->tcb);
+    if (proc->tcb_ut == NULL) {
+        ZF_LOGE("Failed to alloc tcb ut");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* Configure the TCB */
+    err = seL4_TCB_Configure(proc->tcb, proc->cspace.root_cnode, seL4_NilData, proc->vspace, seL4_NilData,
+                             PROCESS_IPC_BUFFER, proc->ipc_buffer);
+    if (err != seL4_NoError) {
+        ZF_LOGE("Unable to configure new TCB");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* Create scheduling context */
+    proc->sched_context_ut = objpool_alloc(OBJPOOL_SCHED_CONTEXT, &proc->sched_context);
+    if (proc->sched_context_ut == NULL) {
+        ZF_LOGE("Failed to alloc sched context ut");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* Configure the scheduling context to use the first core with budget equal to period */
+    err = seL4_SchedControl_Configure(sched_ctrl_start, proc->sched_context, US_IN_MS, US_IN_MS, 0, 0);
+    if (err != seL4_NoError) {
+        ZF_LOGE("Unable to configure scheduling context");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* bind sched context, set fault endpoint and priority
+     * In MCS, fault end point needed here should be in current thread's cspace. */
+    err = seL4_TCB_SetSchedParams(proc->tcb, seL4_CapInitThreadTCB, seL4_MinPrio, PROCESS_PRIORITY,
+                                  proc->sched_context, proc->fault_ep);
+    if (err != seL4_NoError) {
+        ZF_LOGE("Unable to set scheduling params");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* Provide a name for the thread -- Helpful for debugging */
+    NAME_THREAD(proc->tcb, name);
+
+    proc->active = true;
+    return proc;
+}
+
+/* Map in the IPC buffer for the thread */
+static bool map_ipc_buffer(process_t *proc)
+{
+    if (as_define_region(&proc->as, PROCESS_IPC_BUFFER, PAGE_SIZE_4K, REGION_READ | REGION_WRITE,
+                         REGION_FIXED) == NULL) {
+        ZF_LOGE("Unable to define IPC buffer region for user app");
+        return false;
+    }
+    seL4_Error err = map_user_frame(&cspace, proc->ipc_buffer, proc->vspace, PROCESS_IPC_BUFFER, seL4_AllRights,
+                                    seL4_ARM_Default_VMAttributes, &proc->as.page_table.structures);
+    if (err != 0) {
+        ZF_LOGE("Unable to map IPC buffer for user app");
+        return false;
+    }
+    return true;
+}
+
+process_t *process_start(const char *app_name)
+{
+    /* find the app in the cpio image, which is only parsed the first time */
+    ZF_LOGI("\nStarting \"%s\"...\n", app_name);
+    const process_template_t *tmpl = template_get(app_name);
+    if (tmpl == NULL) {
+        return NULL;
+    }
+
+    process_t *proc = create_process(app_name);
+    if (proc == NULL) {
+        return NULL;
+    }
+
+    /* set up the stack */
+    seL4_Word sp = init_process_stack(proc, tmpl->sysinfo);
+    if (sp == 0) {
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* load the elf image from the cpio file */
+    int err = elf_load(&cspace, &proc->as, tmpl->segments, tmpl->n_segments);
+    if (err) {
+        ZF_LOGE("Failed to load elf image");
+        process_destroy(proc);
+        return NULL;
+    }
+
+    if (!map_ipc_buffer(proc)) {
+        process_destroy(proc);
+        return NULL;
+    }
+
+    /* Start the new process */
+    seL4_UserContext context = {
+        .pc = tmpl->entry,
+        .sp = sp,
+    };
+    printf("Starting %s at %p\n", app_name, (void *) context.pc);
+    err = seL4_TCB_WriteRegisters(proc->tcb, 1, 0, 2, &context);
+    if (err != seL4_NoError) {
+        ZF_LOGE("Failed to write registers");
+        process_destroy(proc);
+        return NULL;
+    }
+    return proc;
+}
+
+process_t *process_fork(process_t *parent)
+{
+    process_t *child = create_process(parent->name);
+    if (child == NULL) {
+        return NULL;
+    }
+
+    if (as_clone(&child->as, &parent->as) != 0 || !map_ipc_buffer(child)) {
+        ZF_LOGE("Failed to copy address space of %d", parent->pid);
+        process_destroy(child);
+        return NULL;
+    }
+    fdtable_copy(&child->fds, &parent->fds);
+
+    /* The parent is blocked in seL4_Call, its pc at the svc instruction so that the
+     * call can be restarted. The child resumes after it, as if the call had
+     * returned a message of one word, which is 0. */
+    seL4_UserContext context;
+    size_t n_regs = sizeof(context) / sizeof(seL4_Word);
+    seL4_Error err = seL4_TCB_ReadRegisters(parent->tcb, false, 0, n_regs, &context);
+    if (err != seL4_NoError) {
+        ZF_LOGE("Failed to read registers");
+        process_destroy(child);
+        return NULL;
+    }
+    context.pc += sizeof(uint32_t);
+    context.x1 = seL4_MessageInfo_new(0, 0, 0, 1).words[0];
+    context.x2 = 0;
+
+    err = seL4_TCB_WriteRegisters(child->tcb, true, 0, n_regs, &context);
+    if (err != seL4_NoError) {
+        ZF_LOGE("Failed to write registers");
+        process_destroy(child);
+        return NULL;
+    }
+    return child;
+}
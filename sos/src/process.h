@@ -0,0 +1,126 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <sel4/sel4.h>
+#include <cspace/cspace.h>
+#include <sos_protocol.h>
+
+#include "ut.h"
+#include "addrspace.h"
+#include "file.h"
+
+/* The most processes that can exist at once. */
+#define MAX_PROCESSES 32
+
+/* Badge of the endpoint caps of the process in a slot of the process table. Syscalls
+ * and faults of the process arrive with this badge, so finding the process that sent
+ * them is a single array index. */
+#define PROCESS_BADGE_BASE   (100)
+#define PROCESS_BADGE(slot)  (PROCESS_BADGE_BASE + (slot))
+
+/* Most pages of a user buffer pinned at once while reading or writing it. */
+#define IO_BATCH_PAGES       64
+
+/* A user process, with a single thread. */
+typedef struct {
+    /* The slot of the process table is in use. */
+    bool active;
+    /* Unique among the processes that exist, and not soon reused once the process is gone. */
+    int pid;
+    /* The slot of the process table, which its badge encodes. */
+    int slot;
+    const char *name;
+    /* When the process was created, in milliseconds since boot. */
+    unsigned start_ms;
+
+    ut_t *tcb_ut;
+    seL4_CPtr tcb;
+    ut_t *vspace_ut;
+    seL4_CPtr vspace;
+    /* The ASID pool the vspace was assigned to, -1 if none. */
+    int asid_pool;
+
+    ut_t *ipc_buffer_ut;
+    seL4_CPtr ipc_buffer;
+
+    ut_t *sched_context_ut;
+    seL4_CPtr sched_context;
+
+    /* Badged copy of the SOS endpoint in the SOS cspace, which faults are delivered on. */
+    seL4_CPtr fault_ep;
+
+    cspace_t cspace;
+
+    addrspace_t as;
+    fdtable_t fds;
+
+    /* A read waiting for input, which is replied to once it completes. */
+    struct {
+        file_waiter_t waiter;
+        /* The file being read, NULL if no read is waiting. */
+        file_t *file;
+        ut_t *reply_ut;
+        seL4_CPtr reply;
+        /* The pinned pages of the buffer being read into. */
+        struct iovec iov[IO_BATCH_PAGES];
+        frame_ref_t frames[IO_BATCH_PAGES];
+        size_t pages;
+    } read;
+} process_t;
+
+/* Set up process creation, with the endpoint processes talk to SOS on. */
+void init_processes(seL4_CPtr ep, seL4_CPtr sched_ctrl);
+
+/*
+ * Start a process running an app from the cpio archive.
+ *
+ * @return the new process, or NULL on failure.
+ */
+process_t *process_start(const char *app_name);
+
+/*
+ * Create a copy of a process blocked in a syscall. The address space of the
+ * child is a copy on write clone of the parent's, and the child returns from
+ * the syscall with 0 in the first message register. The child shares the open
+ * files of the parent.
+ *
+ * @return the new process, or NULL on failure.
+ */
+process_t *process_fork(process_t *parent);
+
+/*
+ * Tear down a process, returning all of its memory, including its paging
+ * structures and kernel objects, and freeing its slot of the process table.
+ * The process must not be blocked in a syscall that SOS will reply to, other
+ * than a read waiting for input, which is cancelled.
+ */
+void process_destroy(process_t *proc);
+
+/*
+ * Leave a read that found no input to complete when input arrives. The process
+ * stays blocked until then, and is sent the result with the reply object, which
+ * the process now owns. The pages of the buffer stay pinned until the reply.
+ */
+void process_read_later(process_t *proc, file_t *file, const struct iovec *iov,
+                        const frame_ref_t *frames, size_t pages, seL4_CPtr reply, ut_t *reply_ut);
+
+/* Find the process that a badged message came from, NULL if none. */
+process_t *process_from_badge(seL4_Word badge);
+
+/*
+ * Describe the processes that exist, in process table order.
+ *
+ * @return the number of processes described, at most max.
+ */
+size_t process_status(sos_process_t *status, size_t max);
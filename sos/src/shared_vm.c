@@ -0,0 +1,151 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "shared_vm.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <utils/util.h>
+#include <aos/sel4_zf_logif.h>
+
+#define N_BUCKETS 64
+
+/* An entry of an address space sharing a page. */
+typedef struct sharer sharer_t;
+struct sharer {
+    uint32_t pte;
+    sharer_t *next;
+};
+
+typedef struct shared_page shared_page_t;
+struct shared_page {
+    uintptr_t vaddr;
+    frame_ref_t frame;
+    /* Address spaces sharing the page, and how many of them made it writable. */
+    sharer_t *sharers;
+    size_t n_sharers;
+    size_t n_writable;
+    /* Next page in the same bucket. */
+    shared_page_t *next;
+};
+
+static shared_page_t *buckets[N_BUCKETS];
+
+static shared_page_t **bucket(uintptr_t vaddr)
+{
+    return &buckets[(vaddr >> seL4_PageBits) % N_BUCKETS];
+}
+
+static shared_page_t *find(uintptr_t vaddr)
+{
+    shared_page_t *page = *bucket(vaddr);
+    while (page != NULL && page->vaddr != vaddr) {
+        page = page->next;
+    }
+    return page;
+}
+
+/* Give every entry for a page the write access the other sharers allow it. */
+static void update_access(shared_page_t *page)
+{
+    for (sharer_t *sharer = page->sharers; sharer != NULL; sharer = sharer->next) {
+        pte_t *pte = pte_from_handle(sharer->pte);
+        size_t others_writable = page->n_writable - pte->share_writable;
+        bool writable = pte->share_may_write && others_writable == page->n_sharers - 1;
+        if (pte->writable == writable) {
+            continue;
+        }
+
+        /* Unmap the page, so the next access maps it with the new rights */
+        if (pte->referenced) {
+            seL4_Error err = seL4_ARM_Page_Unmap(pte->cap);
+            ZF_LOGF_IFERR(err, "Failed to unmap page");
+            pte->referenced = 0;
+        }
+        pte->writable = writable;
+    }
+}
+
+frame_ref_t shared_vm_frame(uintptr_t vaddr)
+{
+    shared_page_t *page = find(vaddr);
+    return page == NULL ? NULL_FRAME : page->frame;
+}
+
+int shared_vm_join(pte_t *pte, uintptr_t vaddr)
+{
+    assert(pte->valid && pte->share && pte->shared);
+
+    shared_page_t *page = find(vaddr);
+    if (page == NULL) {
+        page = malloc(sizeof(*page));
+        if (page == NULL) {
+            return -1;
+        }
+        shared_page_t **head = bucket(vaddr);
+        *page = (shared_page_t) {
+            .vaddr = vaddr,
+            .frame = pte->frame,
+            .next = *head,
+        };
+        *head = page;
+    }
+    assert(page->frame == pte->frame);
+
+    sharer_t *sharer = malloc(sizeof(*sharer));
+    if (sharer == NULL) {
+        if (page->n_sharers == 0) {
+            *bucket(vaddr) = page->next;
+            free(page);
+        }
+        return -1;
+    }
+    *sharer = (sharer_t) {
+        .pte = pte_to_handle(pte),
+        .next = page->sharers,
+    };
+    page->sharers = sharer;
+    page->n_sharers += 1;
+    page->n_writable += pte->share_writable;
+
+    update_access(page);
+    return 0;
+}
+
+void shared_vm_leave(pte_t *pte, uintptr_t vaddr)
+{
+    shared_page_t *page = find(vaddr);
+    assert(page != NULL && page->frame == pte->frame);
+
+    uint32_t handle = pte_to_handle(pte);
+    sharer_t **prev = &page->sharers;
+    while ((*prev)->pte != handle) {
+        prev = &(*prev)->next;
+    }
+    sharer_t *sharer = *prev;
+    *prev = sharer->next;
+    free(sharer);
+
+    page->n_sharers -= 1;
+    page->n_writable -= pte->share_writable;
+    if (page->n_sharers > 0) {
+        update_access(page);
+        return;
+    }
+
+    shared_page_t **link = bucket(vaddr);
+    while (*link != page) {
+        link = &(*link)->next;
+    }
+    *link = page->next;
+    free(page);
+}
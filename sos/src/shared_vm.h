@@ -0,0 +1,49 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "frame_table.h"
+#include "pagetable.h"
+
+/*
+ * Pages shared between address spaces with sos_share_vm(). A shared page is
+ * identified by its address, which is the same in every address space sharing
+ * it, and is backed by a single frame mapped into all of them.
+ *
+ * An address space may write to a shared page only if every other address space
+ * sharing it has made it shared writable, and its own region is writable.
+ */
+
+/*
+ * Find the frame of a shared page.
+ *
+ * @return the frame, or NULL_FRAME if no address space shares a page at vaddr.
+ */
+frame_ref_t shared_vm_frame(uintptr_t vaddr);
+
+/*
+ * Add a page to the address spaces sharing the page at vaddr, which becomes
+ * shared if it was not already. The entry must have the share bits set, and
+ * hold a reference to the frame of the shared page, if there is one yet.
+ * The write access of every entry for the page is updated to match.
+ *
+ * @return 0 on success, -1 if out of memory.
+ */
+int shared_vm_join(pte_t *pte, uintptr_t vaddr);
+
+/*
+ * Remove a page from the address spaces sharing the page at vaddr. The entry
+ * itself is left to be released by the caller.
+ */
+void shared_vm_leave(pte_t *pte, uintptr_t vaddr);
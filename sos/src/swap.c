@@ -0,0 +1,198 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "swap.h"
+#include "network.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdbool.h>
+#include <utils/util.h>
+#include <cspace/bitfield.h>
+#include <nfsc/libnfs.h>
+#include <sos/gen_config.h>
+
+#define SWAP_PAGE_SIZE  BIT(seL4_PageBits)
+#define SWAP_SLOT_WORDS ((CONFIG_SOS_SWAP_SLOTS + WORD_BITS - 1) / WORD_BITS)
+
+/* Slots are stored in page table entries alongside frame references. */
+compile_time_assert("Swap slots fit in a pte", CONFIG_SOS_SWAP_SLOTS <= BIT(19));
+compile_time_assert("Swap clusters are not empty", CONFIG_SOS_SWAP_CLUSTER > 0);
+
+static struct {
+    /* Handle of the open swap file, NULL until first used. */
+    struct nfsfh *file;
+    /* Bitmap of the slots in use. */
+    unsigned long slots[SWAP_SLOT_WORDS];
+    /* Number of slots in use. */
+    size_t used;
+    size_t writes;
+    size_t reads;
+    size_t write_clusters;
+    size_t read_clusters;
+    /* A cluster of pages gathered together to be written with one request. */
+    unsigned char cluster[CONFIG_SOS_SWAP_CLUSTER * SWAP_PAGE_SIZE];
+} swap;
+
+/* Scatter data read by a request to the pages in its buffer, starting offset
+ * bytes into the first. */
+static void scatter_read(nfs_req_t *req, const void *data, size_t len)
+{
+    unsigned char *const *pages = req->buf;
+    const unsigned char *src = data;
+    for (size_t done = 0; done < len;) {
+        size_t page = (req->offset + done) / SWAP_PAGE_SIZE;
+        size_t offset = (req->offset + done) % SWAP_PAGE_SIZE;
+        size_t n = MIN(SWAP_PAGE_SIZE - offset, len - done);
+        memcpy(pages[page] + offset, src + done, n);
+        done += n;
+    }
+}
+
+static int swap_open(void)
+{
+    struct nfs_context *nfs = network_nfs();
+    if (nfs == NULL) {
+        ZF_LOGE("No NFS to swap to");
+        return -1;
+    }
+
+    nfs_req_t req = {};
+    if (network_nfs_wait(&req, nfs_creat_async(nfs, CONFIG_SOS_SWAP_FILE, 0600, network_nfs_cb, &req)) < 0) {
+        ZF_LOGE("Failed to create swap file");
+        return -1;
+    }
+
+    swap.file = req.file;
+    ZF_LOGI("Swapping to %s", CONFIG_SOS_SWAP_FILE);
+    return 0;
+}
+
+/* Transfer a cluster of pages with a single request, retrying short transfers. */
+static int swap_io(size_t slot, unsigned char *const *pages, size_t n, bool write)
+{
+    struct nfs_context *nfs = network_nfs();
+    size_t len = n * SWAP_PAGE_SIZE;
+    const unsigned char *src = pages[0];
+    if (write && n > 1) {
+        for (size_t i = 0; i < n; i++) {
+            memcpy(swap.cluster + i * SWAP_PAGE_SIZE, pages[i], SWAP_PAGE_SIZE);
+        }
+        src = swap.cluster;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t offset = slot * SWAP_PAGE_SIZE + done;
+        nfs_req_t req = { .copy = write ? NULL : scatter_read, .buf = (void *) pages, .offset = done };
+        int err;
+        if (write) {
+            err = nfs_pwrite_async(nfs, swap.file, offset, len - done, src + done, network_nfs_cb, &req);
+        } else {
+            err = nfs_pread_async(nfs, swap.file, offset, len - done, network_nfs_cb, &req);
+        }
+        int status = network_nfs_wait(&req, err);
+        if (status <= 0) {
+            /* Reading past the end of the file means the slot was never
+             * written, which should not happen. */
+            return -1;
+        }
+        done += status;
+    }
+    return 0;
+}
+
+/* Find the first run of n free slots. @return its first slot, or -1 if there is none. */
+static ssize_t find_slots(size_t n)
+{
+    size_t run = 0;
+    for (size_t slot = bf_first_free(SWAP_SLOT_WORDS, swap.slots); slot < CONFIG_SOS_SWAP_SLOTS; slot++) {
+        if (bf_get_bit(swap.slots, slot)) {
+            run = 0;
+        } else if (++run == n) {
+            return slot + 1 - n;
+        }
+    }
+    return -1;
+}
+
+ssize_t swap_out(unsigned char *const *pages, size_t n)
+{
+    assert(n > 0 && n <= CONFIG_SOS_SWAP_CLUSTER);
+    if (swap.file == NULL && swap_open() != 0) {
+        return -1;
+    }
+
+    ssize_t slot = find_slots(n);
+    if (slot < 0) {
+        ZF_LOGE("Swap file has no room for %zu pages", n);
+        return -1;
+    }
+    if (swap_io(slot, pages, n, true) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        bf_set_bit(swap.slots, slot + i);
+    }
+    swap.used += n;
+    swap.writes += n;
+    swap.write_clusters += 1;
+    return slot;
+}
+
+int swap_in(size_t slot, unsigned char *const *pages, size_t n)
+{
+    assert(n > 0 && n <= CONFIG_SOS_SWAP_CLUSTER);
+    for (size_t i = 0; i < n; i++) {
+        assert(bf_get_bit(swap.slots, slot + i));
+    }
+    if (swap_io(slot, pages, n, false) != 0) {
+        return -1;
+    }
+
+    swap.reads += n;
+    swap.read_clusters += 1;
+    for (size_t i = 0; i < n; i++) {
+        swap_free(slot + i);
+    }
+    return 0;
+}
+
+void swap_free(size_t slot)
+{
+    assert(bf_get_bit(swap.slots, slot));
+    bf_clr_bit(swap.slots, slot);
+    swap.used -= 1;
+}
+
+bool swap_reserve(size_t slot)
+{
+    assert(slot < CONFIG_SOS_SWAP_SLOTS);
+    if (bf_get_bit(swap.slots, slot)) {
+        return false;
+    }
+    bf_set_bit(swap.slots, slot);
+    swap.used += 1;
+    return true;
+}
+
+void swap_stats(swap_stats_t *stats)
+{
+    *stats = (swap_stats_t) {
+        .slots = CONFIG_SOS_SWAP_SLOTS,
+        .used = swap.used,
+        .writes = swap.writes,
+        .reads = swap.reads,
+        .write_clusters = swap.write_clusters,
+        .read_clusters = swap.read_clusters,
+    };
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * The swap file holds pages evicted from memory, one page per slot. It is
+ * created on the NFS export the first time a page is written out.
+ *
+ * Pages are moved in clusters of up to CONFIG_SOS_SWAP_CLUSTER, held in
+ * consecutive slots and transferred with a single NFS request, so that
+ * neighbouring pages cost one round trip to the server rather than one each.
+ */
+
+/* Counters describing the state of the swap file. */
+typedef struct {
+    /* Slots in the swap file. */
+    size_t slots;
+    /* Slots currently holding a page. */
+    size_t used;
+    /* Pages written to the swap file. */
+    size_t writes;
+    /* Pages read from the swap file. */
+    size_t reads;
+    /* Clusters written and read, each with a single request. */
+    size_t write_clusters;
+    size_t read_clusters;
+} swap_stats_t;
+
+/*
+ * Write a cluster of pages to consecutive free slots of the swap file.
+ *
+ * @param pages  the pages to write out, in slot order.
+ * @param n      number of pages, at most CONFIG_SOS_SWAP_CLUSTER.
+ * @return       the slot of the first page, or -1 if swap has no run of n
+ *               free slots or the write failed.
+ */
+ssize_t swap_out(unsigned char *const *pages, size_t n);
+
+/*
+ * Read a cluster of pages back from consecutive slots of the swap file,
+ * releasing the slots.
+ *
+ * @param slot   slot of the first page.
+ * @param pages  where to read the pages to, in slot order.
+ * @param n      number of pages, at most CONFIG_SOS_SWAP_CLUSTER.
+ * @return 0 on success, -1 on failure, in which case the slots are kept.
+ */
+int swap_in(size_t slot, unsigned char *const *pages, size_t n);
+
+/* Release a slot without reading it back. */
+void swap_free(size_t slot);
+
+/*
+ * Take a free slot without writing a page to it, e.g. for the tests to leave
+ * swap without a run of free slots. Release it again with swap_free().
+ *
+ * @return whether the slot was free.
+ */
+bool swap_reserve(size_t slot);
+
+/* Get the current swap counters. */
+void swap_stats(swap_stats_t *stats);
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "template.h"
+
+#include <string.h>
+#include <cpio/cpio.h>
+#include <elf/elf.h>
+#include <utils/util.h>
+
+/* Templates cached, the least recently used of which is replaced by a new one. */
+#define TEMPLATE_CACHE_SIZE 8
+
+/* The linker will link this symbol to the start address  *
+ * of an archive of attached applications.                */
+extern char _cpio_archive[];
+extern char _cpio_archive_end[];
+
+static struct {
+    process_template_t templates[TEMPLATE_CACHE_SIZE];
+    /* When each template was last used, 0 if it is not in use. */
+    uint64_t last_used[TEMPLATE_CACHE_SIZE];
+    uint64_t clock;
+    size_t hits;
+    size_t misses;
+} cache;
+
+/* Fill in a template from the ELF file of an app. @return 0 on success, -1 on failure. */
+static int make_template(const char *name, process_template_t *tmpl)
+{
+    unsigned long elf_size;
+    size_t cpio_len = _cpio_archive_end - _cpio_archive;
+    const char *elf_base = cpio_get_file(_cpio_archive, cpio_len, name, &elf_size);
+    if (elf_base == NULL) {
+        ZF_LOGE("Unable to locate cpio header for %s", name);
+        return -1;
+    }
+    /* Ensure that the file is an elf file. */
+    elf_t elf_file = {};
+    if (elf_newFile(elf_base, elf_size, &elf_file)) {
+        ZF_LOGE("Invalid elf file");
+        return -1;
+    }
+
+    /* find the vsyscall table */
+    uintptr_t *sysinfo = elf_getSectionNamed(&elf_file, "__vsyscall", NULL);
+    if (sysinfo == NULL || *sysinfo == 0) {
+        ZF_LOGE("could not find syscall table for c library");
+        return -1;
+    }
+
+    int n_segments = elf_segments(&elf_file, tmpl->segments, TEMPLATE_MAX_SEGMENTS);
+    if (n_segments < 0) {
+        return -1;
+    }
+
+    strncpy(tmpl->name, name, N_NAME - 1);
+    tmpl->name[N_NAME - 1] = '\0';
+    tmpl->elf_base = elf_base;
+    tmpl->elf_size = elf_size;
+    tmpl->entry = elf_getEntryPoint(&elf_file);
+    tmpl->sysinfo = *sysinfo;
+    tmpl->n_segments = n_segments;
+    return 0;
+}
+
+/* Find the cached template of an app. @return its index, or -1 if it is not cached. */
+static int find_template(const char *name)
+{
+    for (int i = 0; i < TEMPLATE_CACHE_SIZE; i++) {
+        if (cache.last_used[i] != 0 && strncmp(cache.templates[i].name, name, N_NAME) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const process_template_t *template_get(const char *name)
+{
+    /* Names too long to be stored would match the wrong template */
+    if (strlen(name) >= N_NAME) {
+        ZF_LOGE("App name %s is too long", name);
+        return NULL;
+    }
+
+    int i = find_template(name);
+    if (i >= 0) {
+        cache.hits += 1;
+        cache.last_used[i] = ++cache.clock;
+        return &cache.templates[i];
+    }
+
+    cache.misses += 1;
+    process_template_t tmpl;
+    if (make_template(name, &tmpl) != 0) {
+        return NULL;
+    }
+
+    /* Replace an unused template, or failing that the least recently used */
+    int victim = 0;
+    for (i = 1; i < TEMPLATE_CACHE_SIZE; i++) {
+        if (cache.last_used[i] < cache.last_used[victim]) {
+            victim = i;
+        }
+    }
+    cache.templates[victim] = tmpl;
+    cache.last_used[victim] = ++cache.clock;
+    return &cache.templates[victim];
+}
+
+void template_invalidate(const char *name)
+{
+    int i = find_template(name);
+    if (i >= 0) {
+        cache.last_used[i] = 0;
+    }
+}
+
+void template_stats(template_stats_t *stats)
+{
+    *stats = (template_stats_t) {
+        .hits = cache.hits,
+        .misses = cache.misses,
+    };
+    for (int i = 0; i < TEMPLATE_CACHE_SIZE; i++) {
+        stats->templates += cache.last_used[i] != 0;
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sos_protocol.h>
+
+#include "elfload.h"
+
+/*
+ * Process templates hold what starting an app needs from its ELF file in
+ * the cpio archive: where the file is, its entry point, its loadable
+ * segments and the address of its vsyscall table. Finding the file is a
+ * linear scan of the archive and the rest means parsing the ELF headers, so
+ * templates are cached by app name, and an app started repeatedly only
+ * pays for this once.
+ *
+ * A template points into the file it was made from, so it must be
+ * invalidated if the file changes. Nothing in SOS changes the linked in
+ * cpio archive, but any future source of apps has to.
+ */
+
+/* Most loadable segments of an app. */
+#define TEMPLATE_MAX_SEGMENTS 8
+
+typedef struct {
+    char name[N_NAME];
+    /* The ELF file the template was made from. */
+    const char *elf_base;
+    size_t elf_size;
+    uintptr_t entry;
+    /* Address of the vsyscall table, passed to the C library in the aux vectors. */
+    uintptr_t sysinfo;
+    size_t n_segments;
+    elf_segment_t segments[TEMPLATE_MAX_SEGMENTS];
+} process_template_t;
+
+/* Counters describing the template cache. */
+typedef struct {
+    /* Templates cached. */
+    size_t templates;
+    /* Lookups that found a cached template, and that had to make one. */
+    size_t hits;
+    size_t misses;
+} template_stats_t;
+
+/*
+ * Get the template of an app in the cpio archive, making and caching it if it
+ * is not already cached.
+ *
+ * @return the template, valid until it is invalidated or another template is
+ *         made, or NULL if there is no such app or it is not a valid ELF file.
+ */
+const process_template_t *template_get(const char *name);
+
+/* Drop the cached template of an app, if there is one, as its file has changed. */
+void template_invalidate(const char *name);
+
+/* Get the current counters of the template cache. */
+void template_stats(template_stats_t *stats);
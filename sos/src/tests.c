@@ -11,14 +11,48 @@
  */
 #define ZF_LOG_LEVEL ZF_LOG_INFO
 #include <assert.h>
+#include <string.h>
 #include <cspace/cspace.h>
 #include <utils/util.h>
 #include <sel4/sel4.h>
+#include <clock/timestamp.h>
+#include <sos/gen_config.h>
+#include "asid.h"
 #include "dma.h"
+#include "elfload.h"
 #include "bootstrap.h"
 #include "frame_table.h"
+#include "pagetable.h"
+#include "addrspace.h"
+#include "mapping.h"
+#include "objpool.h"
+#include "process.h"
+#include "page_cache.h"
+#include "pager.h"
+#include "swap.h"
+#include "template.h"
+#include "lz.h"
+#include "zswap.h"
+#include "ut.h"
+#include "utils.h"
+#include "vmem_layout.h"
 
 #define TEST_FRAMES 10
+/* Processes started and torn down by the teardown test */
+#define TEARDOWN_CYCLES 32
+/* Processes started to measure spawn latency, each way */
+#define SPAWN_RUNS 8
+#define ZEROED_TEST_FRAMES (CONFIG_SOS_FRAME_ZEROED_POOL + TEST_FRAMES)
+
+/* The large page benchmark scans enough memory to overflow the TLB with 4K pages */
+#define SCAN_LARGE_PAGES 2
+#define SCAN_BYTES       (SCAN_LARGE_PAGES * BIT(seL4_LargePageBits))
+#define SCAN_SMALL_PAGES (SCAN_BYTES / PAGE_SIZE_4K)
+#define SCAN_PASSES      8
+#define SCAN_STRIDE      (64 / sizeof(seL4_Word))
+
+/* PMU event number of level 1 data TLB refills */
+#define PMU_L1D_TLB_REFILL 0x05
 
 static void test_bf_bit(unsigned long bit)
 {
@@ -59,12 +93,17 @@ static void test_cspace(cspace_t *cspace)
     ZF_LOGI("Test cspace");
     /* test we can alloc a cptr */
     ZF_LOGV("Test allocating cslot");
+    size_t used = cspace->n_slots_used;
     seL4_CPtr cptr = cspace_alloc_slot(cspace);
     assert(cptr != 0);
+    assert(cspace->n_slots_used > used);
+    assert(cspace->max_slots_used >= cspace->n_slots_used);
 
     ZF_LOGV("Test freeing cslot");
     /* test we can free the cptr */
+    used = cspace->n_slots_used;
     cspace_free_slot(cspace, cptr);
+    assert(cspace->n_slots_used == used - 1);
 
     ZF_LOGV("Test free slot is returned");
     /* test we get the same cptr back if we alloc again */
@@ -101,6 +140,60 @@ static void test_cspace(cspace_t *cspace)
     free(slots);
 }
 
+static void assert_ut_stats_equal(ut_stats_t *a, ut_stats_t *b)
+{
+    for (size_t i = 0; i < N_UNTYPED_LISTS; i++) {
+        assert(a->free[i] == b->free[i]);
+        assert(a->split[i] == b->split[i]);
+    }
+}
+
+static void test_ut(cspace_t *cspace)
+{
+    ut_stats_t before, stats;
+    ut_stats(&before);
+
+    /* fill a 4K untyped with the smallest objects */
+    ut_t *uts[BIT(seL4_PageBits - seL4_EndpointBits)];
+    for (size_t i = 0; i < ARRAY_SIZE(uts); i++) {
+        uts[i] = ut_alloc(seL4_EndpointBits, cspace);
+        assert(uts[i] != NULL);
+        assert(uts[i]->size_bits == seL4_EndpointBits);
+    }
+    ut_stats(&stats);
+    assert(stats.split[seL4_PageBits - seL4_EndpointBits] > before.split[seL4_PageBits - seL4_EndpointBits]);
+
+    /* handing them all back merges them into what they were split from */
+    for (size_t i = 0; i < ARRAY_SIZE(uts); i++) {
+        ut_free(uts[i]);
+    }
+    ut_stats(&stats);
+    assert_ut_stats_equal(&before, &stats);
+
+    if (before.free[seL4_LargePageBits - seL4_EndpointBits] == 0) {
+        ZF_LOGW("No large untypeds to test allocations above 4K");
+        return;
+    }
+
+    /* objects bigger than 4K come from large untypeds, and can be retyped */
+    for (size_t size_bits = seL4_PageBits + 1; size_bits <= seL4_LargePageBits; size_bits++) {
+        ut_t *ut = ut_alloc(size_bits, cspace);
+        assert(ut != NULL);
+        assert(ut->size_bits == size_bits);
+
+        seL4_CPtr frame = cspace_alloc_slot(cspace);
+        assert(frame != seL4_CapNull);
+        seL4_Error err = cspace_untyped_retype(cspace, ut->cap, frame, seL4_ARM_SmallPageObject, seL4_PageBits);
+        assert(err == seL4_NoError);
+        cspace_delete(cspace, frame);
+        cspace_free_slot(cspace, frame);
+
+        ut_free(ut);
+        ut_stats(&stats);
+        assert_ut_stats_equal(&before, &stats);
+    }
+}
+
 static void test_dma(void)
 {
     dma_addr_t dma = sos_dma_malloc(PAGE_SIZE_4K, PAGE_SIZE_4K);
@@ -112,6 +205,48 @@ static void test_dma(void)
     for (size_t i = 0; i < PAGE_SIZE_4K; i++) {
         assert(blah[i] == 'a' + i % 25);
     }
+    sos_dma_free(dma);
+
+    /* small buffers come from slabs, and never share a cache line */
+    dma_addr_t small[64];
+    for (size_t i = 0; i < ARRAY_SIZE(small); i++) {
+        small[i] = sos_dma_malloc(1 + i * 31, 1);
+        assert(small[i].paddr != 0);
+        assert(IS_ALIGNED(small[i].paddr, 7));
+        assert(sos_dma_virt_to_phys(small[i].vaddr) == small[i].paddr);
+        assert(sos_dma_phys_to_virt(small[i].paddr) == small[i].vaddr);
+        if (i > 0) {
+            assert(small[i].paddr != small[i - 1].paddr);
+        }
+    }
+
+    /* freed memory is reused */
+    dma_addr_t reused = small[0];
+    sos_dma_free(small[0]);
+    small[0] = sos_dma_malloc(1, 1);
+    assert(small[0].paddr == reused.paddr);
+
+    /* large buffers are whole pages, aligned as requested */
+    dma_addr_t large = sos_dma_malloc(3 * PAGE_SIZE_4K + 1, BIT(16));
+    assert(large.paddr != 0);
+    assert(IS_ALIGNED(large.paddr, 16));
+    sos_dma_free(large);
+    dma_addr_t large_again = sos_dma_malloc(3 * PAGE_SIZE_4K + 1, BIT(16));
+    assert(large_again.paddr == large.paddr);
+    sos_dma_free(large_again);
+
+    for (size_t i = 0; i < ARRAY_SIZE(small); i++) {
+        sos_dma_free(small[i]);
+    }
+
+    /* the pool grows to satisfy a buffer bigger than any free extent */
+    dma_addr_t chunk = sos_dma_malloc(BIT(SOS_DMA_SIZE_BITS), PAGE_SIZE_4K);
+    if (chunk.paddr == 0) {
+        ZF_LOGW("Could not grow DMA pool");
+    } else {
+        *(volatile char *) chunk.vaddr = 'a';
+        sos_dma_free(chunk);
+    }
 }
 
 static void test_frame_table(void)
@@ -164,6 +299,961 @@ static void test_frame_table(void)
     }
 }
 
+static void test_frame_reserve(void)
+{
+    frame_table_refill();
+
+    frame_table_stats_t before;
+    frame_table_stats(&before);
+    assert(before.reserve >= CONFIG_SOS_FRAME_RESERVE_LOW);
+
+    /* An allocation with a full reserve should not need to provision */
+    frame_ref_t frame = alloc_frame();
+    assert(frame != NULL_FRAME);
+
+    frame_table_stats_t after;
+    frame_table_stats(&after);
+    assert(after.reserve_hits == before.reserve_hits + 1);
+    assert(after.reserve_misses == before.reserve_misses);
+    assert(after.frames == before.frames);
+    assert(after.reserve == before.reserve - 1);
+
+    free_frame(frame);
+}
+
+static void test_frame_refs(void)
+{
+    frame_ref_t frame = alloc_frame();
+    assert(frame != NULL_FRAME);
+    assert(frame_ref_count(frame) == 1);
+    assert(!frame_pinned(frame));
+
+    frame_table_stats_t before;
+    frame_table_stats(&before);
+
+    /* A shared frame survives until the last reference is dropped */
+    frame_ref_get(frame);
+    assert(frame_ref_count(frame) == 2);
+    free_frame(frame);
+    assert(frame_ref_count(frame) == 1);
+
+    frame_table_stats_t stats;
+    frame_table_stats(&stats);
+    assert(stats.allocated == before.allocated);
+
+    /* A pinned frame survives until it is unpinned */
+    frame_ref_pin(frame);
+    assert(frame_pinned(frame));
+    frame_ref_put(frame);
+    frame_table_stats(&stats);
+    assert(stats.allocated == before.allocated);
+
+    frame_ref_unpin(frame);
+    frame_table_stats(&stats);
+    assert(stats.allocated == before.allocated - 1);
+}
+
+static void test_zeroed_frames(void)
+{
+    frame_table_refill();
+
+    frame_table_stats_t before;
+    frame_table_stats(&before);
+    assert(before.zeroed > 0);
+
+    frame_ref_t frame = alloc_zeroed_frame();
+    assert(frame != NULL_FRAME);
+
+    frame_table_stats_t after;
+    frame_table_stats(&after);
+    assert(after.zeroed_hits == before.zeroed_hits + 1);
+
+    /* Dirty the frame, it must not come back from the zeroed pool */
+    unsigned char *data = frame_data(frame);
+    for (size_t i = 0; i < BIT(seL4_PageBits); i++) {
+        assert(data[i] == 0);
+        data[i] = i;
+    }
+    free_frame(frame);
+
+    /* Drain the zeroed pool and check the on-demand path also zeroes */
+    frame_ref_t frames[ZEROED_TEST_FRAMES] = {};
+    for (size_t f = 0; f < ZEROED_TEST_FRAMES; f++) {
+        frames[f] = alloc_zeroed_frame();
+        assert(frames[f] != NULL_FRAME);
+        data = frame_data(frames[f]);
+        for (size_t i = 0; i < BIT(seL4_PageBits); i++) {
+            assert(data[i] == 0);
+        }
+    }
+    frame_table_stats(&after);
+    assert(after.zeroed_misses > before.zeroed_misses);
+
+    for (size_t f = 0; f < ZEROED_TEST_FRAMES; f++) {
+        free_frame(frames[f]);
+    }
+}
+
+static void test_page_table(void)
+{
+    page_table_t pt;
+    int error = page_table_init(&pt);
+    assert(error == 0);
+
+    uintptr_t vaddr = 0x1234567000;
+    assert(page_table_lookup(&pt, vaddr) == NULL);
+
+    pte_t *pte = page_table_lookup_alloc(&pt, vaddr);
+    assert(pte != NULL);
+    assert(!pte->valid);
+    assert(page_table_lookup(&pt, vaddr) == pte);
+    assert(page_table_lookup(&pt, vaddr + PAGE_SIZE_4K) == pte + 1);
+    assert(pte_from_handle(pte_to_handle(pte)) == pte);
+
+    /* Neighbouring entries of a last level table map neighbouring pages */
+    size_t index = (vaddr >> seL4_PageBits) % PT_ENTRIES;
+    assert(pte_index(pte) == index);
+    assert(page_table_lookup(&pt, vaddr - index * PAGE_SIZE_4K) == pte - pte_index(pte));
+
+    /* Pageable frames go round the clock, unless pinned */
+    frame_ref_t frame = alloc_frame();
+    assert(frame != NULL_FRAME);
+    *pte = (pte_t) { .frame = frame, .valid = 1 };
+    frame_set_pageable(frame, pte_to_handle(pte));
+    assert(pte_from_handle(frame_owner(frame)) == pte);
+
+    frame_table_stats_t stats;
+    frame_table_stats(&stats);
+    assert(stats.pageable == 1);
+    assert(frame_evictable(frame));
+    assert(frame_clock_next() == frame);
+
+    frame_ref_pin(frame);
+    assert(!frame_evictable(frame));
+    assert(frame_clock_next() == NULL_FRAME);
+    frame_ref_unpin(frame);
+
+    free_frame(frame);
+    frame_table_stats(&stats);
+    assert(stats.pageable == 0);
+    assert(frame_clock_next() == NULL_FRAME);
+}
+
+static void test_addrspace(cspace_t *cspace)
+{
+    frame_table_stats_t before, after;
+    frame_table_stats(&before);
+
+    /* No vspace is needed as long as nothing is mapped */
+    addrspace_t as;
+    int error = as_init(&as, seL4_CapNull);
+    assert(error == 0);
+
+    /* Define more regions than initially fit, out of order */
+    uintptr_t base = 0x10000000;
+    for (int i = 15; i >= 0; i--) {
+        seL4_Word perms = (i % 2) ? REGION_READ : REGION_READ | REGION_WRITE;
+        region_t *region = as_define_region(&as, base + i * 4 * PAGE_SIZE_4K, 2 * PAGE_SIZE_4K, perms,
+                                            REGION_ANONYMOUS);
+        assert(region != NULL);
+    }
+    assert(as.n_regions == 16);
+
+    /* Overlapping regions are rejected */
+    assert(as_define_region(&as, base + PAGE_SIZE_4K, 2 * PAGE_SIZE_4K, REGION_READ, REGION_ANONYMOUS) == NULL);
+    assert(as_define_region(&as, base - PAGE_SIZE_4K, 2 * PAGE_SIZE_4K, REGION_READ, REGION_ANONYMOUS) == NULL);
+
+    region_t *region = as_find_region(&as, base + 8 * PAGE_SIZE_4K + 100);
+    assert(region != NULL && region->start == base + 8 * PAGE_SIZE_4K);
+    assert(as_find_region(&as, base + 2 * PAGE_SIZE_4K) == NULL);
+    assert(as_find_region(&as, base - 1) == NULL);
+
+    /* Ranges may span adjacent regions, but not holes */
+    assert(as_check_range(&as, base, 2 * PAGE_SIZE_4K, true));
+    assert(!as_check_range(&as, base, 2 * PAGE_SIZE_4K + 1, false));
+    assert(!as_check_range(&as, base + 4 * PAGE_SIZE_4K, 8, true));
+    assert(as_define_region(&as, base + 2 * PAGE_SIZE_4K, 2 * PAGE_SIZE_4K, REGION_READ, REGION_ANONYMOUS) != NULL);
+    assert(as_check_range(&as, base + PAGE_SIZE_4K, 4 * PAGE_SIZE_4K, false));
+    assert(!as_check_range(&as, base + PAGE_SIZE_4K, 4 * PAGE_SIZE_4K, true));
+
+    /* Faults outside of regions or against their permissions fail */
+    assert(as_handle_fault(cspace, &as, base - 1, 0, false) == -1);
+    assert(as_handle_fault(cspace, &as, base + 4 * PAGE_SIZE_4K, BIT(6), false) == -1);
+    assert(as_handle_fault(cspace, &as, base, 0, true) == -1);
+
+    /* Removing a region releases its pages */
+    frame_ref_t frame = alloc_frame();
+    assert(frame != NULL_FRAME);
+    pte_t *pte = page_table_lookup_alloc(&as.page_table, base + PAGE_SIZE_4K);
+    assert(pte != NULL);
+    *pte = (pte_t) { .frame = frame, .valid = 1, .writable = 1 };
+    assert(as_remove_region(&as, base + PAGE_SIZE_4K) == -1);
+    assert(as_remove_region(&as, base) == 0);
+    assert(!pte->valid);
+    assert(as_find_region(&as, base) == NULL);
+    assert(as.n_regions == 16);
+
+    as_destroy(&as);
+    frame_table_stats(&after);
+    assert(after.allocated == before.allocated);
+}
+
+static void test_heap(void)
+{
+    addrspace_t as;
+    int error = as_init(&as, seL4_CapNull);
+    assert(error == 0);
+    uintptr_t heap = PROCESS_VMEM_START;
+
+    /* The heap starts out empty, and grows and shrinks in whole pages */
+    assert(as_brk(&as, 0) == heap);
+    assert(as_brk(&as, heap + 100) == heap + 100);
+    region_t *region = as_find_region(&as, heap);
+    assert(region != NULL && region->end == heap + PAGE_SIZE_4K);
+    assert(as_brk(&as, heap + 3 * PAGE_SIZE_4K) == heap + 3 * PAGE_SIZE_4K);
+    assert(as.n_regions == 1 && as.regions[0].end == heap + 3 * PAGE_SIZE_4K);
+    assert(as_brk(&as, heap - 1) == heap + 3 * PAGE_SIZE_4K);
+    assert(as_brk(&as, heap + PAGE_SIZE_4K) == heap + PAGE_SIZE_4K);
+    assert(as.regions[0].end == heap + PAGE_SIZE_4K);
+    assert(as_brk(&as, heap) == heap);
+    assert(as.n_regions == 0);
+
+    /* Mappings are placed downwards from the top */
+    uintptr_t first = as_mmap(&as, 2 * PAGE_SIZE_4K, REGION_READ | REGION_WRITE);
+    assert(first == PROCESS_MMAP_TOP - 2 * PAGE_SIZE_4K);
+    uintptr_t second = as_mmap(&as, 1, REGION_READ);
+    assert(second == first - PAGE_SIZE_4K);
+
+    /* Unmapping the middle of a mapping splits it, and the hole is reused */
+    uintptr_t third = as_mmap(&as, 4 * PAGE_SIZE_4K, REGION_READ);
+    assert(as_munmap(&as, third + PAGE_SIZE_4K, 2 * PAGE_SIZE_4K) == 0);
+    assert(as.n_regions == 4);
+    assert(as_find_region(&as, third + PAGE_SIZE_4K) == NULL);
+    assert(as_find_region(&as, third + 3 * PAGE_SIZE_4K)->start == third + 3 * PAGE_SIZE_4K);
+    assert(as_mmap(&as, 2 * PAGE_SIZE_4K, REGION_READ) == third + PAGE_SIZE_4K);
+
+    /* Unmapping a range can cover several mappings */
+    assert(as_munmap(&as, third, PROCESS_MMAP_TOP - third) == 0);
+    assert(as.n_regions == 0);
+
+    /* The heap can not grow into a mapping, nor can SOS's own mappings be removed */
+    assert(as_define_region(&as, heap + 2 * PAGE_SIZE_4K, PAGE_SIZE_4K, REGION_READ, REGION_FIXED) != NULL);
+    assert(as_brk(&as, heap + 3 * PAGE_SIZE_4K) == heap);
+    assert(as_brk(&as, heap + 2 * PAGE_SIZE_4K) == heap + 2 * PAGE_SIZE_4K);
+    assert(as_munmap(&as, heap, 3 * PAGE_SIZE_4K) == -1);
+    assert(as_munmap(&as, heap, 2 * PAGE_SIZE_4K) == 0);
+    assert(as_brk(&as, 0) == heap);
+
+    as_destroy(&as);
+}
+
+static void test_stack_growth(cspace_t *cspace)
+{
+    addrspace_t as;
+    int error = as_init(&as, seL4_CapNull);
+    assert(error == 0);
+
+    /* A region two pages below the stack limit leaves room for the guard page */
+    uintptr_t top = PROCESS_STACK_TOP;
+    uintptr_t limit = top - 8 * PAGE_SIZE_4K;
+    assert(as_define_region(&as, limit - 2 * PAGE_SIZE_4K, PAGE_SIZE_4K, REGION_READ, REGION_ANONYMOUS) != NULL);
+    region_t *stack = as_define_stack(&as, top, 8 * PAGE_SIZE_4K);
+    assert(stack != NULL && stack->start == top - PAGE_SIZE_4K && stack->end == top);
+
+    /* Faults in the guard page or above the stack fail */
+    assert(as_handle_fault(cspace, &as, limit - PAGE_SIZE_4K, 0, false) == -1);
+    assert(as_find_region(&as, limit - PAGE_SIZE_4K) == NULL);
+    assert(as_handle_fault(cspace, &as, top + 8, 0, false) == -1);
+
+    /* Mapping a page needs a vspace, so grow the stack with an instruction fault, which
+     * fails on the stack's permissions only after the stack has grown */
+    assert(as_handle_fault(cspace, &as, limit, 0, true) == -1);
+    stack = as_find_region(&as, limit);
+    assert(stack != NULL && stack->start == limit && stack->end == top);
+    assert(as.n_regions == 2);
+    as_destroy(&as);
+
+    /* The stack does not grow up against a region below it */
+    error = as_init(&as, seL4_CapNull);
+    assert(error == 0);
+    assert(as_define_region(&as, limit - PAGE_SIZE_4K, PAGE_SIZE_4K, REGION_READ, REGION_ANONYMOUS) != NULL);
+    assert(as_define_stack(&as, top, 8 * PAGE_SIZE_4K) != NULL);
+    assert(as_handle_fault(cspace, &as, limit, 0, true) == -1);
+    assert(as_find_region(&as, limit) == NULL);
+    assert(as_handle_fault(cspace, &as, limit + PAGE_SIZE_4K, 0, true) == -1);
+    assert(as_find_region(&as, limit + PAGE_SIZE_4K)->start == limit + PAGE_SIZE_4K);
+    as_destroy(&as);
+
+    /* Once the stack is unmapped, faults below where it was fail rather than growing
+     * whatever region is now above them */
+    error = as_init(&as, seL4_CapNull);
+    assert(error == 0);
+    assert(as_define_region(&as, PROCESS_IPC_BUFFER, PAGE_SIZE_4K, REGION_READ | REGION_WRITE,
+                            REGION_FIXED) != NULL);
+    assert(as_define_stack(&as, top, 8 * PAGE_SIZE_4K) != NULL);
+    assert(as_munmap(&as, top - PAGE_SIZE_4K, PAGE_SIZE_4K) == 0);
+    assert(as.n_regions == 1);
+    assert(as_handle_fault(cspace, &as, top - 2 * PAGE_SIZE_4K, 0, true) == -1);
+    assert(as_handle_fault(cspace, &as, limit, 0, true) == -1);
+    assert(as.n_regions == 1);
+    assert(as_find_region(&as, PROCESS_IPC_BUFFER)->start == PROCESS_IPC_BUFFER);
+    as_destroy(&as);
+
+    /* Trimming just the top page has the same effect */
+    error = as_init(&as, seL4_CapNull);
+    assert(error == 0);
+    assert(as_define_stack(&as, top, 8 * PAGE_SIZE_4K) != NULL);
+    assert(as_handle_fault(cspace, &as, top - 2 * PAGE_SIZE_4K, 0, true) == -1);
+    assert(as_munmap(&as, top - PAGE_SIZE_4K, PAGE_SIZE_4K) == 0);
+    assert(as_find_region(&as, top - 2 * PAGE_SIZE_4K)->end == top - PAGE_SIZE_4K);
+    assert(as_handle_fault(cspace, &as, limit, 0, true) == -1);
+    assert(as_find_region(&as, limit) == NULL);
+    as_destroy(&as);
+}
+
+static void test_clone(void)
+{
+    frame_table_stats_t before, after;
+    frame_table_stats(&before);
+
+    addrspace_t parent, child;
+    int error = as_init(&parent, seL4_CapNull);
+    assert(error == 0);
+    error = as_init(&child, seL4_CapNull);
+    assert(error == 0);
+
+    uintptr_t base = 0x10000000;
+    assert(as_define_region(&parent, base, 2 * PAGE_SIZE_4K, REGION_READ | REGION_WRITE, REGION_ANONYMOUS) != NULL);
+    assert(as_define_region(&parent, base + 4 * PAGE_SIZE_4K, PAGE_SIZE_4K, REGION_READ, REGION_ANONYMOUS) != NULL);
+    assert(as_define_region(&parent, PROCESS_IPC_BUFFER, PAGE_SIZE_4K, REGION_READ | REGION_WRITE,
+                            REGION_FIXED) != NULL);
+    assert(as_brk(&parent, parent.heap_start + 100) == parent.heap_start + 100);
+
+    /* Unmapped pages, as the address spaces have no vspace */
+    frame_ref_t data = alloc_frame();
+    frame_ref_t text = alloc_frame();
+    assert(data != NULL_FRAME && text != NULL_FRAME);
+    pte_t *data_pte = page_table_lookup_alloc(&parent.page_table, base + PAGE_SIZE_4K);
+    *data_pte = (pte_t) { .frame = data, .valid = 1, .writable = 1 };
+    frame_set_pageable(data, pte_to_handle(data_pte));
+    pte_t *text_pte = page_table_lookup_alloc(&parent.page_table, base + 4 * PAGE_SIZE_4K);
+    *text_pte = (pte_t) { .frame = text, .valid = 1 };
+    frame_set_pageable(text, pte_to_handle(text_pte));
+
+    /* Everything but SOS's own mappings is copied, sharing the frames */
+    assert(as_clone(&child, &parent) == 0);
+    assert(child.n_regions == 3 && as_find_region(&child, PROCESS_IPC_BUFFER) == NULL);
+    assert(child.brk == parent.brk);
+    assert(frame_ref_count(data) == 2 && frame_ref_count(text) == 2);
+
+    /* with writable pages now copied on write */
+    pte_t *copy = page_table_lookup(&child.page_table, base + PAGE_SIZE_4K);
+    assert(copy->valid && copy->frame == data && copy->cow && !copy->writable);
+    assert(data_pte->cow && !data_pte->writable);
+    copy = page_table_lookup(&child.page_table, base + 4 * PAGE_SIZE_4K);
+    assert(copy->valid && copy->frame == text && !copy->cow && copy->shared);
+    assert(page_table_lookup(&child.page_table, base)->valid == 0);
+
+    /* Writes to read only regions are still refused */
+    assert(as_handle_fault(NULL, &child, base + 4 * PAGE_SIZE_4K, BIT(6), false) == -1);
+
+    as_destroy(&parent);
+    assert(frame_ref_count(data) == 1 && frame_ref_count(text) == 1);
+    as_destroy(&child);
+    frame_table_stats(&after);
+    assert(after.allocated == before.allocated);
+    assert(after.pageable == before.pageable);
+}
+
+static void test_share_vm(void)
+{
+    frame_table_stats_t before, after;
+    frame_table_stats(&before);
+
+    addrspace_t producer, consumer;
+    int error = as_init(&producer, seL4_CapNull);
+    assert(error == 0);
+    error = as_init(&consumer, seL4_CapNull);
+    assert(error == 0);
+
+    uintptr_t base = 0x10000000;
+    assert(as_define_region(&producer, base, 2 * PAGE_SIZE_4K, REGION_READ | REGION_WRITE,
+                            REGION_ANONYMOUS) != NULL);
+    assert(as_define_region(&consumer, base, 2 * PAGE_SIZE_4K, REGION_READ | REGION_WRITE,
+                            REGION_ANONYMOUS) != NULL);
+
+    /* Ranges must be page aligned and within writable regions to be shared writable */
+    assert(as_share(&producer, base + 1, PAGE_SIZE_4K, false) == -1);
+    assert(as_share(&producer, base, 3 * PAGE_SIZE_4K, false) == -1);
+    assert(as_share(&producer, base, 2 * PAGE_SIZE_4K, true) == 0);
+
+    /* The page of the first to share is the one shared, unmapped address spaces can not
+     * touch the page, so fill in its contents directly */
+    pte_t *mine = page_table_lookup(&producer.page_table, base);
+    assert(mine->valid && mine->share && mine->writable);
+    frame_data(mine->frame)[0] = 42;
+
+    assert(as_share(&consumer, base, PAGE_SIZE_4K, false) == 0);
+    pte_t *theirs = page_table_lookup(&consumer.page_table, base);
+    assert(theirs->frame == mine->frame && frame_data(theirs->frame)[0] == 42);
+    assert(frame_ref_count(mine->frame) == 2);
+
+    /* Only the consumer may write, as only the producer allows others to */
+    assert(!mine->writable && theirs->writable);
+    assert(as_share(&consumer, base, PAGE_SIZE_4K, true) == 0);
+    theirs = page_table_lookup(&consumer.page_table, base);
+    assert(mine->writable && theirs->writable);
+
+    /* Once the consumer is gone the producer has the page to itself */
+    assert(as_share(&consumer, base, PAGE_SIZE_4K, false) == 0);
+    assert(!mine->writable);
+    as_destroy(&consumer);
+    assert(mine->writable && frame_ref_count(mine->frame) == 1);
+
+    as_destroy(&producer);
+    frame_table_stats(&after);
+    assert(after.allocated == before.allocated);
+}
+
+static void test_pin(void)
+{
+    addrspace_t as;
+    int error = as_init(&as, seL4_CapNull);
+    assert(error == 0);
+
+    uintptr_t base = 0x10000000;
+    assert(as_define_region(&as, base, 2 * PAGE_SIZE_4K, REGION_READ | REGION_WRITE, REGION_ANONYMOUS) != NULL);
+    assert(as_define_region(&as, base + 2 * PAGE_SIZE_4K, PAGE_SIZE_4K, REGION_READ, REGION_ANONYMOUS) != NULL);
+
+    /* Resident pages, which are pinned without faulting, as the address space has no vspace */
+    frame_ref_t frames[3];
+    for (size_t i = 0; i < 3; i++) {
+        frames[i] = alloc_frame();
+        assert(frames[i] != NULL_FRAME);
+        pte_t *pte = page_table_lookup_alloc(&as.page_table, base + i * PAGE_SIZE_4K);
+        *pte = (pte_t) { .frame = frames[i], .valid = 1, .writable = i < 2 };
+        frame_set_pageable(frames[i], pte_to_handle(pte));
+    }
+
+    /* A buffer straddling pages is split at the page boundary */
+    struct iovec iov[3];
+    frame_ref_t pinned[3];
+    uintptr_t buf = base + PAGE_SIZE_4K - 10;
+    assert(as_pin(NULL, &as, buf, 20, true, iov, pinned, 3) == 2);
+    assert(pinned[0] == frames[0] && pinned[1] == frames[1]);
+    assert(iov[0].iov_base == frame_data(frames[0]) + PAGE_SIZE_4K - 10 && iov[0].iov_len == 10);
+    assert(iov[1].iov_base == frame_data(frames[1]) && iov[1].iov_len == 10);
+    assert(frame_pinned(frames[0]) && frame_pinned(frames[1]));
+    as_unpin(pinned, 2);
+    assert(!frame_pinned(frames[0]) && !frame_pinned(frames[1]));
+
+    /* At most max pages are pinned at once */
+    assert(as_pin(NULL, &as, base, 3 * PAGE_SIZE_4K, false, iov, pinned, 1) == 1);
+    assert(iov[0].iov_len == PAGE_SIZE_4K);
+    as_unpin(pinned, 1);
+
+    /* Writes to read only memory, and buffers running out of the regions, pin nothing */
+    assert(as_pin(NULL, &as, base + PAGE_SIZE_4K, 2 * PAGE_SIZE_4K, true, iov, pinned, 3) == -1);
+    assert(as_pin(NULL, &as, base + 2 * PAGE_SIZE_4K, 2 * PAGE_SIZE_4K, false, iov, pinned, 3) == -1);
+    for (size_t i = 0; i < 3; i++) {
+        assert(!frame_pinned(frames[i]));
+    }
+
+    as_destroy(&as);
+}
+
+static void test_page_cache(void)
+{
+    static const char file[1];
+    page_cache_stats_t before, after;
+    page_cache_stats(&before);
+
+    assert(page_cache_lookup(file, 0) == NULL_FRAME);
+    frame_ref_t frame = alloc_frame();
+    assert(frame != NULL_FRAME);
+    assert(page_cache_insert(file, PAGE_SIZE_4K, frame, NULL) == 0);
+    assert(frame_ref_count(frame) == 2);
+
+    /* Pages are found by both file and offset */
+    assert(page_cache_lookup(file, 0) == NULL_FRAME);
+    assert(page_cache_lookup(file + 1, PAGE_SIZE_4K) == NULL_FRAME);
+    assert(page_cache_lookup(file, PAGE_SIZE_4K) == frame);
+
+    /* The cache keeps the page after everyone else is done with it */
+    free_frame(frame);
+    assert(frame_ref_count(frame) == 1);
+    assert(page_cache_lookup(file, PAGE_SIZE_4K) == frame);
+
+    page_cache_stats(&after);
+    assert(after.hits == before.hits + 2);
+    assert(after.misses == before.misses + 3);
+}
+
+static size_t test_pages_written;
+
+static int test_write_page(UNUSED const void *file, UNUSED uintptr_t offset, UNUSED frame_ref_t frame)
+{
+    test_pages_written++;
+    return 0;
+}
+
+static void test_page_cache_writeback(void)
+{
+    static const char file[1];
+    frame_ref_t frame = alloc_frame();
+    assert(frame != NULL_FRAME);
+    assert(page_cache_insert(file, 0, frame, test_write_page) == 0);
+
+    /* Clean pages are not written */
+    assert(page_cache_flush(file, 0, PAGE_SIZE_4K) == 0);
+    assert(test_pages_written == 0);
+
+    /* A dirty page stays dirty while it is still mapped */
+    page_cache_set_dirty(file, 0);
+    assert(page_cache_flush(file, PAGE_SIZE_4K, 2 * PAGE_SIZE_4K) == 0);
+    assert(test_pages_written == 0);
+    assert(page_cache_flush(file, 0, PAGE_SIZE_4K) == 0);
+    assert(page_cache_flush(file, 0, PAGE_SIZE_4K) == 0);
+    assert(test_pages_written == 2);
+
+    /* and is clean once written back after it is unmapped */
+    free_frame(frame);
+    assert(page_cache_flush(file, 0, PAGE_SIZE_4K) == 0);
+    assert(page_cache_flush(file, 0, PAGE_SIZE_4K) == 0);
+    assert(test_pages_written == 3);
+
+    /* Removing a file writes back its dirty pages and forgets them */
+    page_cache_stats_t before, after;
+    page_cache_stats(&before);
+    page_cache_set_dirty(file, 0);
+    page_cache_remove(file);
+    assert(test_pages_written == 4);
+    assert(page_cache_lookup(file, 0) == NULL_FRAME);
+    page_cache_stats(&after);
+    assert(after.pages == before.pages - 1);
+}
+
+/* Count data TLB refills with event counter 0, alongside the cycle counter. */
+static void pmu_init(void)
+{
+    seL4_Word pmcr;
+    asm volatile("mrs %0, PMCR_EL0" : "=r"(pmcr));
+    /* enable, with 64-bit cycle counter */
+    asm volatile("msr PMCR_EL0, %0" :: "r"(pmcr | BIT(6) | BIT(0)));
+    asm volatile("msr PMSELR_EL0, %0" :: "r"(0ul));
+    asm volatile("msr PMXEVTYPER_EL0, %0" :: "r"((seL4_Word) PMU_L1D_TLB_REFILL));
+    asm volatile("msr PMCNTENSET_EL0, %0" :: "r"(BIT(31) | BIT(0)));
+    asm volatile("isb");
+}
+
+static void pmu_read(seL4_Word *cycles, seL4_Word *refills)
+{
+    asm volatile("isb");
+    asm volatile("mrs %0, PMCCNTR_EL0" : "=r"(*cycles));
+    asm volatile("mrs %0, PMEVCNTR0_EL0" : "=r"(*refills));
+}
+
+/* Sequentially read a cache line at a time, returning cycles and TLB refills taken */
+static void scan(volatile seL4_Word *region, seL4_Word *cycles, seL4_Word *refills)
+{
+    seL4_Word start_cycles, start_refills;
+    UNUSED seL4_Word sum = 0;
+
+    /* warm up */
+    for (size_t i = 0; i < SCAN_BYTES / sizeof(seL4_Word); i += SCAN_STRIDE) {
+        sum += region[i];
+    }
+
+    pmu_read(&start_cycles, &start_refills);
+    for (int pass = 0; pass < SCAN_PASSES; pass++) {
+        for (size_t i = 0; i < SCAN_BYTES / sizeof(seL4_Word); i += SCAN_STRIDE) {
+            sum += region[i];
+        }
+    }
+    pmu_read(cycles, refills);
+
+    *cycles -= start_cycles;
+    *refills -= start_refills;
+}
+
+/* Fill a page with pseudo random bytes, which do not compress. */
+static void fill_noise(unsigned char *data, uint32_t seed)
+{
+    uint32_t x = seed;
+    for (size_t i = 0; i < PAGE_SIZE_4K; i++) {
+        x = x * 1103515245 + 12345;
+        data[i] = x >> 24;
+    }
+}
+
+static bool is_noise(unsigned char *data, uint32_t seed)
+{
+    static unsigned char expected[PAGE_SIZE_4K];
+    fill_noise(expected, seed);
+    return memcmp(data, expected, PAGE_SIZE_4K) == 0;
+}
+
+static void test_zswap(void)
+{
+    /* Compression round trips, and fails when the output does not fit */
+    static unsigned char text[PAGE_SIZE_4K], packed[PAGE_SIZE_4K * 2], unpacked[PAGE_SIZE_4K];
+    for (size_t i = 0; i < sizeof(text); i++) {
+        text[i] = "the quick brown fox "[i % 20] + i / 512;
+    }
+    size_t len = lz_compress(text, sizeof(text), packed, sizeof(packed));
+    assert(len > 0 && len < sizeof(text) / 4);
+    assert(lz_decompress(packed, len, unpacked, sizeof(unpacked)) == sizeof(text));
+    assert(memcmp(text, unpacked, sizeof(text)) == 0);
+    assert(lz_compress(text, sizeof(text), packed, len - 1) == 0);
+    assert(lz_decompress(packed, len, unpacked, sizeof(unpacked) - 1) == -1);
+
+    zswap_stats_t before, after;
+    zswap_stats(&before);
+
+    /* An empty store takes over the frame of the page it is given */
+    frame_ref_t frame = alloc_zeroed_frame();
+    assert(frame != NULL_FRAME);
+    ssize_t entry = zswap_store(frame);
+    assert(entry >= 0);
+    zswap_stats(&after);
+    assert(after.pages == before.pages + 1);
+    assert(after.frames == before.frames + 1);
+    assert(frame_ref_count(frame) == 2);
+    free_frame(frame);
+
+    /* Pages that do not compress are turned away */
+    frame_ref_t noise = alloc_frame();
+    assert(noise != NULL_FRAME);
+    fill_noise(frame_data(noise), 1);
+    assert(zswap_store(noise) == -1);
+    zswap_stats(&after);
+    assert(after.rejects == before.rejects + 1);
+
+    /* Pages come back intact, and the store lets go of frames it no longer needs */
+    memset(frame_data(noise), 0xff, PAGE_SIZE_4K);
+    assert(zswap_load(entry, frame_data(noise)) == 0);
+    for (size_t i = 0; i < PAGE_SIZE_4K; i++) {
+        assert(frame_data(noise)[i] == 0);
+    }
+    free_frame(noise);
+    zswap_stats(&after);
+    assert(after.pages == before.pages);
+    assert(after.frames == before.frames);
+    assert(after.loads == before.loads + 1);
+}
+
+static void test_asid_pools(void)
+{
+    asid_stats_t before, stats;
+    asid_stats(&before);
+
+    /* Fill every pool, and take one ASID more, which needs a new pool */
+    size_t n = before.capacity - before.used + 1;
+    seL4_CPtr *vspaces = malloc(n * sizeof(seL4_CPtr));
+    ut_t **uts = malloc(n * sizeof(ut_t *));
+    int *pools = malloc(n * sizeof(int));
+    assert(vspaces != NULL && uts != NULL && pools != NULL);
+    for (size_t i = 0; i < n; i++) {
+        uts[i] = alloc_retype(&vspaces[i], seL4_ARM_PageGlobalDirectoryObject, seL4_PGDBits);
+        assert(uts[i] != NULL);
+        pools[i] = asid_assign(vspaces[i]);
+        assert(pools[i] >= 0);
+    }
+    asid_stats(&stats);
+    assert(stats.pools == before.pools + 1);
+    assert(stats.used == before.used + n);
+    assert(stats.capacity == before.capacity + ASIDS_PER_POOL);
+    assert(pools[n - 1] == (int) before.pools);
+
+    /* Deleting the vspaces gives their ASIDs back, but the new pool is kept */
+    for (size_t i = 0; i < n; i++) {
+        cspace_delete(&cspace, vspaces[i]);
+        cspace_free_slot(&cspace, vspaces[i]);
+        ut_free(uts[i]);
+        asid_release(pools[i]);
+    }
+    asid_stats(&stats);
+    assert(stats.pools == before.pools + 1);
+    assert(stats.used == before.used);
+
+    /* A freed ASID is reused rather than a pool being made */
+    uts[0] = alloc_retype(&vspaces[0], seL4_ARM_PageGlobalDirectoryObject, seL4_PGDBits);
+    assert(uts[0] != NULL);
+    pools[0] = asid_assign(vspaces[0]);
+    assert(pools[0] == 0);
+    cspace_delete(&cspace, vspaces[0]);
+    cspace_free_slot(&cspace, vspaces[0]);
+    ut_free(uts[0]);
+    asid_release(pools[0]);
+    asid_stats(&stats);
+    assert(stats.pools == before.pools + 1);
+
+    free(pools);
+    free(uts);
+    free(vspaces);
+}
+
+static void test_large_pages(cspace_t *cspace)
+{
+    uintptr_t large_vaddr = SOS_TEST_START;
+    uintptr_t small_vaddr = SOS_TEST_START + SCAN_BYTES;
+
+    /* unaligned large mappings are rejected */
+    seL4_Error err = map_large_frame(cspace, seL4_CapNull, seL4_CapInitThreadVSpace, large_vaddr + PAGE_SIZE_4K,
+                                     seL4_ReadWrite, seL4_ARM_Default_VMAttributes);
+    assert(err == seL4_AlignmentError);
+
+    /* the same amount of memory, mapped with large and with small pages */
+    ut_t *large_uts[SCAN_LARGE_PAGES] = {};
+    seL4_CPtr large_pages[SCAN_LARGE_PAGES] = {};
+    for (size_t i = 0; i < SCAN_LARGE_PAGES; i++) {
+        large_uts[i] = ut_alloc_2m_untyped(NULL);
+        if (large_uts[i] == NULL) {
+            ZF_LOGW("Not enough large pages to benchmark");
+            for (size_t j = 0; j < i; j++) {
+                cspace_delete(cspace, large_pages[j]);
+                cspace_free_slot(cspace, large_pages[j]);
+                ut_free(large_uts[j]);
+            }
+            return;
+        }
+
+        large_pages[i] = cspace_alloc_slot(cspace);
+        assert(large_pages[i] != seL4_CapNull);
+        err = cspace_untyped_retype(cspace, large_uts[i]->cap, large_pages[i], seL4_ARM_LargePageObject,
+                                    seL4_LargePageBits);
+        assert(err == seL4_NoError);
+        err = map_large_frame(cspace, large_pages[i], seL4_CapInitThreadVSpace,
+                              large_vaddr + i * BIT(seL4_LargePageBits), seL4_ReadWrite,
+                              seL4_ARM_Default_VMAttributes | seL4_ARM_ExecuteNever);
+        assert(err == seL4_NoError);
+    }
+
+    /* large pages are usable across their whole extent */
+    seL4_Word *large = (seL4_Word *) large_vaddr;
+    for (size_t i = 0; i < SCAN_BYTES / sizeof(seL4_Word); i += PAGE_SIZE_4K / sizeof(seL4_Word)) {
+        assert(large[i] == 0);
+        large[i] = i;
+    }
+    for (size_t i = 0; i < SCAN_BYTES / sizeof(seL4_Word); i += PAGE_SIZE_4K / sizeof(seL4_Word)) {
+        assert(large[i] == i);
+    }
+
+    static frame_ref_t frames[SCAN_SMALL_PAGES];
+    static seL4_CPtr small_pages[SCAN_SMALL_PAGES];
+    for (size_t i = 0; i < SCAN_SMALL_PAGES; i++) {
+        frames[i] = alloc_frame();
+        assert(frames[i] != NULL_FRAME);
+        small_pages[i] = cspace_alloc_slot(cspace);
+        assert(small_pages[i] != seL4_CapNull);
+        err = cspace_copy(cspace, small_pages[i], frame_table_cspace(), frame_page(frames[i]), seL4_AllRights);
+        assert(err == seL4_NoError);
+    }
+    err = map_frames_range(cspace, small_pages, SCAN_SMALL_PAGES, seL4_CapInitThreadVSpace, small_vaddr,
+                           seL4_ReadWrite, seL4_ARM_Default_VMAttributes | seL4_ARM_ExecuteNever, NULL);
+    assert(err == seL4_NoError);
+
+    /* the range is mapped in order */
+    for (size_t i = 0; i < SCAN_SMALL_PAGES; i++) {
+        frame_data(frames[i])[0] = i;
+        assert(((unsigned char *) small_vaddr)[i * PAGE_SIZE_4K] == (unsigned char) i);
+    }
+
+    pmu_init();
+    seL4_Word small_cycles, small_refills, large_cycles, large_refills;
+    scan((seL4_Word *) small_vaddr, &small_cycles, &small_refills);
+    scan((seL4_Word *) large_vaddr, &large_cycles, &large_refills);
+    ZF_LOGI("Scan of %zu KiB x %d: 4K pages %lu cycles, %lu dTLB refills; 2M pages %lu cycles, %lu dTLB refills",
+            (size_t) SCAN_BYTES / 1024, SCAN_PASSES, small_cycles, small_refills, large_cycles, large_refills);
+
+    err = unmap_frames_range(small_pages, SCAN_SMALL_PAGES);
+    assert(err == seL4_NoError);
+    for (size_t i = 0; i < SCAN_SMALL_PAGES; i++) {
+        cspace_delete(cspace, small_pages[i]);
+        cspace_free_slot(cspace, small_pages[i]);
+        free_frame(frames[i]);
+    }
+    for (size_t i = 0; i < SCAN_LARGE_PAGES; i++) {
+        cspace_delete(cspace, large_pages[i]);
+        cspace_free_slot(cspace, large_pages[i]);
+        ut_free(large_uts[i]);
+    }
+}
+
+static void test_heap_large_pages(cspace_t *cspace)
+{
+    ut_t *probe = ut_alloc_2m_untyped(NULL);
+    if (probe == NULL) {
+        ZF_LOGW("No large pages left to back a heap with");
+        return;
+    }
+    ut_free(probe);
+
+    frame_table_stats_t before, after;
+    frame_table_stats(&before);
+
+    seL4_CPtr vspace;
+    ut_t *vspace_ut = alloc_retype(&vspace, seL4_ARM_PageGlobalDirectoryObject, seL4_PGDBits);
+    assert(vspace_ut != NULL);
+    int pool = asid_assign(vspace);
+    assert(pool >= 0);
+    addrspace_t as;
+    int error = as_init(&as, vspace);
+    assert(error == 0);
+
+    /* The first touch of a whole 2MiB span of the heap maps a large page */
+    size_t span_pages = BIT(seL4_LargePageBits - seL4_PageBits);
+    uintptr_t heap = PROCESS_VMEM_START;
+    uintptr_t end = heap + BIT(seL4_LargePageBits) + PAGE_SIZE_4K;
+    assert(as_brk(&as, end) == end);
+    assert(as_handle_fault(cspace, &as, heap + 100, BIT(6), false) == 0);
+    assert(page_table_lookup(&as.page_table, heap) == NULL);
+    assert(as_pages(&as) == span_pages);
+
+    /* The page past the span gets a page of its own */
+    assert(as_handle_fault(cspace, &as, heap + BIT(seL4_LargePageBits), BIT(6), false) == 0);
+    assert(page_table_lookup(&as.page_table, heap + BIT(seL4_LargePageBits))->valid);
+    assert(as_pages(&as) == span_pages + 1);
+
+    /* SOS accesses the large page in place, without pinning frames */
+    struct iovec iov[2];
+    frame_ref_t pinned[2];
+    uintptr_t buf = heap + 2 * PAGE_SIZE_4K - 1;
+    assert(as_pin(cspace, &as, buf, 2, true, iov, pinned, 2) == 2);
+    assert(pinned[0] == NULL_FRAME && pinned[1] == NULL_FRAME);
+    assert(*(char *) iov[0].iov_base == 0);
+    *(char *) iov[0].iov_base = 'a';
+    *(char *) iov[1].iov_base = 'b';
+    as_unpin(pinned, 2);
+
+    /* Unmapping part of the span splits the large page, its other pages keep their contents */
+    assert(as_munmap(&as, heap, PAGE_SIZE_4K) == 0);
+    assert(as_pages(&as) == span_pages);
+    assert(as_handle_fault(cspace, &as, buf, 0, false) == 0);
+    pte_t *pte = page_table_lookup(&as.page_table, buf);
+    assert(pte != NULL && pte->valid && frame_data(pte->frame)[PAGE_SIZE_4K - 1] == 'a');
+    assert(as_pages(&as) == span_pages);
+    assert(as_pin(cspace, &as, buf + 1, 1, false, iov, pinned, 1) == 1);
+    assert(pinned[0] == NULL_FRAME && *(char *) iov[0].iov_base == 'b');
+    as_unpin(pinned, 1);
+
+    /* Destroying the address space gives the large page back */
+    as_destroy(&as);
+    cspace_delete(cspace, vspace);
+    cspace_free_slot(cspace, vspace);
+    ut_free(vspace_ut);
+    asid_release(pool);
+    probe = ut_alloc_2m_untyped(NULL);
+    assert(probe != NULL);
+    ut_free(probe);
+    frame_table_stats(&after);
+    assert(after.allocated == before.allocated);
+}
+
+/* Check the page at vaddr is resident and holds what is expected */
+static void assert_page(addrspace_t *as, uintptr_t vaddr, const unsigned char *expected)
+{
+    pte_t *pte = page_table_lookup(&as->page_table, vaddr);
+    assert(pte != NULL && pte->valid && !pte->swapped);
+    assert(memcmp(frame_data(pte->frame), expected, PAGE_SIZE_4K) == 0);
+}
+
+/* Fault a page in, unless it was prefaulted when it was loaded */
+static void fault_in(cspace_t *cspace, addrspace_t *as, uintptr_t vaddr)
+{
+    pte_t *pte = page_table_lookup(&as->page_table, vaddr);
+    if (pte == NULL || !pte->valid) {
+        assert(as_handle_fault(cspace, as, vaddr, 0, false) == 0);
+    }
+}
+
+static void test_elf_lazy(cspace_t *cspace)
+{
+    static char image[3 * PAGE_SIZE_4K];
+    for (size_t i = 0; i < sizeof(image); i++) {
+        image[i] = i % 251 + 1;
+    }
+    static unsigned char expected[PAGE_SIZE_4K];
+
+    seL4_CPtr vspace;
+    ut_t *vspace_ut = alloc_retype(&vspace, seL4_ARM_PageGlobalDirectoryObject, seL4_PGDBits);
+    assert(vspace_ut != NULL);
+    int pool = asid_assign(vspace);
+    assert(pool >= 0);
+    addrspace_t as;
+    int error = as_init(&as, vspace);
+    assert(error == 0);
+
+    /* Nothing is loaded until a page is touched */
+    uintptr_t base = 0x400000;
+    region_t *region = as_define_region(&as, base, 3 * PAGE_SIZE_4K, REGION_READ | REGION_WRITE, REGION_ELF);
+    assert(region != NULL);
+    region->data = image;
+    region->data_vaddr = base + 0x10;
+    region->data_size = PAGE_SIZE_4K + 0x100;
+    for (size_t i = 0; i < 3; i++) {
+        pte_t *pte = page_table_lookup(&as.page_table, base + i * PAGE_SIZE_4K);
+        assert(pte == NULL || !pte->valid);
+    }
+
+    /* A page gets the part of the file that falls in it, and zeroes around it */
+    assert(as_handle_fault(cspace, &as, base + PAGE_SIZE_4K + 8, 0, false) == 0);
+    assert(!page_table_lookup(&as.page_table, base)->valid);
+    memset(expected, 0, PAGE_SIZE_4K);
+    memcpy(expected, image + PAGE_SIZE_4K - 0x10, 0x110);
+    assert_page(&as, base + PAGE_SIZE_4K, expected);
+    assert(as_handle_fault(cspace, &as, base, 0, false) == 0);
+    memset(expected, 0, PAGE_SIZE_4K);
+    memcpy(expected + 0x10, image, PAGE_SIZE_4K - 0x10);
+    assert_page(&as, base, expected);
+
+    /* Pages past the file data are bss, and come back zeroed */
+    assert(as_handle_fault(cspace, &as, base + 2 * PAGE_SIZE_4K, BIT(6), false) == 0);
+    memset(expected, 0, PAGE_SIZE_4K);
+    assert_page(&as, base + 2 * PAGE_SIZE_4K, expected);
+
+    /* A page shared by two segments holds the contents of both, whether or
+     * not it was prefaulted with the first */
+    uintptr_t elf = base + 0x100000;
+    elf_segment_t segments[] = {
+        { .data = image, .file_size = 0x1000, .mem_size = 0x1020, .vaddr = elf + 0x10, .flags = PF_R | PF_W },
+        { .data = image + 0x1100, .file_size = 0x1000, .mem_size = 0x3000, .vaddr = elf + 0x1800,
+          .flags = PF_R | PF_W },
+    };
+    assert(elf_load(cspace, &as, segments, ARRAY_SIZE(segments)) == 0);
+    memset(expected, 0, PAGE_SIZE_4K);
+    memcpy(expected, image + 0xff0, 0x10);
+    memcpy(expected + 0x800, image + 0x1100, 0x800);
+    assert_page(&as, elf + PAGE_SIZE_4K, expected);
+
+    /* The second segment loads the rest of its pages itself */
+    assert(as_find_region(&as, elf + 2 * PAGE_SIZE_4K)->start == elf + 2 * PAGE_SIZE_4K);
+    fault_in(cspace, &as, elf + 2 * PAGE_SIZE_4K);
+    memset(expected, 0, PAGE_SIZE_4K);
+    memcpy(expected, image + 0x1900, 0x800);
+    assert_page(&as, elf + 2 * PAGE_SIZE_4K, expected);
+    fault_in(cspace, &as, elf + 4 * PAGE_SIZE_4K);
+    memset(expected, 0, PAGE_SIZE_4K);
+    assert_page(&as, elf + 4 * PAGE_SIZE_4K, expected);
+
+    /* Segments with different permissions can not share a page, as the page could
+     * only be mapped with one segment's */
+    uintptr_t mixed = base + 0x200000;
+    elf_segment_t text_and_data[] = {
+        { .data = image, .file_size = 0x100, .mem_size = 0x100, .vaddr = mixed, .flags = PF_R | PF_X },
+        { .data = image + 0x800, .file_size = 0x100, .mem_size = 0x100, .vaddr = mixed + 0x800,
+          .flags = PF_R | PF_W },
+    };
+    assert(elf_load(cspace, &as, text_and_data, ARRAY_SIZE(text_and_data)) == -1);
+    assert(as_find_region(&as, mixed)->perms == (REGION_READ | REGION_EXEC));
+
+    as_destroy(&as);
+    cspace_delete(cspace, vspace);
+    cspace_free_slot(cspace, vspace);
+    ut_free(vspace_ut);
+    asid_release(pool);
+}
+
 void run_tests(cspace_t *cspace)
 {
     /* test the cspace bitfield data structure */
@@ -194,6 +1284,10 @@ void run_tests(cspace_t *cspace)
     cspace_destroy(&dummy_cspace);
     ZF_LOGI("Double level cspace test passed!");
 
+    /* test untyped splitting and merging */
+    test_ut(cspace);
+    ZF_LOGI("Untyped allocator test passed!");
+
     /* test DMA */
     test_dma();
     ZF_LOGI("DMA test passed!");
@@ -201,4 +1295,476 @@ void run_tests(cspace_t *cspace)
     /* test frame table */
     test_frame_table();
     ZF_LOGI("Frame table test passed!");
+
+    /* test frame sharing */
+    test_frame_refs();
+    ZF_LOGI("Frame reference test passed!");
+
+    /* test zeroed frame pool */
+    test_zeroed_frames();
+    ZF_LOGI("Zeroed frame test passed!");
+
+    /* test frame table reserve */
+    test_frame_reserve();
+    ZF_LOGI("Frame reserve test passed!");
+
+    /* test page table */
+    test_page_table();
+    ZF_LOGI("Page table test passed!");
+
+    /* test address space regions */
+    test_addrspace(cspace);
+    ZF_LOGI("Address space test passed!");
+
+    test_heap();
+    ZF_LOGI("Heap test passed!");
+
+    test_stack_growth(cspace);
+    ZF_LOGI("Stack growth test passed!");
+
+    test_clone();
+    ZF_LOGI("Address space clone test passed!");
+
+    test_share_vm();
+    ZF_LOGI("Shared memory test passed!");
+
+    test_page_cache();
+    ZF_LOGI("Page cache test passed!");
+
+    test_page_cache_writeback();
+    ZF_LOGI("Page cache writeback test passed!");
+
+    test_pin();
+    ZF_LOGI("User buffer pinning test passed!");
+
+    test_zswap();
+    ZF_LOGI("Compressed store test passed!");
+
+    test_asid_pools();
+    ZF_LOGI("ASID pool test passed!");
+
+    /* test and benchmark large pages */
+    test_large_pages(cspace);
+    ZF_LOGI("Large page test passed!");
+
+    test_heap_large_pages(cspace);
+    ZF_LOGI("Large page heap test passed!");
+
+    test_elf_lazy(cspace);
+    ZF_LOGI("Lazy ELF loading test passed!");
+}
+
+/* Memory held by SOS that a process could leak. */
+typedef struct {
+    size_t frames;
+    size_t allocated;
+    ut_stats_t ut;
+    size_t slots;
+    size_t paging_structures;
+} memory_snapshot_t;
+
+static void snapshot_memory(cspace_t *cspace, memory_snapshot_t *snapshot)
+{
+    frame_table_stats_t stats;
+    frame_table_stats(&stats);
+    snapshot->frames = stats.frames;
+    snapshot->allocated = stats.allocated;
+    ut_stats(&snapshot->ut);
+    snapshot->slots = cspace->n_slots_used;
+    snapshot->paging_structures = mapping_paging_structures();
+}
+
+static void test_process_teardown(cspace_t *cspace, const char *app)
+{
+    /* The first process grows the SOS cspace and frame table, which are kept. The frames it
+     * frees are enough for each of the later ones, so the frame table stops growing. */
+    process_t *proc = process_start(app);
+    assert(proc != NULL);
+    process_destroy(proc);
+
+    memory_snapshot_t before, after;
+    snapshot_memory(cspace, &before);
+    for (int i = 0; i < TEARDOWN_CYCLES; i++) {
+        proc = process_start(app);
+        assert(proc != NULL);
+        assert(proc->active);
+        process_destroy(proc);
+        assert(!proc->active);
+    }
+    snapshot_memory(cspace, &after);
+
+    assert(after.frames == before.frames);
+    assert(after.allocated == before.allocated);
+    assert_ut_stats_equal(&before.ut, &after.ut);
+    assert(after.slots == before.slots);
+    assert(after.paging_structures == before.paging_structures);
+}
+
+static void test_process_table(const char *app)
+{
+    process_t *a = process_start(app);
+    process_t *b = process_start(app);
+    assert(a != NULL && b != NULL);
+    assert(a->pid > 0 && b->pid > 0 && a->pid != b->pid);
+    assert(process_from_badge(PROCESS_BADGE(a->slot)) == a);
+    assert(process_from_badge(PROCESS_BADGE(b->slot)) == b);
+
+    sos_process_t status[MAX_PROCESSES];
+    size_t n = process_status(status, MAX_PROCESSES);
+    assert(n >= 2);
+    size_t found = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (status[i].pid == a->pid || status[i].pid == b->pid) {
+            assert(strcmp(status[i].command, app) == 0);
+            assert(status[i].size > 0);
+            found++;
+        }
+    }
+    assert(found == 2);
+    assert(process_status(status, 1) == 1);
+
+    /* A slot is reused once free, with a new pid, and the old badge finds the new process */
+    int slot = b->slot;
+    int pid = b->pid;
+    process_destroy(b);
+    assert(process_from_badge(PROCESS_BADGE(slot)) == NULL);
+    process_t *c = process_start(app);
+    assert(c != NULL);
+    assert(c->slot == slot && c->pid != pid);
+    assert(process_from_badge(PROCESS_BADGE(slot)) == c);
+
+    process_destroy(c);
+    process_destroy(a);
+}
+
+/* Average time to start a process, in microseconds, with or without the object pools. */
+static uint64_t time_spawns(const char *app, bool pooled)
+{
+    uint64_t freq = timestamp_get_freq();
+    uint64_t total = 0;
+    for (int i = 0; i < SPAWN_RUNS; i++) {
+        /* The last process destroyed recycled its objects into the pools */
+        if (!pooled) {
+            objpool_drain();
+        }
+        uint64_t start = timestamp_us(freq);
+        process_t *proc = process_start(app);
+        total += timestamp_us(freq) - start;
+        assert(proc != NULL);
+        process_destroy(proc);
+    }
+    return total / SPAWN_RUNS;
+}
+
+static void test_objpool(const char *app)
+{
+    objpool_stats_t before, stats;
+    objpool_refill();
+    objpool_stats(OBJPOOL_TCB, &before);
+    assert(before.objects == before.size);
+
+    /* Processes take their objects from the pools, and give them back */
+    process_t *proc = process_start(app);
+    assert(proc != NULL);
+    objpool_stats(OBJPOOL_TCB, &stats);
+    if (before.size > 0) {
+        assert(stats.objects == before.objects - 1);
+        assert(stats.hits == before.hits + 1);
+    }
+    process_destroy(proc);
+    objpool_stats(OBJPOOL_TCB, &stats);
+    assert(stats.objects == before.objects);
+    assert(stats.recycled == before.recycled + (before.size > 0));
+
+    /* Without the pools every object comes from the untyped allocator */
+    uint64_t pooled = time_spawns(app, true);
+    uint64_t unpooled = time_spawns(app, false);
+    objpool_refill();
+    ZF_LOGI("Spawn of %s: %lu us with object pools, %lu us without", app, pooled, unpooled);
+}
+
+static void test_templates(const char *app)
+{
+    template_stats_t before, stats;
+    template_stats(&before);
+
+    /* An app is parsed once, and found in the cache after that */
+    const process_template_t *tmpl = template_get(app);
+    assert(tmpl != NULL);
+    assert(strcmp(tmpl->name, app) == 0);
+    assert(tmpl->entry != 0 && tmpl->sysinfo != 0 && tmpl->n_segments > 0);
+    assert(template_get(app) == tmpl);
+    template_stats(&stats);
+    assert(stats.hits + stats.misses == before.hits + before.misses + 2);
+    assert(stats.hits >= before.hits + 1);
+
+    /* Starting a process uses the cached template */
+    process_t *proc = process_start(app);
+    assert(proc != NULL);
+    process_destroy(proc);
+    template_stats(&before);
+    assert(before.hits == stats.hits + 1);
+    assert(before.misses == stats.misses);
+
+    /* An invalidated template is made again */
+    template_invalidate(app);
+    template_stats(&stats);
+    assert(stats.templates == before.templates - 1);
+    tmpl = template_get(app);
+    assert(tmpl != NULL);
+    template_stats(&stats);
+    assert(stats.misses == before.misses + 1);
+    assert(stats.templates == before.templates);
+
+    /* Apps that do not exist are not cached */
+    assert(template_get("no such app") == NULL);
+    template_stats(&before);
+    assert(before.templates == stats.templates);
+}
+
+/*
+ * Memory taken by starve_frames() to run the frame table out of free frames.
+ * There may be too many untypeds to list anywhere else, so they are listed in
+ * frames taken before them.
+ */
+#define STARVE_LIST_PAGES 1024
+#define STARVE_PER_PAGE   (PAGE_SIZE_4K / sizeof(uintptr_t))
+static struct {
+    frame_ref_t list[STARVE_LIST_PAGES];
+    size_t list_pages;
+    size_t untypeds;
+    size_t frames;
+} starved;
+
+static uintptr_t *starved_entry(size_t i)
+{
+    assert(i < starved.list_pages * STARVE_PER_PAGE);
+    return &((uintptr_t *) frame_data(starved.list[i / STARVE_PER_PAGE]))[i % STARVE_PER_PAGE];
+}
+
+/* Take every free untyped and every free frame but keep, so that allocating
+ * any more frames has to evict pages. */
+static void starve_frames(size_t keep)
+{
+    ut_stats_t uts;
+    ut_stats(&uts);
+    frame_table_stats_t frames;
+    frame_table_stats(&frames);
+    size_t entries = uts.free[seL4_PageBits - seL4_EndpointBits] + frames.reserve + frames.zeroed;
+    starved.list_pages = (entries + STARVE_PER_PAGE - 1) / STARVE_PER_PAGE;
+    assert(starved.list_pages <= STARVE_LIST_PAGES);
+    for (size_t i = 0; i < starved.list_pages; i++) {
+        starved.list[i] = alloc_frame();
+        assert(starved.list[i] != NULL_FRAME);
+    }
+
+    ut_t *ut;
+    starved.untypeds = 0;
+    while ((ut = ut_alloc_4k_untyped(NULL)) != NULL) {
+        *starved_entry(starved.untypeds++) = (uintptr_t) ut;
+    }
+
+    /* The zeroed pool goes first, so the reserve is never found empty. */
+    starved.frames = 0;
+    frame_table_stats(&frames);
+    while (frames.reserve + frames.zeroed > keep) {
+        frame_ref_t frame = frames.zeroed > 0 ? alloc_zeroed_frame() : alloc_frame();
+        assert(frame != NULL_FRAME);
+        *starved_entry(starved.untypeds + starved.frames++) = frame;
+        frame_table_stats(&frames);
+    }
+}
+
+/* Give back everything taken by starve_frames(). */
+static void feed_frames(void)
+{
+    for (size_t i = 0; i < starved.untypeds; i++) {
+        ut_free((ut_t *) *starved_entry(i));
+    }
+    for (size_t i = 0; i < starved.frames; i++) {
+        free_frame(*starved_entry(starved.untypeds + i));
+    }
+    for (size_t i = 0; i < starved.list_pages; i++) {
+        free_frame(starved.list[i]);
+    }
+    starved.list_pages = 0;
+}
+
+/* Map a frame of noise, which does not compress and so goes to the swap
+ * file when evicted, at index i of the last level table at vaddr. */
+static pte_t *noise_page(addrspace_t *as, uintptr_t vaddr, size_t i)
+{
+    frame_ref_t frame = alloc_frame();
+    assert(frame != NULL_FRAME);
+    fill_noise(frame_data(frame), i + 1);
+    pte_t *pte = page_table_lookup_alloc(&as->page_table, vaddr + i * PAGE_SIZE_4K);
+    assert(pte != NULL);
+    *pte = (pte_t) { .frame = frame, .valid = 1, .writable = 1 };
+    return pte;
+}
+
+/* Check n pages went out to the swap file together, in consecutive slots. */
+static void assert_swapped_run(pte_t *first, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        assert(first[i].valid && first[i].swapped && !first[i].compressed);
+        assert(first[i].frame == first[0].frame + i);
+    }
+}
+
+static void test_swap_clusters(void)
+{
+    if (CONFIG_SOS_SWAP_CLUSTER < 3) {
+        ZF_LOGW("Swap clusters too small to test");
+        return;
+    }
+
+    /* The clock hand only finds the pages of this test */
+    frame_table_stats_t frames;
+    frame_table_stats(&frames);
+    assert(frames.pageable == 0);
+
+    addrspace_t as;
+    int error = as_init(&as, seL4_CapNull);
+    assert(error == 0);
+
+    /* Pages at these indices of one last level table: a run between a
+     * referenced and a shared page, a run between the shared page and a
+     * pinned one, and a run longer than a cluster. */
+    enum { REFERENCED = 0, RUN = 1, SHARED = 4, SHORT_RUN = 5, PINNED = 7, LONG_RUN = 8 };
+    uintptr_t base = 0x10000000;
+    size_t last = LONG_RUN + CONFIG_SOS_SWAP_CLUSTER;
+    for (size_t i = 0; i <= last; i++) {
+        noise_page(&as, base, i);
+    }
+    pte_t *pte = page_table_lookup(&as.page_table, base);
+    assert(pte != NULL);
+
+    /* The runs come first round the clock */
+    for (size_t i = 0; i <= last; i++) {
+        if (i != REFERENCED && i != SHARED && i != PINNED) {
+            frame_set_pageable(pte[i].frame, pte_to_handle(&pte[i]));
+        }
+    }
+    cspace_t *cspace = frame_table_cspace();
+    seL4_CPtr cap = cspace_alloc_slot(cspace);
+    assert(cap != seL4_CapNull);
+    error = cspace_copy(cspace, cap, cspace, frame_page(pte[REFERENCED].frame), seL4_AllRights);
+    assert(error == 0);
+    pte[REFERENCED].cap = cap;
+    pte[REFERENCED].referenced = 1;
+    frame_set_pageable(pte[REFERENCED].frame, pte_to_handle(&pte[REFERENCED]));
+    frame_set_pageable(pte[PINNED].frame, pte_to_handle(&pte[PINNED]));
+    frame_ref_pin(pte[PINNED].frame);
+    pte[SHARED].shared = 1;
+
+    pager_stats_t before, after;
+    swap_stats_t swap_start, swap_before, swap_after;
+    pager_stats(&before);
+    swap_stats(&swap_start);
+
+    /* A victim takes its unreferenced neighbours with it, up to a referenced,
+     * shared or pinned page, or as many as fit in a cluster */
+    assert(pager_evict() == 0);
+    assert_swapped_run(&pte[RUN], 3);
+    assert(!pte[REFERENCED].swapped && pte[REFERENCED].referenced && !pte[SHARED].swapped);
+    assert(pager_evict() == 0);
+    assert_swapped_run(&pte[SHORT_RUN], 2);
+    assert(!pte[SHARED].swapped && !pte[PINNED].swapped);
+    assert(pager_evict() == 0);
+    assert_swapped_run(&pte[LONG_RUN], CONFIG_SOS_SWAP_CLUSTER);
+    assert(!pte[last].swapped);
+    pager_stats(&after);
+    swap_stats(&swap_after);
+    assert(after.pageouts == before.pageouts + 3 + 2 + CONFIG_SOS_SWAP_CLUSTER);
+    assert(after.pageout_clusters == before.pageout_clusters + 3);
+    assert(after.second_chances == before.second_chances);
+    assert(swap_after.writes == swap_start.writes + 3 + 2 + CONFIG_SOS_SWAP_CLUSTER);
+    assert(swap_after.write_clusters == swap_start.write_clusters + 3);
+
+    /* Without a run of free slots in swap, the victim goes out alone. A
+     * referenced page is passed over on the way. */
+    static unsigned long reserved[(CONFIG_SOS_SWAP_SLOTS + WORD_BITS - 1) / WORD_BITS];
+    for (size_t slot = 0; slot < CONFIG_SOS_SWAP_SLOTS; slot += 2) {
+        if (swap_reserve(slot)) {
+            bf_set_bit(reserved, slot);
+        }
+    }
+    pager_release_page(&pte[last]);
+    size_t pair = last + 1;
+    for (size_t i = pair; i < pair + 2; i++) {
+        noise_page(&as, base, i);
+        frame_set_pageable(pte[i].frame, pte_to_handle(&pte[i]));
+    }
+    pager_stats(&before);
+    swap_stats(&swap_before);
+    assert(pager_evict() == 0);
+    pager_stats(&after);
+    swap_stats(&swap_after);
+    assert(pte[pair].swapped && !pte[pair + 1].swapped);
+    assert(!pte[REFERENCED].referenced);
+    assert(after.second_chances == before.second_chances + 1);
+    assert(after.pageouts == before.pageouts + 1);
+    assert(after.pageout_clusters == before.pageout_clusters + 1);
+    assert(swap_after.writes == swap_before.writes + 1);
+    for (size_t slot = 0; slot < CONFIG_SOS_SWAP_SLOTS; slot += 2) {
+        if (bf_get_bit(reserved, slot)) {
+            bf_clr_bit(reserved, slot);
+            swap_free(slot);
+        }
+    }
+
+    /* A page is read back in with the neighbours written out with it, which
+     * are left unreferenced */
+    pager_stats(&before);
+    swap_stats(&swap_before);
+    assert(pager_page_in(&pte[RUN + 1]) != NULL_FRAME);
+    pager_stats(&after);
+    swap_stats(&swap_after);
+    for (size_t i = RUN; i < RUN + 3; i++) {
+        assert(!pte[i].swapped && !pte[i].referenced);
+        assert(is_noise(frame_data(pte[i].frame), i + 1));
+    }
+    assert(after.pageins == before.pageins + 3);
+    assert(after.pagein_clusters == before.pagein_clusters + 1);
+    assert(after.prefetches == before.prefetches + 2);
+    assert(swap_after.reads == swap_before.reads + 3);
+    assert(swap_after.read_clusters == swap_before.read_clusters + 1);
+
+    /* Neighbours are only read into free frames, never at the cost of evicting
+     * other pages */
+    starve_frames(1);
+    pager_stats(&before);
+    assert(pager_page_in(&pte[SHORT_RUN]) != NULL_FRAME);
+    pager_stats(&after);
+    feed_frames();
+    assert(!pte[SHORT_RUN].swapped && pte[SHORT_RUN + 1].swapped);
+    assert(is_noise(frame_data(pte[SHORT_RUN].frame), SHORT_RUN + 1));
+    assert(after.pageins == before.pageins + 1);
+    assert(after.pagein_clusters == before.pagein_clusters + 1);
+    assert(after.prefetches == before.prefetches);
+    assert(after.pageouts == before.pageouts);
+
+    frame_ref_unpin(pte[PINNED].frame);
+    as_destroy(&as);
+    swap_stats(&swap_after);
+    assert(swap_after.used == swap_start.used);
+}
+
+void run_process_tests(cspace_t *cspace, const char *app)
+{
+    test_templates(app);
+    ZF_LOGI("Process template test passed!");
+
+    test_process_table(app);
+    ZF_LOGI("Process table test passed!");
+
+    test_objpool(app);
+    ZF_LOGI("Object pool test passed!");
+
+    test_process_teardown(cspace, app);
+    ZF_LOGI("Process teardown test passed!");
+
+    test_swap_clusters();
+    ZF_LOGI("Swap cluster test passed!");
 }
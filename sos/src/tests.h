@@ -12,3 +12,7 @@
 #pragma once
 
 void run_tests(cspace_t *cspace);
+
+/* Tests that start processes or use the swap file, to be run once processes
+ * can be created and the network is up. */
+void run_process_tests(cspace_t *cspace, const char *app);
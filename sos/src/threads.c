@@ -21,6 +21,7 @@
 #include "vmem_layout.h"
 #include "utils.h"
 #include "mapping.h"
+#include "objpool.h"
 
 #define SOS_THREAD_PRIORITY     (0)
 
@@ -103,8 +104,7 @@ sos_thread_t *thread_create(thread_main_f function, void *arg, seL4_Word badge,
     new_thread->badge = badge;
 
     /* Create an IPC buffer */
-    new_thread->ipc_buffer_ut = alloc_retype(&new_thread->ipc_buffer,
-                                             seL4_ARM_SmallPageObject, seL4_PageBits);
+    new_thread->ipc_buffer_ut = objpool_alloc(OBJPOOL_PAGE, &new_thread->ipc_buffer);
     if (new_thread->ipc_buffer_ut == NULL) {
         ZF_LOGE("Failed to alloc ipc buffer ut");
         return NULL;
@@ -140,7 +140,7 @@ sos_thread_t *thread_create(thread_main_f function, void *arg, seL4_Word badge,
     }
 
     /* Create a new TCB object */
-    new_thread->tcb_ut = alloc_retype(&new_thread->tcb, seL4_TCBObject, seL4_TCBBits);
+    new_thread->tcb_ut = objpool_alloc(OBJPOOL_TCB, &new_thread->tcb);
     if (new_thread->tcb_ut == NULL) {
         ZF_LOGE("Failed to alloc tcb ut");
         return NULL;
@@ -157,9 +157,7 @@ sos_thread_t *thread_create(thread_main_f function, void *arg, seL4_Word badge,
     }
 
     /* Create scheduling context */
-    new_thread->sched_context_ut = alloc_retype(&new_thread->sched_context,
-                                                seL4_SchedContextObject,
-                                                seL4_MinSchedContextBits);
+    new_thread->sched_context_ut = objpool_alloc(OBJPOOL_SCHED_CONTEXT, &new_thread->sched_context);
     if (new_thread->sched_context_ut == NULL) {
         ZF_LOGE("Failed to alloc sched context ut");
         return NULL;
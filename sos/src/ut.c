@@ -21,19 +21,81 @@
 /* this global variable tracks our ut table */
 static ut_table_t table;
 
+/* The two halves of a split untyped are held in a pair of adjacent nodes, aligned
+ * to the size of the pair, so each can find the other. */
+compile_time_assert("ut_t is a power of two in size", (sizeof(ut_t) & (sizeof(ut_t) - 1)) == 0);
+
+/* Index of an entry, counting from the start of the table, 0 for none. The split untypeds
+ * are allocated from frames mapped after the table, so always have an index. */
+static inline uint32_t ut_index(ut_t *node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+    assert(node >= table.untypeds && (size_t)(node - table.untypeds) < UINT32_MAX);
+    return node - table.untypeds + 1;
+}
+
+static inline ut_t *ut_from_index(uint32_t index)
+{
+    return index == 0 ? NULL : &table.untypeds[index - 1];
+}
+
 static void push(ut_t **head, ut_t *new)
 {
-    new->next = *head;
+    new->next = ut_index(*head);
     *head = new;
 }
 
 static ut_t *pop(ut_t **head)
 {
     ut_t *popped = *head;
-    *head = popped->next;
+    *head = ut_from_index(popped->next);
     return popped;
 }
 
+/* add an untyped to the free list for its size */
+static void free_list_add(ut_t *node)
+{
+    size_t index = SIZE_BITS_TO_INDEX(node->size_bits);
+    ut_t **head = &table.free_untypeds[index];
+    node->prev = 0;
+    node->next = ut_index(*head);
+    if (*head != NULL) {
+        (*head)->prev = ut_index(node);
+    }
+    *head = node;
+    node->free = 1;
+    table.n_free[index]++;
+}
+
+/* take an untyped off the free list for its size */
+static void free_list_remove(ut_t *node)
+{
+    assert(node->free);
+    size_t index = SIZE_BITS_TO_INDEX(node->size_bits);
+    ut_t *prev = ut_from_index(node->prev);
+    ut_t *next = ut_from_index(node->next);
+    if (prev != NULL) {
+        prev->next = node->next;
+    } else {
+        table.free_untypeds[index] = next;
+    }
+    if (next != NULL) {
+        next->prev = node->prev;
+    }
+    node->next = 0;
+    node->prev = 0;
+    node->free = 0;
+    table.n_free[index]--;
+}
+
+static inline ut_t *buddy(ut_t *node)
+{
+    assert(node->parent != 0);
+    return (ut_t *)((uintptr_t) node ^ sizeof(ut_t));
+}
+
 static inline seL4_Word ut_to_paddr(ut_t *ut)
 {
     return (ut - table.untypeds) * PAGE_SIZE_4K + table.first_paddr;
@@ -65,7 +127,6 @@ size_t ut_size(void)
 
 void ut_add_untyped_range(seL4_Word paddr, seL4_CPtr cap, size_t n, bool device)
 {
-    ut_t **list = &table.free_untypeds[SIZE_BITS_TO_INDEX(seL4_PageBits)];
     for (size_t i = 0; i < n; i++) {
         ut_t *node = paddr_to_ut(paddr + (i * PAGE_SIZE_4K));
         node->cap = cap;
@@ -73,21 +134,48 @@ void ut_add_untyped_range(seL4_Word paddr, seL4_CPtr cap, size_t n, bool device)
         cap++;
         if (!device) {
             node->size_bits = seL4_PageBits;
-            push(list, node);
+            free_list_add(node);
             table.n_4k_untyped++;
         }
     }
 }
 
+void ut_add_large_untyped(seL4_Word paddr, seL4_CPtr cap)
+{
+    assert(IS_ALIGNED(paddr, seL4_LargePageBits));
+    ut_t *node = paddr_to_ut(paddr);
+    node->cap = cap;
+    node->valid = 1;
+    node->size_bits = seL4_LargePageBits;
+    free_list_add(node);
+    table.n_large_untyped++;
+}
+
+ut_t *ut_alloc_2m_untyped(uintptr_t *paddr)
+{
+    ut_t *n = table.free_untypeds[SIZE_BITS_TO_INDEX(seL4_LargePageBits)];
+    if (n == NULL) {
+        ZF_LOGD("out of large untypeds");
+        return NULL;
+    }
+
+    free_list_remove(n);
+    if (paddr) {
+        *paddr = ut_to_paddr(n);
+    }
+    ZF_LOGD("Allocated large %lx, cap %lx", ut_to_paddr(n), (seL4_CPtr) n->cap);
+    return n;
+}
+
 ut_t *ut_alloc_4k_untyped(uintptr_t *paddr)
 {
-    ut_t **list = &table.free_untypeds[SIZE_BITS_TO_INDEX(seL4_PageBits)];
-    if (*list == NULL) {
+    ut_t *n = table.free_untypeds[SIZE_BITS_TO_INDEX(seL4_PageBits)];
+    if (n == NULL) {
         ZF_LOGE("out of memory");
         return NULL;
     }
 
-    ut_t *n = pop(list);
+    free_list_remove(n);
     if (paddr) {
         *paddr = ut_to_paddr(n);
     }
@@ -95,10 +183,10 @@ ut_t *ut_alloc_4k_untyped(uintptr_t *paddr)
     return n;
 }
 
-/* ensure there are at least two spare free structures so we can split an untyped */
+/* ensure there is at least one spare pair of free structures so we can split an untyped */
 static bool ensure_new_structures(cspace_t *cspace)
 {
-    if (table.free_structures == NULL || table.free_structures->next == 0) {
+    if (table.free_structures == NULL) {
         /* we need to allocate more spare ut objects */
         ut_t *frame = ut_alloc_4k_untyped(NULL);
         if (frame == NULL) {
@@ -129,8 +217,8 @@ static bool ensure_new_structures(cspace_t *cspace)
             return false;
         }
 
-        /* now add all the new uts structures to the free list */
-        for (size_t i = 0; i < PAGE_SIZE_4K / sizeof(ut_t); i++) {
+        /* now add all the new uts structures to the free list, in pairs */
+        for (size_t i = 0; i < PAGE_SIZE_4K / sizeof(ut_t); i += 2) {
             push(&table.free_structures, &new_uts[i]);
         }
     }
@@ -138,11 +226,74 @@ static bool ensure_new_structures(cspace_t *cspace)
 
 }
 
+/* split an untyped into two halves, adding both to the free list for their size */
+static bool split(ut_t *larger, cspace_t *cspace)
+{
+    size_t size_bits = larger->size_bits - 1;
+
+    /* check we have enough memory to account for our new uts */
+    if (!ensure_new_structures(cspace)) {
+        return false;
+    }
+    ut_t *halves = pop(&table.free_structures);
+
+    /* now ask the cspace to retype for us */
+    for (int i = 0; i < 2; i++) {
+        halves[i] = (ut_t) {
+            .cap = cspace_alloc_slot(cspace),
+            .valid = 1,
+            .size_bits = size_bits,
+            .parent = ut_index(larger),
+        };
+        seL4_Error err = seL4_NoError;
+        if (halves[i].cap == seL4_CapNull) {
+            err = seL4_NotEnoughMemory;
+        } else {
+            err = cspace_untyped_retype(cspace, larger->cap, halves[i].cap, seL4_UntypedObject, size_bits);
+        }
+        if (err) {
+            for (int j = 0; j <= i; j++) {
+                if (halves[j].cap != seL4_CapNull) {
+                    if (j < i) {
+                        cspace_delete(cspace, halves[j].cap);
+                    }
+                    cspace_free_slot(cspace, halves[j].cap);
+                }
+            }
+            push(&table.free_structures, halves);
+            return false;
+        }
+    }
+
+    table.n_split[SIZE_BITS_TO_INDEX(larger->size_bits)]++;
+    free_list_add(&halves[1]);
+    free_list_add(&halves[0]);
+    return true;
+}
+
+/* merge a free untyped with its free buddy, returning the untyped they were split from */
+static ut_t *merge(ut_t *node)
+{
+    ut_t *halves = (ut_t *) ROUND_DOWN((uintptr_t) node, 2 * sizeof(ut_t));
+    ut_t *parent = ut_from_index(node->parent);
+
+    /* with both halves deleted, the larger untyped is reset on its next retype */
+    for (int i = 0; i < 2; i++) {
+        cspace_delete(table.cspace, halves[i].cap);
+        cspace_free_slot(table.cspace, halves[i].cap);
+        halves[i] = (ut_t) {};
+    }
+    push(&table.free_structures, halves);
+
+    table.n_split[SIZE_BITS_TO_INDEX(parent->size_bits)]--;
+    return parent;
+}
+
 ut_t *ut_alloc(size_t size_bits, cspace_t *cspace)
 {
     /* check we can handle the size */
-    if (size_bits > seL4_PageBits) {
-        ZF_LOGE("UT table can only allocate untypeds <= 4K in size");
+    if (size_bits > seL4_LargePageBits) {
+        ZF_LOGE("UT table can only allocate untypeds <= 2M in size");
         return NULL;
     }
 
@@ -151,74 +302,51 @@ ut_t *ut_alloc(size_t size_bits, cspace_t *cspace)
         return NULL;
     }
 
-    if (size_bits == seL4_PageBits) {
-        return ut_alloc_4k_untyped(NULL);
-    }
-
     ut_t **list = &table.free_untypeds[SIZE_BITS_TO_INDEX(size_bits)];
     if (*list == NULL) {
-        /* need to retype a bigger object into the size requested */
-        ut_t *larger = ut_alloc(size_bits + 1, cspace);
-        if (larger == NULL) {
-            return NULL;
-        }
-
-        /* check we have enough memory to account for our new uts */
-        if (!ensure_new_structures(cspace)) {
-            ut_free(larger);
-            return NULL;
-        }
-
-        /* now ask the cspace to retype for us */
-        ut_t *new1 = pop(&table.free_structures);
-        new1->cap = cspace_alloc_slot(cspace);
-        if (new1->cap == seL4_CapNull) {
-            ut_free(larger);
-            return NULL;
-        }
-        new1->size_bits = size_bits;
-
-        ut_t *new2 = pop(&table.free_structures);
-        new2->cap = cspace_alloc_slot(cspace);
-        if (new2->cap == seL4_CapNull) {
-            cspace_free_slot(cspace, new1->cap);
-            ut_free(larger);
+        if (size_bits == seL4_LargePageBits) {
+            ZF_LOGE("out of large untypeds");
             return NULL;
         }
-        new2->size_bits = size_bits;
 
-        seL4_Error err = cspace_untyped_retype(cspace, larger->cap, new1->cap, seL4_UntypedObject, size_bits);
-        if (err) {
-            cspace_free_slot(cspace, new1->cap);
-            cspace_free_slot(cspace, new2->cap);
-            push(&table.free_structures, new1);
-            ut_free(larger);
+        /* need to retype a bigger object into the size requested */
+        ut_t *larger = ut_alloc(size_bits + 1, cspace);
+        if (larger == NULL) {
             return NULL;
         }
 
-        err = cspace_untyped_retype(cspace, larger->cap, new2->cap, seL4_UntypedObject, size_bits);
-        if (err) {
-            cspace_delete(cspace, new1->cap);
-            cspace_free_slot(cspace, new1->cap);
-            cspace_free_slot(cspace, new2->cap);
-            push(&table.free_structures, new1);
-            push(&table.free_structures, new2);
+        assert(table.cspace == NULL || table.cspace == cspace);
+        table.cspace = cspace;
+        if (!split(larger, cspace)) {
             ut_free(larger);
             return NULL;
         }
-
-        push(list, new1);
-        push(list, new2);
         /* finally, we now know there are untyped objects for the requested size */
     }
 
-    return pop(list);
+    ut_t *node = *list;
+    free_list_remove(node);
+    return node;
 }
 
 void ut_free(ut_t *node)
 {
-    ut_t **list = &table.free_untypeds[SIZE_BITS_TO_INDEX(node->size_bits)];
-    push(list, node);
+    assert(!node->free);
+
+    /* merge with the other half for as long as it is free */
+    while (node->parent != 0 && buddy(node)->free) {
+        free_list_remove(buddy(node));
+        node = merge(node);
+    }
+    free_list_add(node);
+}
+
+void ut_stats(ut_stats_t *stats)
+{
+    for (size_t i = 0; i < N_UNTYPED_LISTS; i++) {
+        stats->free[i] = table.n_free[i];
+        stats->split[i] = table.n_split[i];
+    }
 }
 
 ut_t *ut_alloc_4k_device(uintptr_t paddr)
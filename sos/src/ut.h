@@ -12,9 +12,11 @@
 #pragma once
 
 /*
- * This is an untyped object allocator which tracks objects of 4k and less in size.
+ * This is an untyped object allocator which tracks objects of up to a large page in size.
  *
- * You may extend this allocator to track further details about 4k frames.
+ * Objects of 4k are preallocated at boot, as are the large page sized untypeds set aside for
+ * bigger objects. Other sizes are split on demand from the next size up, buddy style, and are
+ * merged back together when both halves are free again.
  */
 
 #include <stdint.h>
@@ -39,14 +41,22 @@ PACKED struct ut {
      * we can use the remaining bits to store other information */
     seL4_Untyped cap : 20;
     unsigned long valid : 1;
-    unsigned long size_bits : 4;
-    unsigned long unused : 39;
-    ut_t *next; // pointer to next item in list
+    unsigned long size_bits : 5;
+    /* the untyped is on the free list for its size */
+    unsigned long free : 1;
+    unsigned long unused : 5;
+    /* Entries are linked by their index in the SOS ut table region, which every entry is
+     * allocated from, so the entry stays 16 bytes. 0 is no entry. */
+    uint32_t next; // next item in list
+    uint32_t prev; // previous item in list
+    /* the untyped this was split from, 0 if it was added to the table */
+    uint32_t parent;
 };
 compile_time_assert("Small cspace bits", INITIAL_TASK_CSPACE_BITS == 20);
+compile_time_assert("ut_t is 16 bytes", sizeof(ut_t) == 16);
 
 /* list of valid object sizes we can allocate */
-#define N_UNTYPED_LISTS (seL4_PageBits - seL4_EndpointBits + 1)
+#define N_UNTYPED_LISTS (seL4_LargePageBits - seL4_EndpointBits + 1)
 
 /* Untyped memory table */
 typedef struct {
@@ -54,18 +64,35 @@ typedef struct {
     seL4_Word first_paddr;
     /* region of 4K untypeds - one for each untyped . */
     ut_t *untypeds;
-    /* list of free untypeds, one list per object size. The untyped list at seL4_PageBits
-     * is a free list in the untypeds region. The rest are sublists, with bookkeeping data allocated
-     * from an untyped */
+    /* list of free untypeds, one list per object size. The lists at seL4_PageBits and
+     * seL4_LargePageBits start out with entries in the untypeds region, large page untypeds being
+     * tracked by the entry of their first 4K. The rest are split from bigger untypeds, with
+     * bookkeeping data allocated from an untyped */
     ut_t *free_untypeds[N_UNTYPED_LISTS];
+    /* the number of free untypeds on each list */
+    size_t n_free[N_UNTYPED_LISTS];
+    /* the number of untypeds of each size currently split into two smaller ones */
+    size_t n_split[N_UNTYPED_LISTS];
     /* the number of non-device 4k untypeds this table is managing */
     size_t n_4k_untyped;
-    /* list of unused nodes which can be used to populate untyped lists
-     * of untyped objects < 4K in size, where the bookkeping data is allocated on demand from the 4k
-     * untypeds free list */
+    /* the number of large page untypeds this table is managing */
+    size_t n_large_untyped;
+    /* list of unused pairs of nodes which can be used to hold the two halves of a split untyped,
+     * where the bookkeping data is allocated on demand from the 4k untypeds free list. Each pair
+     * is listed by its first node */
     ut_t *free_structures;
+    /* the cspace split untypeds are allocated in, used to delete them again when merged */
+    cspace_t *cspace;
 } ut_table_t;
 
+/* Per size statistics of the allocator, indexed by size_bits - seL4_EndpointBits. */
+typedef struct {
+    /* free untypeds of each size */
+    size_t free[N_UNTYPED_LISTS];
+    /* untypeds of each size that are split into smaller ones */
+    size_t split[N_UNTYPED_LISTS];
+} ut_stats_t;
+
 /* return the size (in 4K pages) of the table required to cover a specific region */
 size_t ut_pages_for_region(ut_region_t region);
 
@@ -101,6 +128,14 @@ size_t ut_size(void);
  */
 void ut_add_untyped_range(seL4_Word paddr, seL4_CPtr cap, size_t n, bool device);
 
+/* Add a large page sized untyped to the table. The paddr must be in the range provided to
+ * ut_init with the region parameter, and must not overlap any range of 4k untypeds.
+ *
+ * @param paddr  the physical address of the untyped, aligned to its size
+ * @param cap    the cptr of the untyped, which is seL4_LargePageBits in size
+ */
+void ut_add_large_untyped(seL4_Word paddr, seL4_CPtr cap);
+
 /**
  * Allocate an untyped object of 4K in size. This operation will *never* result in a
  * cspace allocation as all 4K objects are pre-allocated.
@@ -115,7 +150,17 @@ void ut_add_untyped_range(seL4_Word paddr, seL4_CPtr cap, size_t n, bool device)
 ut_t *ut_alloc_4k_untyped(uintptr_t *paddr);
 
 /**
- * Allocate an untyped of a specific size < seL4_PageBits.
+ * Allocate a large page (2MiB) sized untyped. Only untypeds set aside at boot with
+ * ut_add_large_untyped are used, so this operation never results in a cspace allocation.
+ *
+ * @param paddr[out]  return the physical address of the untyped memory here. NULL
+ *                    if no value should be returned.
+ * @return            the table entry of the untyped, NULL if none are left.
+ */
+ut_t *ut_alloc_2m_untyped(uintptr_t *paddr);
+
+/**
+ * Allocate an untyped of a specific size <= seL4_LargePageBits.
  *
  * This operation may result in cspace allocations, as we may need to retype untyped
  * objects of bigger sizes until we get the size we need, if free untyped objects of
@@ -123,6 +168,12 @@ ut_t *ut_alloc_4k_untyped(uintptr_t *paddr);
  * cspace, which must not call back into this function to avoid infinite recursion. The
  * cspace *can* call into ut_alloc_alloc_4k_untyped.
  *
+ * Objects bigger than 4K are split from the large page untypeds added with
+ * ut_add_large_untyped, as are 4K objects once the preallocated ones run out. The
+ * other 4K untypeds are never merged, so at most CONFIG_SOS_LARGE_PAGES * 2MiB of
+ * memory is ever available in objects bigger than 4K, less any large untypeds taken
+ * whole by ut_alloc_2m_untyped.
+ *
  * @param size_bits    the amount of contiguous and aligned memory to reserve (2^size_bits)
  * @param cspace_alloc a cspace which can be used to allocate slots.
  * @return             A pointer which can be used to free the allocation.
@@ -133,12 +184,12 @@ ut_t *ut_alloc(size_t size_bits, cspace_t *cspace_alloc);
 
 /**
  * Mark an untyped object as free. This will make the object available for reallocation.
- * This allocator does not remerge untyped objects: if you allocate your entire
- * set of memory as objects < seL4_PageBits, you will not be able to allocate any
- * bigger objects. It is possible to merge untypeds, but this is not implemented to
- * reduce complexity.
+ * If the other half of the untyped it was split from is also free, the two are merged back
+ * together, repeatedly, so memory split into small objects can be used for bigger ones again.
+ * Any objects retyped from the untyped must have been deleted before it is freed.
  *
- * Allocations made with ut_alloc_frame and ut_alloc can both be freed with this function.
+ * Allocations made with ut_alloc_4k_untyped, ut_alloc_2m_untyped and ut_alloc can all be freed
+ * with this function.
  *
  * @param ut        the ut pointer returned by ut_alloc or ut_alloc_4k_untyped
  * @param size_bits the size to the memory to free, that was used for the allocation.
@@ -153,3 +204,10 @@ void ut_free(ut_t *ut);
  * @return      cptr to the allocated untyped. seL4_CapNull if the paddr is not available.
  */
 ut_t *ut_alloc_4k_device(uintptr_t paddr);
+
+/**
+ * Report the free and split untypeds of each size, showing how fragmented memory is.
+ *
+ * @param stats[out] the statistics of the allocator.
+ */
+void ut_stats(ut_stats_t *stats);
@@ -24,10 +24,18 @@
 #define SOS_STACK_PAGES      100
 #define SOS_UT_TABLE         (0x8000000000)
 #define SOS_FRAME_TABLE      (0x8100000000)
+#define SOS_FRAME_META       (0x8180000000)
 #define SOS_FRAME_DATA       (0x8200000000)
+#define SOS_TEST_START       (0x8300000000)
+/* Chunks of DMA memory added after boot */
+#define SOS_DMA_POOL         (0x8400000000)
+/* Large pages backing process memory, see addrspace.c */
+#define SOS_USER_LARGE_PAGES (0x8500000000)
 
 /* Constants for how SOS will layout the address space of any processes it loads up */
 #define PROCESS_STACK_TOP   (0x90000000)
 #define PROCESS_IPC_BUFFER  (0xA0000000)
 #define PROCESS_VMEM_START  (0xC0000000)
+/* mmap regions are placed downwards from here */
+#define PROCESS_MMAP_TOP    (0x7000000000)
 
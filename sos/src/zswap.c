@@ -0,0 +1,173 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#include "zswap.h"
+#include "lz.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <utils/util.h>
+#include <cspace/bitfield.h>
+#include <sos/gen_config.h>
+
+/* Compressed pages are stored in whole blocks, allocated from a bitmap of a word per frame. */
+#define ZSWAP_BLOCK_SIZE        (PAGE_SIZE_4K / WORD_BITS)
+#define ZSWAP_BLOCKS_PER_FRAME  WORD_BITS
+/* Pages that compress to more blocks than this are not worth keeping in memory. */
+#define ZSWAP_MAX_BLOCKS        (ZSWAP_BLOCKS_PER_FRAME * 3 / 4)
+/* Every entry takes at least a block, so this many are never exhausted. */
+#define ZSWAP_ENTRIES           (CONFIG_SOS_ZSWAP_FRAMES * ZSWAP_BLOCKS_PER_FRAME)
+#define ZSWAP_ENTRY_WORDS       ((ZSWAP_ENTRIES + WORD_BITS - 1) / WORD_BITS)
+
+/* Entries are stored in page table entries alongside frame references. */
+compile_time_assert("Compressed store entries fit in a pte", ZSWAP_ENTRIES <= BIT(19));
+compile_time_assert("Compressed store frames fit in an entry", CONFIG_SOS_ZSWAP_FRAMES <= UINT16_MAX);
+
+/* A compressed page. */
+typedef struct {
+    /* Index of the frame of the store holding the page. */
+    uint16_t frame;
+    /* Blocks of the frame the page is held in. */
+    uint8_t block;
+    uint8_t blocks;
+    /* Compressed length of the page. */
+    uint16_t len;
+} zswap_entry_t;
+
+static struct {
+    /* Frames of the store, NULL_FRAME where not in use. */
+    frame_ref_t frames[CONFIG_SOS_ZSWAP_FRAMES];
+    /* Bitmap of the blocks in use in each frame. */
+    unsigned long blocks[CONFIG_SOS_ZSWAP_FRAMES];
+    zswap_entry_t entries[ZSWAP_ENTRIES];
+    /* Bitmap of the entries in use. */
+    unsigned long used[ZSWAP_ENTRY_WORDS];
+    size_t n_frames;
+    size_t pages;
+    size_t bytes;
+    size_t stores;
+    size_t loads;
+    size_t rejects;
+    size_t full;
+    /* Where a page is compressed to before being stored. */
+    unsigned char buf[ZSWAP_MAX_BLOCKS * ZSWAP_BLOCK_SIZE];
+} zswap;
+
+/* Find a run of free blocks in a frame. @return the first block, or -1 if there is none. */
+static int find_blocks(unsigned long used, size_t n)
+{
+    unsigned long mask = n == WORD_BITS ? ~0ul : MASK(n);
+    for (size_t block = 0; block + n <= ZSWAP_BLOCKS_PER_FRAME; block++) {
+        if ((used & (mask << block)) == 0) {
+            return block;
+        }
+    }
+    return -1;
+}
+
+/* Find room for a page of n blocks, taking on frame if the store has none. */
+static bool alloc_blocks(size_t n, frame_ref_t frame, zswap_entry_t *entry)
+{
+    size_t free_index = CONFIG_SOS_ZSWAP_FRAMES;
+    for (size_t i = 0; i < CONFIG_SOS_ZSWAP_FRAMES; i++) {
+        if (zswap.frames[i] == NULL_FRAME) {
+            free_index = MIN(free_index, i);
+            continue;
+        }
+        int block = find_blocks(zswap.blocks[i], n);
+        if (block >= 0) {
+            *entry = (zswap_entry_t) { .frame = i, .block = block, .blocks = n };
+            return true;
+        }
+    }
+
+    if (free_index == CONFIG_SOS_ZSWAP_FRAMES) {
+        return false;
+    }
+    /* The page is compressed already, so its frame can be reused */
+    frame_set_unpageable(frame);
+    zswap.frames[free_index] = frame_ref_get(frame);
+    zswap.n_frames += 1;
+    *entry = (zswap_entry_t) { .frame = free_index, .block = 0, .blocks = n };
+    return true;
+}
+
+ssize_t zswap_store(frame_ref_t frame)
+{
+    size_t len = lz_compress(frame_data(frame), PAGE_SIZE_4K, zswap.buf, sizeof(zswap.buf));
+    if (len == 0) {
+        zswap.rejects += 1;
+        return -1;
+    }
+
+    size_t index = bf_first_free(ZSWAP_ENTRY_WORDS, zswap.used);
+    assert(index < ZSWAP_ENTRIES);
+    zswap_entry_t *entry = &zswap.entries[index];
+    if (!alloc_blocks(ROUND_UP(len, ZSWAP_BLOCK_SIZE) / ZSWAP_BLOCK_SIZE, frame, entry)) {
+        zswap.full += 1;
+        return -1;
+    }
+
+    entry->len = len;
+    zswap.blocks[entry->frame] |= MASK(entry->blocks) << entry->block;
+    memcpy(frame_data(zswap.frames[entry->frame]) + entry->block * ZSWAP_BLOCK_SIZE, zswap.buf, len);
+    bf_set_bit(zswap.used, index);
+    zswap.pages += 1;
+    zswap.bytes += len;
+    zswap.stores += 1;
+    return index;
+}
+
+int zswap_load(size_t index, unsigned char *data)
+{
+    assert(bf_get_bit(zswap.used, index));
+    zswap_entry_t *entry = &zswap.entries[index];
+    unsigned char *src = frame_data(zswap.frames[entry->frame]) + entry->block * ZSWAP_BLOCK_SIZE;
+    if (lz_decompress(src, entry->len, data, PAGE_SIZE_4K) != PAGE_SIZE_4K) {
+        ZF_LOGE("Compressed page %zu is corrupt", index);
+        return -1;
+    }
+
+    zswap.loads += 1;
+    zswap_free(index);
+    return 0;
+}
+
+void zswap_free(size_t index)
+{
+    assert(bf_get_bit(zswap.used, index));
+    zswap_entry_t *entry = &zswap.entries[index];
+    zswap.blocks[entry->frame] &= ~(MASK(entry->blocks) << entry->block);
+    if (zswap.blocks[entry->frame] == 0) {
+        frame_ref_put(zswap.frames[entry->frame]);
+        zswap.frames[entry->frame] = NULL_FRAME;
+        zswap.n_frames -= 1;
+    }
+
+    bf_clr_bit(zswap.used, index);
+    zswap.pages -= 1;
+    zswap.bytes -= entry->len;
+}
+
+void zswap_stats(zswap_stats_t *stats)
+{
+    *stats = (zswap_stats_t) {
+        .frames = zswap.n_frames,
+        .pages = zswap.pages,
+        .bytes = zswap.bytes,
+        .stores = zswap.stores,
+        .loads = zswap.loads,
+        .rejects = zswap.rejects,
+        .full = zswap.full,
+    };
+}
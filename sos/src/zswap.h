@@ -0,0 +1,68 @@
+/*
+ * Copyright 2019, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "frame_table.h"
+
+/*
+ * The compressed store keeps evicted pages in memory, compressed, in front
+ * of the swap file. Reading a page back from it costs a decompression rather
+ * than a round trip to the NFS server.
+ *
+ * Compressed pages are packed into frames of the store, which has at most
+ * CONFIG_SOS_ZSWAP_FRAMES of them. The store only grows during eviction,
+ * when there are no free frames, so it takes over the frame of the page
+ * being stored. A frame is returned to the frame table once it holds no
+ * more pages. Pages that do not compress well, or do not fit, are left for
+ * the swap file.
+ */
+
+/* Counters describing the compressed store. */
+typedef struct {
+    /* Frames holding compressed pages. */
+    size_t frames;
+    /* Pages held, and the bytes they are compressed to. */
+    size_t pages;
+    size_t bytes;
+    /* Pages stored, and read back. */
+    size_t stores;
+    size_t loads;
+    /* Pages turned away as they did not compress well enough. */
+    size_t rejects;
+    /* Pages turned away as the store was full. */
+    size_t full;
+} zswap_stats_t;
+
+/*
+ * Compress a page into the store. The store may keep the frame of the page
+ * to hold compressed pages, in which case it takes a reference to it.
+ *
+ * @return the entry holding the page, or -1 if it was not stored.
+ */
+ssize_t zswap_store(frame_ref_t frame);
+
+/*
+ * Read a page back from the store, releasing its entry.
+ *
+ * @return 0 on success, -1 if the page could not be decompressed, in which
+ *         case the entry is kept.
+ */
+int zswap_load(size_t entry, unsigned char *data);
+
+/* Release an entry without reading it back. */
+void zswap_free(size_t entry);
+
+/* Get the current counters of the compressed store. */
+void zswap_stats(zswap_stats_t *stats);